@@ -11,9 +11,23 @@ TEMPLATE = lib
 CONFIG += staticlib
 CONFIG += c++11
 
-SOURCES += qtaes.cpp
-
-HEADERS += qtaes.h
+SOURCES += qtaes.cpp \
+    qtkdf.cpp \
+    qtbase64.cpp \
+    qtaesstream.cpp \
+    qtsecurememory.cpp \
+    qtcpufeatures.cpp \
+    qthash.cpp \
+    qtsessionkey.cpp
+
+HEADERS += qtaes.h \
+    qtkdf.h \
+    qtbase64.h \
+    qtaesstream.h \
+    qtsecurememory.h \
+    qtcpufeatures.h \
+    qthash.h \
+    qtsessionkey.h
 unix {
     target.path = /usr/lib
     INSTALLS += target
@@ -23,8 +37,13 @@ unix {
 }
 
 win32 {
-    LIBS += -LC:/OpenSSL-Win32/lib/MinGW/ -leay32
-    INCLUDEPATH += C:/OpenSSL-Win32/include
+    # needs OpenSSL 1.1 or 3.x (ChaCha20-Poly1305, OpenSSL_version, EVP_KDF),
+    # the old OpenSSL-Win32 1.0 builds won't link. WIN_DEPS is a MinGW prefix
+    # with libcrypto and zlib, MSYS2 mingw64 by default; qmake WIN_DEPS=<prefix>
+    # to change it
+    isEmpty(WIN_DEPS): WIN_DEPS = C:/msys64/mingw64
+    LIBS += -L$$WIN_DEPS/lib -lcrypto
+    INCLUDEPATH += $$WIN_DEPS/include
 }
 
 CONFIG(release, debug|release):DEFINES += QT_NO_DEBUG_OUTPUT
@@ -1,78 +1,562 @@
 #include "qtaes.h"
 
 #include <QCryptographicHash>
+#include <QDebug>
+#include <QMutexLocker>
+#include <QReadLocker>
+#include <QWriteLocker>
+#include <QVarLengthArray>
+#include <QVector>
+#include "qtbase64.h"
+#include "qtcpufeatures.h"
+#include "qthash.h"
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+
+// domain separation, the index key never encrypts anything
+static const char BLIND_KEY_LABEL[] = "RememberKey blind index";
+
+// AEAD records: '$' + base64(version | nonce | ciphertext | tag)
+// '$' is outside the base64 alphabet, so it never starts a legacy ECB record
+static const char AEAD_PREFIX = '$';
+static const int AEAD_NONCE_SIZE = 12;
+static const int AEAD_TAG_SIZE = 16;
+static const int AEAD_OVERHEAD = 1 + AEAD_NONCE_SIZE + AEAD_TAG_SIZE;
+
+static int paddedLength(int len)
+{
+    // padding 0
+    return (len + AES_BLOCK_SIZE - 1) / AES_BLOCK_SIZE * AES_BLOCK_SIZE;
+}
+
+static const EVP_CIPHER *cipherForMode(QtAes::CipherMode mode)
+{
+    switch(mode) {
+    case QtAes::AesGcm:
+        return EVP_aes_256_gcm();
+    case QtAes::ChaCha20Poly1305:
+        return EVP_chacha20_poly1305();
+    default:
+        return EVP_aes_128_ecb();
+    }
+}
+
+QtAes::QtAes() :
+    cipherMode(detectCipherMode()), keyGeneration(0)
+{
+}
+
+QtAes::~QtAes()
+{
+    freeContexts();
+}
 
 void QtAes::initialize(const QString &key)
 {
-    QCryptographicHash hash(QCryptographicHash::Md5);
-    hash.addData(key.toUtf8());
-    QByteArray hashKey = hash.result();
+    // old rows are still readable with the MD5 key
+    QByteArray password = key.toUtf8();
+    QByteArray legacy = QtHash::hash(password, QCryptographicHash::Md5);
+    QByteArray aead = QtHash::hash(password, QCryptographicHash::Sha256);
+    QtSecureMemory::wipe(password.data(), password.length());
 
-    AES_set_encrypt_key((const unsigned char *)hashKey.data(), 128, &encryptKey);
-    AES_set_decrypt_key((const unsigned char *)hashKey.data(), 128, &decryptKey);
+    QWriteLocker locker(&keyLock);
+    resetKeys();
+    legacyKey.assign(legacy.constData(), legacy.length());
+    aeadKey.assign(aead.constData(), aead.length());
+    deriveBlindKey();
+    QtSecureMemory::wipe(legacy.data(), legacy.length());
+    QtSecureMemory::wipe(aead.data(), aead.length());
 }
 
-QString QtAes::encrypt(const QString &input) const
+bool QtAes::initialize(const QString &key, const QtKdf::Params &params)
 {
-    // padding 0
-    QByteArray inArray = input.toUtf8();
-    int len = inArray.length();
-    if(len % AES_BLOCK_SIZE != 0) {
-        int pad = AES_BLOCK_SIZE - len % AES_BLOCK_SIZE;
-        for(int i =0; i < pad; i++) {
-            inArray.append('\0');
-        }
-        len = inArray.length();
+    // the slow part runs before the keys are locked
+    // first half is the record key, second half only feeds the verifier
+    QByteArray derived = QtKdf::derive(key, params, 64);
+    QByteArray password = key.toUtf8();
+    QByteArray legacy = QtHash::hash(password, QCryptographicHash::Md5);
+    QtSecureMemory::wipe(password.data(), password.length());
+
+    QWriteLocker locker(&keyLock);
+    resetKeys();
+    legacyKey.assign(legacy.constData(), legacy.length());
+    QtSecureMemory::wipe(legacy.data(), legacy.length());
+    if(derived.isEmpty()) {
+        return false;
+    }
+    bool assigned = aeadKey.assign(derived.constData(), 32);
+    if(assigned) {
+        verifier = QString(QtHash::hash(derived.mid(32), QCryptographicHash::Sha256).toBase64());
+        kdfParams = params;
+        deriveBlindKey();
     }
+    QtSecureMemory::wipe(derived.data(), derived.length());
+    return assigned && !blindKey.isEmpty();
+}
 
-    //  encrypt every block
-    QByteArray outArray;
-    const unsigned char *inbuffer = (const unsigned char *)inArray.data();
-    int remain = len;
-    while(remain > 0) {
-        encryptBlock(inbuffer, outArray);
-        remain -= AES_BLOCK_SIZE;
-        inbuffer += AES_BLOCK_SIZE;
+void QtAes::clear()
+{
+    QWriteLocker locker(&keyLock);
+    resetKeys();
+}
+
+// with keyLock held for writing
+void QtAes::resetKeys()
+{
+    freeContexts();
+    keyGeneration++;
+    legacyKey.clear();
+    aeadKey.clear();
+    blindKey.clear();
+    kdfParams = QtKdf::Params();
+    verifier.clear();
+}
+
+QString QtAes::getVerifier() const
+{
+    QReadLocker locker(&keyLock);
+    return verifier;
+}
+
+void QtAes::deriveBlindKey()
+{
+    if(!blindKey.resize(EVP_MAX_MD_SIZE)) {
+        qDebug() << "No secure memory for the blind index key";
+        return;
     }
+    unsigned int length = 0;
+    HMAC(EVP_sha256(), aeadKey.constData(), aeadKey.size(),
+         (const unsigned char *)BLIND_KEY_LABEL, sizeof(BLIND_KEY_LABEL) - 1,
+         (unsigned char *)blindKey.data(), &length);
+    blindKey.resize(length);
+}
 
-    // to base64
-    QByteArray base64Array = outArray.toBase64();
+QByteArray QtAes::blindToken(const QByteArray &input) const
+{
+    QReadLocker locker(&keyLock);
+    if(blindKey.isEmpty()) {
+        return QByteArray();
+    }
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int length = 0;
+    HMAC(EVP_sha256(), blindKey.constData(), blindKey.size(),
+         (const unsigned char *)input.constData(), input.length(), digest, &length);
+    QByteArray token((const char *)digest, blindTokenSize());
+    QtSecureMemory::wipe(digest, sizeof(digest));
+    return token;
+}
 
-    // DONE
-    return QString(base64Array);
+QtAes::CipherMode QtAes::detectCipherMode()
+{
+    // without AES and carry-less multiply in hardware ChaCha20 is faster
+    // and has no table lookups to leak timing
+    return QtCpuFeatures::hasFastAesGcm() ? AesGcm : ChaCha20Poly1305;
+}
+
+bool QtAes::isLegacy(const QString &input)
+{
+    return !input.startsWith(QLatin1Char(AEAD_PREFIX));
+}
+
+bool QtAes::isLegacy(const QByteArray &input)
+{
+    return !input.startsWith(AEAD_PREFIX);
+}
+
+QString QtAes::encrypt(const QString &input) const
+{
+    QByteArray output;
+    encrypt(input.toUtf8(), &output);
+    return QString::fromLatin1(output);
 }
 
 QString QtAes::decrypt(const QString &input) const
 {
-    // from base64
-    QByteArray base64Array;
-    base64Array.append(input);
-    QByteArray inArray = QByteArray::fromBase64(base64Array);
+    QString output;
+    decrypt(input, &output);
+    return output;
+}
 
-    // decrypt every block
+bool QtAes::decrypt(const QString &input, QString *output) const
+{
     QByteArray outArray;
-    const unsigned char *inbuffer = (const unsigned char *)inArray.data();
-    int remain = inArray.length();
-    while(remain > 0) {
-        decryptBlock(inbuffer, outArray);
-        remain -= AES_BLOCK_SIZE;
-        inbuffer += AES_BLOCK_SIZE;
+    bool ok = decrypt(input.toLatin1(), &outArray);
+    *output = QString::fromUtf8(outArray);
+    return ok;
+}
+
+void QtAes::encrypt(const QByteArray &input, QByteArray *output) const
+{
+    int len = input.length();
+    if(cipherMode == LegacyEcb) {
+        // padding 0
+        QVarLengthArray<char, 1024> raw(paddedLength(len));
+        memset(raw.data(), 0, raw.size());
+        memcpy(raw.data(), input.constData(), len);
+        cryptEcb(true, raw.data(), raw.size());
+        output->resize(QtBase64::encodedLength(raw.size()));
+        output->resize(QtBase64::encode(raw.constData(), raw.size(), output->data()));
+        return;
+    }
+
+    QVarLengthArray<unsigned char, 1024> raw(AEAD_OVERHEAD + len);
+    EVP_CIPHER_CTX *ctx = acquireContext(cipherMode, true);
+    sealRecord(ctx, input.constData(), len, raw.data());
+    releaseContext(cipherMode, true, ctx);
+
+    output->resize(1 + QtBase64::encodedLength(raw.size()));
+    char *out = output->data();
+    out[0] = AEAD_PREFIX;
+    output->resize(1 + QtBase64::encode((const char *)raw.constData(), raw.size(), out + 1));
+}
+
+bool QtAes::decrypt(const QByteArray &input, QByteArray *output) const
+{
+    const char *in = input.constData();
+    int len = input.length();
+    bool aead = !isLegacy(input);
+    if(aead) {
+        in++;
+        len--;
+    }
+
+    // base64 straight into the output, then decrypt in place
+    output->resize(QtBase64::decodedMaxLength(len));
+    int rawLen = QtBase64::decode(in, len, output->data());
+    if(rawLen < 0) {
+        output->clear();
+        return false;
+    }
+
+    if(!aead) {
+        rawLen = rawLen / AES_BLOCK_SIZE * AES_BLOCK_SIZE;
+        cryptEcb(false, output->data(), rawLen);
+        // strip the zero padding, ECB has no integrity so the caller checks the content
+        output->resize(qstrnlen(output->constData(), rawLen));
+        return true;
+    }
+
+    int plainLen = 0;
+    bool ok = openRecord(output->data(), rawLen, &plainLen);
+    output->resize(plainLen);
+    return ok;
+}
+
+QStringList QtAes::encryptList(const QStringList &inputs) const
+{
+    QList<QByteArray> utf8List;
+    utf8List.reserve(inputs.size());
+    for(const QString &input : inputs) {
+        utf8List.append(input.toUtf8());
+    }
+
+    QList<QByteArray> outList;
+    encryptList(utf8List, &outList);
+
+    QStringList outputs;
+    outputs.reserve(inputs.size());
+    for(const QByteArray &out : outList) {
+        outputs.append(QString::fromLatin1(out));
     }
 
     // DONE
-    return QString::fromUtf8(outArray);
+    return outputs;
 }
 
-void QtAes::encryptBlock(const unsigned char *inbuffer, QByteArray &out) const
+bool QtAes::decryptList(const QStringList &inputs, QStringList *outputs) const
 {
-    unsigned char outbuffer[AES_BLOCK_SIZE];
-    AES_encrypt(inbuffer, outbuffer, &encryptKey);
-    out.append((const char *)outbuffer, AES_BLOCK_SIZE);
+    QList<QByteArray> inList;
+    inList.reserve(inputs.size());
+    for(const QString &input : inputs) {
+        inList.append(input.toLatin1());
+    }
+
+    QList<QByteArray> outList;
+    bool ok = decryptList(inList, &outList);
+
+    outputs->clear();
+    outputs->reserve(inputs.size());
+    for(const QByteArray &out : outList) {
+        outputs->append(QString::fromUtf8(out));
+    }
+
+    // DONE
+    return ok;
+}
+
+void QtAes::encryptList(const QList<QByteArray> &inputs, QList<QByteArray> *outputs) const
+{
+    // size the raw buffer once for all fields
+    QVector<int> offsets(inputs.size() + 1);
+    int total = 0;
+    for(int i = 0; i < inputs.size(); i++) {
+        offsets[i] = total;
+        if(cipherMode == LegacyEcb) {
+            total += paddedLength(inputs.at(i).length());
+        } else {
+            total += AEAD_OVERHEAD + inputs.at(i).length();
+        }
+    }
+    offsets[inputs.size()] = total;
+
+    QByteArray buffer(total, '\0');
+    char *base = buffer.data();
+    if(cipherMode == LegacyEcb) {
+        for(int i = 0; i < inputs.size(); i++) {
+            memcpy(base + offsets.at(i), inputs.at(i).constData(), inputs.at(i).length());
+        }
+        // encrypt every block in one call
+        cryptEcb(true, base, total);
+    } else {
+        EVP_CIPHER_CTX *ctx = acquireContext(cipherMode, true);
+        for(int i = 0; i < inputs.size(); i++) {
+            sealRecord(ctx, inputs.at(i).constData(), inputs.at(i).length(),
+                       (unsigned char *)base + offsets.at(i));
+        }
+        releaseContext(cipherMode, true, ctx);
+    }
+
+    // to base64, output buffers left by the caller are reused
+    int prefix = (cipherMode == LegacyEcb) ? 0 : 1;
+    while(outputs->size() > inputs.size()) {
+        outputs->removeLast();
+    }
+    while(outputs->size() < inputs.size()) {
+        outputs->append(QByteArray());
+    }
+    for(int i = 0; i < inputs.size(); i++) {
+        int rawLen = offsets.at(i + 1) - offsets.at(i);
+        QByteArray &out = (*outputs)[i];
+        out.resize(prefix + QtBase64::encodedLength(rawLen));
+        char *outbuffer = out.data();
+        if(prefix) {
+            outbuffer[0] = AEAD_PREFIX;
+        }
+        out.resize(prefix + QtBase64::encode(base + offsets.at(i), rawLen, outbuffer + prefix));
+    }
+}
+
+bool QtAes::decryptList(const QList<QByteArray> &inputs, QList<QByteArray> *outputs) const
+{
+    while(outputs->size() > inputs.size()) {
+        outputs->removeLast();
+    }
+    while(outputs->size() < inputs.size()) {
+        outputs->append(QByteArray());
+    }
+
+    // legacy fields are gathered into one buffer and decrypted in one call
+    QVector<int> offsets(inputs.size(), -1);
+    QVector<int> lengths(inputs.size(), 0);
+    int total = 0;
+    for(int i = 0; i < inputs.size(); i++) {
+        if(isLegacy(inputs.at(i))) {
+            total += QtBase64::decodedMaxLength(inputs.at(i).length());
+        }
+    }
+    QByteArray legacyBuffer(total, Qt::Uninitialized);
+    total = 0;
+
+    bool ok = true;
+    for(int i = 0; i < inputs.size(); i++) {
+        const QByteArray &input = inputs.at(i);
+        if(!isLegacy(input)) {
+            ok = decrypt(input, &(*outputs)[i]) && ok;
+            continue;
+        }
+        int rawLen = QtBase64::decode(input.constData(), input.length(), legacyBuffer.data() + total);
+        if(rawLen < 0) {
+            ok = false;
+            rawLen = 0;
+        }
+        offsets[i] = total;
+        lengths[i] = rawLen / AES_BLOCK_SIZE * AES_BLOCK_SIZE;
+        total += lengths.at(i);
+    }
+    cryptEcb(false, legacyBuffer.data(), total);
+
+    for(int i = 0; i < inputs.size(); i++) {
+        if(offsets.at(i) < 0) {
+            continue;
+        }
+        const char *plain = legacyBuffer.constData() + offsets.at(i);
+        (*outputs)[i].resize(0);
+        (*outputs)[i].append(plain, qstrnlen(plain, lengths.at(i)));
+    }
+
+    // DONE
+    return ok;
 }
 
-void QtAes::decryptBlock(const unsigned  char *inbuffer, QByteArray &out) const
+void QtAes::cryptEcb(bool enc, char *data, int len) const
 {
-    unsigned char outbuffer[AES_BLOCK_SIZE];
-    AES_decrypt(inbuffer, outbuffer, &decryptKey);
-    out.append((const char *)outbuffer, AES_BLOCK_SIZE);
+    if(len <= 0) {
+        return;
+    }
+    EVP_CIPHER_CTX *ctx = acquireContext(LegacyEcb, enc);
+    int outlen = 0;
+    EVP_CipherUpdate(ctx, (unsigned char *)data, &outlen, (const unsigned char *)data, len);
+    releaseContext(LegacyEcb, enc, ctx);
+}
+
+void QtAes::sealRecord(EVP_CIPHER_CTX *ctx, const char *plain, int len, unsigned char *record) const
+{
+    unsigned char *nonce = record + 1;
+    unsigned char *cipher = nonce + AEAD_NONCE_SIZE;
+    unsigned char *tag = cipher + len;
+    record[0] = (unsigned char)cipherMode;
+    RAND_bytes(nonce, AEAD_NONCE_SIZE);
+
+    int outlen = 0;
+    EVP_EncryptInit_ex(ctx, NULL, NULL, NULL, nonce);
+    // the version byte is authenticated too
+    EVP_EncryptUpdate(ctx, NULL, &outlen, record, 1);
+    EVP_EncryptUpdate(ctx, cipher, &outlen, (const unsigned char *)plain, len);
+    EVP_EncryptFinal_ex(ctx, cipher + outlen, &outlen);
+    EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, AEAD_TAG_SIZE, tag);
+}
+
+bool QtAes::openRecord(char *data, int len, int *plainLen) const
+{
+    *plainLen = 0;
+    if(len < AEAD_OVERHEAD) {
+        return false;
+    }
+    unsigned char *record = (unsigned char *)data;
+    CipherMode mode = (CipherMode)record[0];
+    if(mode != AesGcm && mode != ChaCha20Poly1305) {
+        return false;
+    }
+    unsigned char version = record[0];
+    unsigned char nonce[AEAD_NONCE_SIZE];
+    unsigned char tag[AEAD_TAG_SIZE];
+    int cipherLen = len - AEAD_OVERHEAD;
+    unsigned char *cipher = record + 1 + AEAD_NONCE_SIZE;
+    memcpy(nonce, record + 1, AEAD_NONCE_SIZE);
+    memcpy(tag, cipher + cipherLen, AEAD_TAG_SIZE);
+
+    // decrypt in place, then move the plaintext over the header
+    EVP_CIPHER_CTX *ctx = acquireContext(mode, false);
+    int outlen = 0;
+    int finallen = 0;
+    bool ok = EVP_DecryptInit_ex(ctx, NULL, NULL, NULL, nonce) > 0
+            && EVP_DecryptUpdate(ctx, NULL, &outlen, &version, 1) > 0
+            && EVP_DecryptUpdate(ctx, cipher, &outlen, cipher, cipherLen) > 0
+            && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, AEAD_TAG_SIZE, tag) > 0
+            && EVP_DecryptFinal_ex(ctx, cipher + outlen, &finallen) > 0;
+    releaseContext(mode, false, ctx);
+
+    if(!ok) {
+        memset(data, 0, len);
+        return false;
+    }
+    memmove(data, cipher, cipherLen);
+    *plainLen = cipherLen;
+    return true;
+}
+
+bool QtAes::seal(CipherMode mode, const unsigned char *nonce, const QByteArray &aad,
+                 const char *in, int len, char *out) const
+{
+    if(mode != AesGcm && mode != ChaCha20Poly1305) {
+        return false;
+    }
+
+    EVP_CIPHER_CTX *ctx = acquireContext(mode, true);
+    unsigned char *cipher = (unsigned char *)out;
+    int outlen = 0;
+    int finallen = 0;
+    bool ok = EVP_EncryptInit_ex(ctx, NULL, NULL, NULL, nonce) > 0
+            && EVP_EncryptUpdate(ctx, NULL, &outlen, (const unsigned char *)aad.constData(), aad.length()) > 0
+            && EVP_EncryptUpdate(ctx, cipher, &outlen, (const unsigned char *)in, len) > 0
+            && EVP_EncryptFinal_ex(ctx, cipher + outlen, &finallen) > 0
+            && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, AEAD_TAG_SIZE, cipher + len) > 0;
+    releaseContext(mode, true, ctx);
+    return ok;
+}
+
+bool QtAes::open(CipherMode mode, const unsigned char *nonce, const QByteArray &aad,
+                 const char *in, int len, char *out) const
+{
+    if((mode != AesGcm && mode != ChaCha20Poly1305) || len < AEAD_TAG_SIZE) {
+        return false;
+    }
+
+    int cipherLen = len - AEAD_TAG_SIZE;
+    unsigned char tag[AEAD_TAG_SIZE];
+    memcpy(tag, in + cipherLen, AEAD_TAG_SIZE);
+
+    EVP_CIPHER_CTX *ctx = acquireContext(mode, false);
+    unsigned char *plain = (unsigned char *)out;
+    int outlen = 0;
+    int finallen = 0;
+    bool ok = EVP_DecryptInit_ex(ctx, NULL, NULL, NULL, nonce) > 0
+            && EVP_DecryptUpdate(ctx, NULL, &outlen, (const unsigned char *)aad.constData(), aad.length()) > 0
+            && EVP_DecryptUpdate(ctx, plain, &outlen, (const unsigned char *)in, cipherLen) > 0
+            && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, AEAD_TAG_SIZE, tag) > 0
+            && EVP_DecryptFinal_ex(ctx, plain + outlen, &finallen) > 0;
+    releaseContext(mode, false, ctx);
+
+    if(!ok) {
+        memset(out, 0, cipherLen);
+    }
+    return ok;
+}
+
+EVP_CIPHER_CTX *QtAes::acquireContext(CipherMode mode, bool enc) const
+{
+    // released in releaseContext, initialize and clear wait for it
+    keyLock.lockForRead();
+    int slot = mode * 2 + (enc ? 1 : 0);
+    {
+        QMutexLocker locker(&poolMutex);
+        while(!contextPool[slot].isEmpty()) {
+            EVP_CIPHER_CTX *ctx = contextPool[slot].takeLast();
+            if((quintptr)EVP_CIPHER_CTX_get_app_data(ctx) == keyGeneration) {
+                return ctx;
+            }
+            EVP_CIPHER_CTX_free(ctx);
+        }
+    }
+
+    // expand the key schedule once per context, later calls only reset the nonce.
+    // The schedule lives in the provider's context, which OpenSSL allocates
+    // with plain OPENSSL_zalloc: CRYPTO_secure_malloc_init only covers
+    // explicit OPENSSL_secure_malloc calls, and the allocator can only be
+    // swapped process-wide (CRYPTO_set_mem_functions), which would pin Qt's
+    // TLS buffers too. So the schedules can't be locked; they're cleansed by
+    // EVP_CIPHER_CTX_free and dropped whenever the keys change or are wiped.
+    const QtSecureBuffer &key = (mode == LegacyEcb) ? legacyKey : aeadKey;
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    EVP_CipherInit_ex(ctx, cipherForMode(mode), NULL,
+                      (const unsigned char *)key.constData(), NULL, enc ? 1 : 0);
+    EVP_CIPHER_CTX_set_padding(ctx, 0);
+    EVP_CIPHER_CTX_set_app_data(ctx, (void *)keyGeneration);
+    return ctx;
+}
+
+void QtAes::releaseContext(CipherMode mode, bool enc, EVP_CIPHER_CTX *ctx) const
+{
+    int slot = mode * 2 + (enc ? 1 : 0);
+    {
+        QMutexLocker locker(&poolMutex);
+        // keyed before the last key change, never handed out again
+        if((quintptr)EVP_CIPHER_CTX_get_app_data(ctx) != keyGeneration) {
+            EVP_CIPHER_CTX_free(ctx);
+        } else {
+            contextPool[slot].append(ctx);
+        }
+    }
+    keyLock.unlock();
+}
+
+void QtAes::freeContexts()
+{
+    QMutexLocker locker(&poolMutex);
+    for(QList<EVP_CIPHER_CTX *> &pool : contextPool) {
+        for(EVP_CIPHER_CTX *ctx : pool) {
+            EVP_CIPHER_CTX_free(ctx);
+        }
+        pool.clear();
+    }
 }
@@ -2,21 +2,106 @@
 #define QTAES_H
 
 #include <QObject>
+#include <QStringList>
+#include <QMutex>
+#include <QReadWriteLock>
 #include <openssl/aes.h>
+#include <openssl/evp.h>
+#include "qtkdf.h"
+#include "qtsecurememory.h"
 
 class QtAes
 {
 public:
+    // Also the format version byte written in front of every AEAD record
+    enum CipherMode {
+        LegacyEcb = 0,
+        AesGcm = 1,
+        ChaCha20Poly1305 = 2
+    };
+
+    QtAes();
+    ~QtAes();
+
+    // Legacy vaults: MD5 key for ECB rows, SHA-256 key for AEAD rows
     void initialize(const QString &key);
+    // Vaults with a KDF header, returns false if the derivation failed
+    bool initialize(const QString &key, const QtKdf::Params &params);
+    // Wipes the keys, initialize again before the next use. Both wait for
+    // operations already running on other threads, none starts meanwhile.
+    void clear();
+    bool hasKdf() const { return kdfParams.isValid(); }
+    const QtKdf::Params &getKdfParams() const { return kdfParams; }
+    // Password check value derived together with the key
+    QString getVerifier() const;
+    // Keyed, truncated HMAC for searchable indexes; equal inputs give equal
+    // tokens, nothing else can be learned without the key
+    static int blindTokenSize() { return 8; }
+    QByteArray blindToken(const QByteArray &input) const;
+
     QString encrypt(const QString &input) const;
     QString decrypt(const QString &input) const ;
+    // Returns false when the auth tag doesn't match (wrong key or tampered data)
+    bool decrypt(const QString &input, QString *output) const;
+
+    // Byte versions skip the UTF-16 round trip. The output is base64 text for
+    // encrypt and plain bytes for decrypt, its buffer is reused across calls.
+    void encrypt(const QByteArray &input, QByteArray *output) const;
+    bool decrypt(const QByteArray &input, QByteArray *output) const;
+
+    // Batch version, all fields go through the cipher in one pass
+    QStringList encryptList(const QStringList &inputs) const;
+    // false when any field fails to authenticate, its output is then empty
+    bool decryptList(const QStringList &inputs, QStringList *outputs) const;
+    void encryptList(const QList<QByteArray> &inputs, QList<QByteArray> *outputs) const;
+    bool decryptList(const QList<QByteArray> &inputs, QList<QByteArray> *outputs) const;
+
+    // Raw AEAD on a caller supplied 12-byte nonce, for framed formats.
+    // seal writes len bytes of ciphertext and the tag, open takes them back.
+    static int tagSize() { return 16; }
+    static int nonceSize() { return 12; }
+    bool seal(CipherMode mode, const unsigned char *nonce, const QByteArray &aad,
+              const char *in, int len, char *out) const;
+    bool open(CipherMode mode, const unsigned char *nonce, const QByteArray &aad,
+              const char *in, int len, char *out) const;
+
+    void setCipherMode(CipherMode mode) { cipherMode = mode; }
+    CipherMode getCipherMode() const { return cipherMode; }
+
+    static CipherMode detectCipherMode();
+    static bool isLegacy(const QString &input);
+    static bool isLegacy(const QByteArray &input);
 
 private:
-    void encryptBlock(const unsigned char *inbuffer, QByteArray &out) const;
-    void decryptBlock(const unsigned char *inbuffer, QByteArray &out) const;
+    Q_DISABLE_COPY(QtAes)
+
+    EVP_CIPHER_CTX *acquireContext(CipherMode mode, bool enc) const;
+    void releaseContext(CipherMode mode, bool enc, EVP_CIPHER_CTX *ctx) const;
+    void freeContexts();
+    void resetKeys();
+    void deriveBlindKey();
+
+    void cryptEcb(bool enc, char *data, int len) const;
+    void sealRecord(EVP_CIPHER_CTX *ctx, const char *plain, int len, unsigned char *record) const;
+    bool openRecord(char *data, int len, int *plainLen) const;
+
+    CipherMode cipherMode;
+    QtSecureBuffer legacyKey;
+    QtSecureBuffer aeadKey;
+    QtSecureBuffer blindKey;
+    QtKdf::Params kdfParams;
+    QString verifier;
+
+    // Held for reading from acquireContext to releaseContext and while the
+    // blind key is used, for writing while the keys change
+    mutable QReadWriteLock keyLock;
+    // bumped with every key change, contexts keyed before it aren't pooled
+    quintptr keyGeneration;
 
-    AES_KEY encryptKey;
-    AES_KEY decryptKey;
+    // Keyed contexts are reused, each caller takes its own one from the pool.
+    // Unlike the raw keys they're on OpenSSL's heap, see acquireContext.
+    mutable QMutex poolMutex;
+    mutable QList<EVP_CIPHER_CTX *> contextPool[6];
 };
 
 #endif // QTAES_H
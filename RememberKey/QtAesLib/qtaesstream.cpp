@@ -0,0 +1,294 @@
+#include "qtaesstream.h"
+
+#include <QRunnable>
+#include <QThread>
+#include <QtEndian>
+#include <openssl/rand.h>
+
+static const char STREAM_MAGIC[] = "RKS2";
+static const char STREAM_VAULT_MAGIC[] = "RKS1";
+static const int STREAM_MAGIC_SIZE = 4;
+static const int STREAM_PREFIX_SIZE = 8;
+static const int STREAM_HEADER_SIZE = STREAM_MAGIC_SIZE + 4 + 4 + STREAM_PREFIX_SIZE;
+static const quint32 STREAM_LAST_CHUNK = 0x80000000u;
+static const int STREAM_MAX_CHUNK_SIZE = 64 * 1024 * 1024;
+static const int STREAM_MAX_KDF_SIZE = 256;
+
+namespace {
+
+class ChunkTask : public QRunnable
+{
+public:
+    ChunkTask(const QtAes *aes, QtAes::CipherMode mode, bool enc,
+              const unsigned char *nonce, const QByteArray &aad,
+              const QByteArray &input, QByteArray *output, bool *ok) :
+        aes(aes), mode(mode), enc(enc), aad(aad), input(input), output(output), ok(ok)
+    {
+        memcpy(this->nonce, nonce, sizeof(this->nonce));
+    }
+
+    void run()
+    {
+        if(enc) {
+            output->resize(input.length() + QtAes::tagSize());
+            *ok = aes->seal(mode, nonce, aad, input.constData(), input.length(), output->data());
+        } else {
+            output->resize(qMax(input.length() - QtAes::tagSize(), 0));
+            *ok = aes->open(mode, nonce, aad, input.constData(), input.length(), output->data());
+        }
+    }
+
+private:
+    const QtAes *aes;
+    QtAes::CipherMode mode;
+    bool enc;
+    unsigned char nonce[12];
+    QByteArray aad;
+    const QByteArray &input;
+    QByteArray *output;
+    bool *ok;
+};
+
+// QIODevice::read may return less than asked for on sequential devices
+QByteArray readFull(QIODevice *in, qint64 size)
+{
+    QByteArray data = in->read(size);
+    while(data.length() < size) {
+        if(!in->waitForReadyRead(-1) && in->bytesAvailable() <= 0) {
+            break;
+        }
+        QByteArray more = in->read(size - data.length());
+        if(more.isEmpty()) {
+            break;
+        }
+        data.append(more);
+    }
+    return data;
+}
+
+}
+
+QtAesStream::QtAesStream(const QString &password, const QtAes *vaultAes, int chunkSize) :
+    cryptoAes(nullptr), vaultAes(vaultAes), password(password),
+    mode(QtAes::detectCipherMode()), chunkSize(chunkSize)
+{
+    pool.setMaxThreadCount(QThread::idealThreadCount());
+}
+
+int QtAesStream::headerSize()
+{
+    return STREAM_HEADER_SIZE;
+}
+
+bool QtAesStream::isStream(QIODevice *in)
+{
+    QByteArray magic = in->peek(STREAM_MAGIC_SIZE);
+    return magic == QByteArray(STREAM_MAGIC) || magic == QByteArray(STREAM_VAULT_MAGIC);
+}
+
+bool QtAesStream::deriveKey(const QtKdf::Params &params)
+{
+    if(!fileKey.initialize(password, params)) {
+        errorMessage = QtKdf::isAvailable(params.algorithm)
+                ? QObject::tr("Can't derive the stream key")
+                : QObject::tr("Can't derive the stream key, its key derivation function isn't supported by this OpenSSL");
+        return false;
+    }
+    cryptoAes = &fileKey;
+    return true;
+}
+
+bool QtAesStream::encrypt(QIODevice *in, QIODevice *out)
+{
+    errorMessage.clear();
+
+    QtKdf::Params params = QtKdf::portableParams();
+    if(!deriveKey(params)) {
+        return false;
+    }
+    QByteArray kdf = params.toString().toLatin1();
+
+    noncePrefix.resize(STREAM_PREFIX_SIZE);
+    RAND_bytes((unsigned char *)noncePrefix.data(), STREAM_PREFIX_SIZE);
+    header = QByteArray(STREAM_MAGIC, STREAM_MAGIC_SIZE);
+    header.append((char)mode);
+    header.append(3, '\0');
+    uchar size[4];
+    qToBigEndian<quint32>(chunkSize, size);
+    header.append((const char *)size, 4);
+    header.append(noncePrefix);
+    uchar kdfSize[2];
+    qToBigEndian<quint16>(kdf.length(), kdfSize);
+    header.append((const char *)kdfSize, 2);
+    header.append(kdf);
+    if(out->write(header) != header.length()) {
+        errorMessage = QObject::tr("Can't write stream header");
+        return false;
+    }
+
+    // a few chunks per thread are in flight, the rest of the input stays on disk
+    int waveSize = pool.maxThreadCount() * 2;
+    QList<Chunk> wave;
+    quint32 index = 0;
+    QByteArray next = readFull(in, chunkSize);
+    forever {
+        Chunk chunk;
+        chunk.index = index++;
+        chunk.input = next;
+        next = readFull(in, chunkSize);
+        chunk.last = next.isEmpty();
+        chunk.ok = false;
+        wave.append(chunk);
+
+        if(chunk.last || wave.size() >= waveSize) {
+            if(!runWave(wave, true, out)) {
+                return false;
+            }
+            wave.clear();
+        }
+        if(chunk.last) {
+            break;
+        }
+    }
+
+    return true;
+}
+
+bool QtAesStream::decrypt(QIODevice *in, QIODevice *out)
+{
+    errorMessage.clear();
+
+    header = readFull(in, STREAM_HEADER_SIZE);
+    if(header.length() != STREAM_HEADER_SIZE
+            || (!header.startsWith(STREAM_MAGIC) && !header.startsWith(STREAM_VAULT_MAGIC))) {
+        errorMessage = QObject::tr("Not an encrypted stream");
+        return false;
+    }
+    mode = (QtAes::CipherMode)header.at(STREAM_MAGIC_SIZE);
+    chunkSize = qFromBigEndian<quint32>((const uchar *)header.constData() + STREAM_MAGIC_SIZE + 4);
+    noncePrefix = header.right(STREAM_PREFIX_SIZE);
+    if(chunkSize <= 0 || chunkSize > STREAM_MAX_CHUNK_SIZE) {
+        errorMessage = QObject::tr("Bad stream chunk size");
+        return false;
+    }
+    if(header.startsWith(STREAM_VAULT_MAGIC)) {
+        if(vaultAes == nullptr) {
+            errorMessage = QObject::tr("The stream is sealed with a vault key");
+            return false;
+        }
+        cryptoAes = vaultAes;
+    } else if(!readKdf(in)) {
+        return false;
+    }
+
+    int waveSize = pool.maxThreadCount() * 2;
+    QList<Chunk> wave;
+    quint32 index = 0;
+    forever {
+        QByteArray lengthBytes = readFull(in, 4);
+        if(lengthBytes.length() != 4) {
+            errorMessage = QObject::tr("Stream truncated");
+            return false;
+        }
+        quint32 length = qFromBigEndian<quint32>((const uchar *)lengthBytes.constData());
+        Chunk chunk;
+        chunk.index = index++;
+        chunk.last = (length & STREAM_LAST_CHUNK) != 0;
+        chunk.ok = false;
+        length &= ~STREAM_LAST_CHUNK;
+        if((int)length > chunkSize || (!chunk.last && (int)length != chunkSize)) {
+            errorMessage = QObject::tr("Bad stream chunk length");
+            return false;
+        }
+        chunk.input = readFull(in, length + QtAes::tagSize());
+        if(chunk.input.length() != (int)length + QtAes::tagSize()) {
+            errorMessage = QObject::tr("Stream truncated");
+            return false;
+        }
+        wave.append(chunk);
+
+        if(chunk.last || wave.size() >= waveSize) {
+            if(!runWave(wave, false, out)) {
+                return false;
+            }
+            wave.clear();
+        }
+        if(chunk.last) {
+            break;
+        }
+    }
+
+    return true;
+}
+
+bool QtAesStream::readKdf(QIODevice *in)
+{
+    QByteArray kdfSize = readFull(in, 2);
+    int size = kdfSize.length() == 2 ? qFromBigEndian<quint16>((const uchar *)kdfSize.constData()) : -1;
+    QByteArray kdf = size > 0 && size <= STREAM_MAX_KDF_SIZE ? readFull(in, size) : QByteArray();
+    if(kdf.length() != size) {
+        errorMessage = QObject::tr("Stream truncated");
+        return false;
+    }
+    // authenticated with the rest of the header
+    header.append(kdfSize);
+    header.append(kdf);
+
+    QtKdf::Params params = QtKdf::Params::fromString(QString::fromLatin1(kdf));
+    if(!params.isValid() || !QtKdf::isWithinLimits(params)) {
+        errorMessage = QObject::tr("Bad stream key parameters");
+        return false;
+    }
+    return deriveKey(params);
+}
+
+bool QtAesStream::runWave(QList<Chunk> &wave, bool enc, QIODevice *out)
+{
+    for(int i = 0; i < wave.size(); i++) {
+        Chunk &chunk = wave[i];
+        unsigned char nonce[12];
+        chunkNonce(chunk.index, nonce);
+        pool.start(new ChunkTask(cryptoAes, mode, enc, nonce, chunkAad(chunk.index, chunk.last),
+                                 chunk.input, &chunk.output, &chunk.ok));
+    }
+    pool.waitForDone();
+
+    // results go out in order
+    for(const Chunk &chunk : wave) {
+        if(!chunk.ok) {
+            errorMessage = enc ? QObject::tr("Can't encrypt stream chunk %1").arg(chunk.index)
+                               : QObject::tr("Stream chunk %1 failed authentication").arg(chunk.index);
+            return false;
+        }
+        if(enc) {
+            uchar length[4];
+            quint32 input = chunk.input.length();
+            qToBigEndian<quint32>(chunk.last ? (input | STREAM_LAST_CHUNK) : input, length);
+            if(out->write((const char *)length, 4) != 4) {
+                errorMessage = QObject::tr("Can't write stream output");
+                return false;
+            }
+        }
+        if(out->write(chunk.output) != chunk.output.length()) {
+            errorMessage = QObject::tr("Can't write stream output");
+            return false;
+        }
+    }
+    return true;
+}
+
+QByteArray QtAesStream::chunkAad(quint32 index, bool last) const
+{
+    QByteArray aad = header;
+    uchar bytes[4];
+    qToBigEndian<quint32>(index, bytes);
+    aad.append((const char *)bytes, 4);
+    aad.append(last ? '\1' : '\0');
+    return aad;
+}
+
+void QtAesStream::chunkNonce(quint32 index, unsigned char *nonce) const
+{
+    memcpy(nonce, noncePrefix.constData(), STREAM_PREFIX_SIZE);
+    qToBigEndian<quint32>(index, nonce + STREAM_PREFIX_SIZE);
+}
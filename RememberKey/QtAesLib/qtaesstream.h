@@ -0,0 +1,70 @@
+#ifndef QTAESSTREAM_H
+#define QTAESSTREAM_H
+
+#include <QIODevice>
+#include <QThreadPool>
+#include "qtaes.h"
+
+// Chunked AEAD for large blobs (exports, backups), sealed with a key derived
+// from a password rather than a vault's key, so any vault knowing the
+// password opens it.
+//
+// Layout: "RKS2" | mode | 3 reserved | chunk size (u32 BE) | 8-byte nonce prefix |
+// KDF length (u16 BE) | KDF parameters as QtKdf::Params::toString, then per
+// chunk: length (u32 BE, top bit marks the last chunk) | ciphertext | tag.
+// The KDF salt is fresh for every stream. Chunk i uses nonce prefix | i (u32 BE)
+// and authenticates the header, its index and the last-chunk flag, so chunks
+// can't be reordered, dropped or truncated. Every chunk but the last has the
+// same size, so chunk i sits at a fixed offset.
+//
+// "RKS1" streams have no KDF parameters, they were sealed with the vault key.
+class QtAesStream
+{
+public:
+    static const int DefaultChunkSize = 1024 * 1024;
+
+    // vaultAes is only needed to open RKS1 streams
+    explicit QtAesStream(const QString &password, const QtAes *vaultAes = nullptr,
+                         int chunkSize = DefaultChunkSize);
+
+    bool encrypt(QIODevice *in, QIODevice *out);
+    bool decrypt(QIODevice *in, QIODevice *out);
+
+    QString getLastErrorMessage() { return errorMessage; }
+
+    static bool isStream(QIODevice *in);
+    // up to the KDF parameters
+    static int headerSize();
+
+private:
+    Q_DISABLE_COPY(QtAesStream)
+
+    struct Chunk {
+        quint32 index;
+        bool last;
+        bool ok;
+        QByteArray input;
+        QByteArray output;
+    };
+
+    bool deriveKey(const QtKdf::Params &params);
+    bool readKdf(QIODevice *in);
+    bool runWave(QList<Chunk> &wave, bool enc, QIODevice *out);
+    QByteArray chunkAad(quint32 index, bool last) const;
+    void chunkNonce(quint32 index, unsigned char *nonce) const;
+
+    // the key chunks are sealed with, fileKey or vaultAes
+    const QtAes *cryptoAes;
+    const QtAes *vaultAes;
+    QtAes fileKey;
+    QString password;
+    QtAes::CipherMode mode;
+    int chunkSize;
+    QByteArray header;
+    QByteArray noncePrefix;
+    QThreadPool pool;
+
+    QString errorMessage;
+};
+
+#endif // QTAESSTREAM_H
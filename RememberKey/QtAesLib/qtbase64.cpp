@@ -0,0 +1,302 @@
+#include "qtbase64.h"
+#include "qtcpufeatures.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define QTBASE64_X86
+#endif
+
+static const char ENCODE_TABLE[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+typedef int (*CodecFunction)(const char *in, int len, char *out);
+
+static int encodeScalar(const char *in, int len, char *out)
+{
+    const unsigned char *src = (const unsigned char *)in;
+    char *dst = out;
+    int i = 0;
+    for(; i + 3 <= len; i += 3) {
+        unsigned int v = (src[i] << 16) | (src[i + 1] << 8) | src[i + 2];
+        *dst++ = ENCODE_TABLE[(v >> 18) & 0x3f];
+        *dst++ = ENCODE_TABLE[(v >> 12) & 0x3f];
+        *dst++ = ENCODE_TABLE[(v >> 6) & 0x3f];
+        *dst++ = ENCODE_TABLE[v & 0x3f];
+    }
+    if(len - i == 1) {
+        unsigned int v = src[i] << 16;
+        *dst++ = ENCODE_TABLE[(v >> 18) & 0x3f];
+        *dst++ = ENCODE_TABLE[(v >> 12) & 0x3f];
+        *dst++ = '=';
+        *dst++ = '=';
+    } else if(len - i == 2) {
+        unsigned int v = (src[i] << 16) | (src[i + 1] << 8);
+        *dst++ = ENCODE_TABLE[(v >> 18) & 0x3f];
+        *dst++ = ENCODE_TABLE[(v >> 12) & 0x3f];
+        *dst++ = ENCODE_TABLE[(v >> 6) & 0x3f];
+        *dst++ = '=';
+    }
+    return dst - out;
+}
+
+static int decodeValue(unsigned char c)
+{
+    if(c >= 'A' && c <= 'Z') {
+        return c - 'A';
+    } else if(c >= 'a' && c <= 'z') {
+        return c - 'a' + 26;
+    } else if(c >= '0' && c <= '9') {
+        return c - '0' + 52;
+    } else if(c == '+') {
+        return 62;
+    } else if(c == '/') {
+        return 63;
+    }
+    return -1;
+}
+
+// len has padding and whitespace stripped already
+static int decodeScalar(const char *in, int len, char *out)
+{
+    const unsigned char *src = (const unsigned char *)in;
+    char *dst = out;
+    unsigned int v = 0;
+    int bits = 0;
+    for(int i = 0; i < len; i++) {
+        int d = decodeValue(src[i]);
+        if(d < 0) {
+            return -1;
+        }
+        v = (v << 6) | d;
+        bits += 6;
+        if(bits >= 8) {
+            bits -= 8;
+            *dst++ = (char)((v >> bits) & 0xff);
+        }
+    }
+    // a single dangling character can't encode a byte
+    if(len % 4 == 1) {
+        return -1;
+    }
+    return dst - out;
+}
+
+#ifdef QTBASE64_X86
+
+// Mula / Lemire: 12 bytes -> 16 indices, then indices -> ASCII with one pshufb
+__attribute__((target("sse4.1")))
+static inline __m128i encodeLookup128(__m128i indices)
+{
+    const __m128i shiftLut = _mm_setr_epi8(
+                'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                '/' - 63, 'A', 0, 0);
+    __m128i result = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    const __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+    result = _mm_or_si128(result, _mm_and_si128(less, _mm_set1_epi8(13)));
+    result = _mm_shuffle_epi8(shiftLut, result);
+    return _mm_add_epi8(result, indices);
+}
+
+__attribute__((target("sse4.1")))
+static int encodeSse4(const char *in, int len, char *out)
+{
+    const __m128i shuffle = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    int i = 0;
+    char *dst = out;
+    // each step reads 16 bytes and consumes 12
+    for(; i + 16 <= len; i += 12) {
+        __m128i in128 = _mm_loadu_si128((const __m128i *)(in + i));
+        in128 = _mm_shuffle_epi8(in128, shuffle);
+        const __m128i t0 = _mm_and_si128(in128, _mm_set1_epi32(0x0fc0fc00));
+        const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+        const __m128i t2 = _mm_and_si128(in128, _mm_set1_epi32(0x003f03f0));
+        const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+        const __m128i indices = _mm_or_si128(t1, t3);
+        _mm_storeu_si128((__m128i *)dst, encodeLookup128(indices));
+        dst += 16;
+    }
+    return (dst - out) + encodeScalar(in + i, len - i, dst);
+}
+
+__attribute__((target("sse4.1")))
+static int decodeSse4(const char *in, int len, char *out)
+{
+    const __m128i lutLo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                        0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+    const __m128i lutHi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lutRoll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+                                          0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    int i = 0;
+    char *dst = out;
+    // each step writes 16 bytes but keeps 12, stay clear of the buffer end
+    for(; i + 24 <= len; i += 16) {
+        const __m128i input = _mm_loadu_si128((const __m128i *)(in + i));
+        const __m128i hiNibble = _mm_and_si128(_mm_srli_epi32(input, 4), _mm_set1_epi8(0x0f));
+        const __m128i loNibble = _mm_and_si128(input, _mm_set1_epi8(0x0f));
+        const __m128i lo = _mm_shuffle_epi8(lutLo, loNibble);
+        const __m128i hi = _mm_shuffle_epi8(lutHi, hiNibble);
+        if(!_mm_testz_si128(lo, hi)) {
+            return -1;
+        }
+        const __m128i eq2F = _mm_cmpeq_epi8(input, _mm_set1_epi8(0x2f));
+        const __m128i roll = _mm_shuffle_epi8(lutRoll, _mm_add_epi8(eq2F, hiNibble));
+        const __m128i values = _mm_add_epi8(input, roll);
+        const __m128i mergeAb = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+        const __m128i merged = _mm_madd_epi16(mergeAb, _mm_set1_epi32(0x00011000));
+        _mm_storeu_si128((__m128i *)dst, _mm_shuffle_epi8(merged, pack));
+        dst += 12;
+    }
+    int tail = decodeScalar(in + i, len - i, dst);
+    return tail < 0 ? -1 : (dst - out) + tail;
+}
+
+__attribute__((target("avx2")))
+static int encodeAvx2(const char *in, int len, char *out)
+{
+    const __m256i shuffle = _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+                                            10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    const __m256i shiftLut = _mm256_setr_epi8(
+                'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                '/' - 63, 'A', 0, 0,
+                'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                '/' - 63, 'A', 0, 0);
+    int i = 0;
+    char *dst = out;
+    // 24 bytes per step, 12 in each lane, reads up to 28 bytes
+    for(; i + 28 <= len; i += 24) {
+        __m256i in256 = _mm256_inserti128_si256(
+                    _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(in + i))),
+                    _mm_loadu_si128((const __m128i *)(in + i + 12)), 1);
+        in256 = _mm256_shuffle_epi8(in256, shuffle);
+        const __m256i t0 = _mm256_and_si256(in256, _mm256_set1_epi32(0x0fc0fc00));
+        const __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+        const __m256i t2 = _mm256_and_si256(in256, _mm256_set1_epi32(0x003f03f0));
+        const __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+        const __m256i indices = _mm256_or_si256(t1, t3);
+        __m256i result = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+        const __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+        result = _mm256_or_si256(result, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+        result = _mm256_shuffle_epi8(shiftLut, result);
+        _mm256_storeu_si256((__m256i *)dst, _mm256_add_epi8(result, indices));
+        dst += 32;
+    }
+    return (dst - out) + encodeSse4(in + i, len - i, dst);
+}
+
+__attribute__((target("avx2")))
+static int decodeAvx2(const char *in, int len, char *out)
+{
+    const __m256i lutLo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                           0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+                                           0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                           0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+    const __m256i lutHi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                           0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+                                           0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                           0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lutRoll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+                                             0, 0, 0, 0, 0, 0, 0, 0,
+                                             0, 16, 19, 4, -65, -65, -71, -71,
+                                             0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i pack = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                          2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, -1, -1);
+    int i = 0;
+    char *dst = out;
+    // 32 characters to 24 bytes, the store is 32 bytes wide
+    for(; i + 48 <= len; i += 32) {
+        const __m256i input = _mm256_loadu_si256((const __m256i *)(in + i));
+        const __m256i hiNibble = _mm256_and_si256(_mm256_srli_epi32(input, 4), _mm256_set1_epi8(0x0f));
+        const __m256i loNibble = _mm256_and_si256(input, _mm256_set1_epi8(0x0f));
+        const __m256i lo = _mm256_shuffle_epi8(lutLo, loNibble);
+        const __m256i hi = _mm256_shuffle_epi8(lutHi, hiNibble);
+        if(!_mm256_testz_si256(lo, hi)) {
+            return -1;
+        }
+        const __m256i eq2F = _mm256_cmpeq_epi8(input, _mm256_set1_epi8(0x2f));
+        const __m256i roll = _mm256_shuffle_epi8(lutRoll, _mm256_add_epi8(eq2F, hiNibble));
+        const __m256i values = _mm256_add_epi8(input, roll);
+        const __m256i mergeAb = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+        const __m256i merged = _mm256_madd_epi16(mergeAb, _mm256_set1_epi32(0x00011000));
+        const __m256i packed = _mm256_shuffle_epi8(merged, pack);
+        _mm256_storeu_si256((__m256i *)dst, _mm256_permutevar8x32_epi32(packed, lanes));
+        dst += 24;
+    }
+    int tail = decodeSse4(in + i, len - i, dst);
+    return tail < 0 ? -1 : (dst - out) + tail;
+}
+
+#endif // QTBASE64_X86
+
+struct CodecDispatch {
+    CodecDispatch() : encode(encodeScalar), decode(decodeScalar), name("scalar")
+    {
+#ifdef QTBASE64_X86
+        if(QtCpuFeatures::has(QtCpuFeatures::Avx2)) {
+            encode = encodeAvx2;
+            decode = decodeAvx2;
+            name = "avx2";
+        } else if(QtCpuFeatures::has(QtCpuFeatures::Sse41)) {
+            encode = encodeSse4;
+            decode = decodeSse4;
+            name = "sse4.1";
+        }
+#endif
+    }
+
+    CodecFunction encode;
+    CodecFunction decode;
+    const char *name;
+};
+
+static const CodecDispatch &dispatch()
+{
+    static const CodecDispatch codec;
+    return codec;
+}
+
+int QtBase64::encode(const char *in, int len, char *out)
+{
+    return dispatch().encode(in, len, out);
+}
+
+int QtBase64::decode(const char *in, int len, char *out)
+{
+    // trailing newline from readLine, then the padding
+    while(len > 0 && (in[len - 1] == '\n' || in[len - 1] == '\r'
+                      || in[len - 1] == ' ' || in[len - 1] == '\t')) {
+        len--;
+    }
+    for(int pad = 0; pad < 2 && len > 0 && in[len - 1] == '='; pad++) {
+        len--;
+    }
+    return dispatch().decode(in, len, out);
+}
+
+QByteArray QtBase64::encode(const QByteArray &in)
+{
+    QByteArray out(encodedLength(in.length()), Qt::Uninitialized);
+    out.resize(encode(in.constData(), in.length(), out.data()));
+    return out;
+}
+
+QByteArray QtBase64::decode(const QByteArray &in)
+{
+    QByteArray out(decodedMaxLength(in.length()), Qt::Uninitialized);
+    int len = decode(in.constData(), in.length(), out.data());
+    if(len < 0) {
+        return QByteArray();
+    }
+    out.resize(len);
+    return out;
+}
+
+const char *QtBase64::implementation()
+{
+    return dispatch().name;
+}
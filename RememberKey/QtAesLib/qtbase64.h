@@ -0,0 +1,24 @@
+#ifndef QTBASE64_H
+#define QTBASE64_H
+
+#include <QByteArray>
+
+// Standard base64 with padding, vectorized where the CPU allows it
+class QtBase64
+{
+public:
+    static int encodedLength(int len) { return (len + 2) / 3 * 4; }
+    static int decodedMaxLength(int len) { return len / 4 * 3 + 3; }
+
+    // Write into a caller buffer of at least encodedLength/decodedMaxLength bytes.
+    // decode ignores trailing whitespace and returns -1 on any other bad character.
+    static int encode(const char *in, int len, char *out);
+    static int decode(const char *in, int len, char *out);
+
+    static QByteArray encode(const QByteArray &in);
+    static QByteArray decode(const QByteArray &in);
+
+    static const char *implementation();
+};
+
+#endif // QTBASE64_H
@@ -0,0 +1,117 @@
+#include "qtcpufeatures.h"
+
+#include <QStringList>
+#include <openssl/crypto.h>
+#include "qtaes.h"
+#include "qtbase64.h"
+#include "qthash.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#define QTCPU_X86
+#elif defined(__aarch64__) && defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#define QTCPU_ARM_LINUX
+#endif
+
+static quint32 detectFeatures()
+{
+    quint32 features = 0;
+#if defined(QTCPU_X86)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("sse4.1")) {
+        features |= QtCpuFeatures::Sse41;
+    }
+    // also checks the OS saves the YMM registers
+    if(__builtin_cpu_supports("avx2")) {
+        features |= QtCpuFeatures::Avx2;
+    }
+
+    unsigned int eax, ebx, ecx, edx;
+    if(__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        if(ecx & bit_AES) {
+            features |= QtCpuFeatures::AesNi;
+        }
+        if(ecx & bit_PCLMUL) {
+            features |= QtCpuFeatures::Pclmul;
+        }
+    }
+    if(__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+        if((ecx & (1u << 9)) && (features & QtCpuFeatures::Avx2)) {
+            features |= QtCpuFeatures::Vaes;
+        }
+        if((ecx & (1u << 10)) && (features & QtCpuFeatures::Avx2)) {
+            features |= QtCpuFeatures::VPclmul;
+        }
+        if(ebx & (1u << 29)) {
+            features |= QtCpuFeatures::ShaNi;
+        }
+    }
+#elif defined(QTCPU_ARM_LINUX)
+    unsigned long hwcap = getauxval(AT_HWCAP);
+    if(hwcap & HWCAP_ASIMD) {
+        features |= QtCpuFeatures::Neon;
+    }
+    if(hwcap & HWCAP_AES) {
+        features |= QtCpuFeatures::ArmAes;
+    }
+    if(hwcap & HWCAP_PMULL) {
+        features |= QtCpuFeatures::ArmPmull;
+    }
+    if(hwcap & HWCAP_SHA2) {
+        features |= QtCpuFeatures::ArmSha2;
+    }
+#elif defined(__aarch64__) && defined(__APPLE__)
+    // every Apple arm64 core has the crypto extension
+    features |= QtCpuFeatures::Neon | QtCpuFeatures::ArmAes
+            | QtCpuFeatures::ArmPmull | QtCpuFeatures::ArmSha2;
+#endif
+    return features;
+}
+
+quint32 QtCpuFeatures::features()
+{
+    static const quint32 detected = detectFeatures();
+    return detected;
+}
+
+bool QtCpuFeatures::hasFastAesGcm()
+{
+    return (has(AesNi) && has(Pclmul)) || (has(ArmAes) && has(ArmPmull));
+}
+
+QString QtCpuFeatures::describe()
+{
+    static const struct {
+        Feature feature;
+        const char *name;
+    } names[] = {
+        { Sse41, "sse4.1" }, { Avx2, "avx2" }, { AesNi, "aes-ni" }, { Pclmul, "pclmul" },
+        { Vaes, "vaes" }, { VPclmul, "vpclmulqdq" }, { ShaNi, "sha-ni" },
+        { Neon, "neon" }, { ArmAes, "arm-aes" }, { ArmPmull, "arm-pmull" }, { ArmSha2, "arm-sha2" }
+    };
+
+    QStringList found;
+    for(const auto &name : names) {
+        if(has(name.feature)) {
+            found << name.name;
+        }
+    }
+
+    QString cipher = QtAes::detectCipherMode() == QtAes::AesGcm ? "aes-256-gcm" : "chacha20-poly1305";
+    // which instructions OpenSSL's cipher and digest code use is its call
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    QString openssl = QString("%1, %2").arg(OpenSSL_version(OPENSSL_VERSION))
+            .arg(OpenSSL_version(OPENSSL_CPU_INFO));
+#else
+    QString openssl = OpenSSL_version(OPENSSL_VERSION);
+#endif
+
+    return QString("cpu: %1; cipher: %2; base64: %3; hash: %4; openssl: %5")
+            .arg(found.isEmpty() ? QString("generic") : found.join(" "))
+            .arg(cipher)
+            .arg(QtBase64::implementation())
+            .arg(QtHash::implementation())
+            .arg(openssl);
+}
@@ -0,0 +1,39 @@
+#ifndef QTCPUFEATURES_H
+#define QTCPUFEATURES_H
+
+#include <QString>
+
+// What the host CPU can do, detected once on first use. Base64 binds its
+// SIMD codec from this and QtAes picks GCM or ChaCha20 with it. The block
+// cipher and digest code inside OpenSSL is OpenSSL's own choice, made from
+// its own CPU probe, so nothing here binds it.
+class QtCpuFeatures
+{
+public:
+    enum Feature {
+        Sse41       = 0x0001,
+        Avx2        = 0x0002,
+        AesNi       = 0x0004,
+        Pclmul      = 0x0008,
+        Vaes        = 0x0010,   // 256-bit AES rounds, needs AVX2
+        VPclmul     = 0x0020,
+        ShaNi       = 0x0040,
+        Neon        = 0x0100,
+        ArmAes      = 0x0200,   // ARMv8 crypto extension
+        ArmPmull    = 0x0400,
+        ArmSha2     = 0x0800
+    };
+
+    static bool has(Feature feature) { return (features() & feature) != 0; }
+    static quint32 features();
+
+    // Hardware AES with carry-less multiply, i.e. GCM beats ChaCha20
+    static bool hasFastAesGcm();
+
+    // One line with the detected features and what actually runs: the
+    // cipher mode, the base64 codec, the digest backend and OpenSSL's own
+    // CPU capability vector
+    static QString describe();
+};
+
+#endif // QTCPUFEATURES_H
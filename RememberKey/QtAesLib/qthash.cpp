@@ -0,0 +1,95 @@
+#include "qthash.h"
+
+#include <openssl/evp.h>
+
+typedef QByteArray (*HashFunction)(const QByteArray &data, QCryptographicHash::Algorithm algorithm,
+                                   const EVP_MD *md);
+
+static QByteArray hashQt(const QByteArray &data, QCryptographicHash::Algorithm algorithm,
+                         const EVP_MD *)
+{
+    return QCryptographicHash::hash(data, algorithm);
+}
+
+static QByteArray hashOpenSsl(const QByteArray &data, QCryptographicHash::Algorithm algorithm,
+                              const EVP_MD *md)
+{
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int length = 0;
+    // the digest may end up as key material, a provider failure falls back to Qt
+    if(EVP_Digest(data.constData(), data.length(), digest, &length, md, NULL) != 1
+            || length != (unsigned int)EVP_MD_size(md)) {
+        return hashQt(data, algorithm, md);
+    }
+    return QByteArray((const char *)digest, length);
+}
+
+namespace {
+
+struct HashDispatch {
+    HashDispatch()
+    {
+        const struct {
+            QCryptographicHash::Algorithm algorithm;
+            const char *name;
+        } digests[] = {
+            { QCryptographicHash::Md5, "MD5" },
+            { QCryptographicHash::Sha1, "SHA1" },
+            { QCryptographicHash::Sha256, "SHA256" }
+        };
+        QByteArray names;
+        for(int i = 0; i < 3; i++) {
+            algorithms[i] = digests[i].algorithm;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+            // explicit fetch, so a provider without the digest is noticed here
+            mds[i] = EVP_MD_fetch(NULL, digests[i].name, NULL);
+#else
+            mds[i] = EVP_get_digestbyname(digests[i].name);
+#endif
+            functions[i] = mds[i] != NULL ? hashOpenSsl : hashQt;
+            names += QByteArray(i == 0 ? "" : " ") + QByteArray(digests[i].name).toLower()
+                    + (mds[i] != NULL ? "=openssl" : "=qt");
+        }
+        name = names;
+    }
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    ~HashDispatch()
+    {
+        for(EVP_MD *md : mds) {
+            EVP_MD_free(md);
+        }
+    }
+
+    EVP_MD *mds[3];
+#else
+    const EVP_MD *mds[3];
+#endif
+    QCryptographicHash::Algorithm algorithms[3];
+    HashFunction functions[3];
+    QByteArray name;
+};
+
+const HashDispatch &dispatch()
+{
+    static const HashDispatch hash;
+    return hash;
+}
+
+}
+
+QByteArray QtHash::hash(const QByteArray &data, QCryptographicHash::Algorithm algorithm)
+{
+    const HashDispatch &hash = dispatch();
+    for(int i = 0; i < 3; i++) {
+        if(hash.algorithms[i] == algorithm) {
+            return hash.functions[i](data, algorithm, hash.mds[i]);
+        }
+    }
+    return hashQt(data, algorithm, NULL);
+}
+
+const char *QtHash::implementation()
+{
+    return dispatch().name.constData();
+}
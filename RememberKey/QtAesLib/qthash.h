@@ -0,0 +1,19 @@
+#ifndef QTHASH_H
+#define QTHASH_H
+
+#include <QByteArray>
+#include <QCryptographicHash>
+
+// One-shot digests. MD5, SHA-1 and SHA-256 go through OpenSSL, which picks
+// its own SHA-NI / ARMv8 / AVX2 code; anything OpenSSL doesn't provide
+// (e.g. MD5 under a FIPS provider) falls back to Qt.
+class QtHash
+{
+public:
+    static QByteArray hash(const QByteArray &data, QCryptographicHash::Algorithm algorithm);
+
+    // the backend of each digest, like "md5=qt sha1=openssl sha256=openssl"
+    static const char *implementation();
+};
+
+#endif // QTHASH_H
@@ -0,0 +1,267 @@
+#include "qtkdf.h"
+
+#include <QStringList>
+#include <QElapsedTimer>
+#include <QDebug>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/opensslv.h>
+
+#if OPENSSL_VERSION_NUMBER >= 0x30200000L
+#include <openssl/kdf.h>
+#include <openssl/core_names.h>
+#define QTKDF_HAVE_ARGON2
+#endif
+
+static const int KDF_SALT_SIZE = 16;
+static const quint32 KDF_MAX_MEMORY_KIB = 1024 * 1024;
+static const quint32 SCRYPT_R = 8;
+// well past what calibrate picks on fast machines
+static const quint32 KDF_MAX_PBKDF2_ITERATIONS = 100000000;
+static const quint32 KDF_MAX_PASSES = 256;
+static const quint32 KDF_MAX_PARALLELISM = 64;
+
+static const char *algorithmName(QtKdf::Algorithm algorithm)
+{
+    switch(algorithm) {
+    case QtKdf::Argon2id:
+        return "argon2id";
+    case QtKdf::Argon2d:
+        return "argon2d";
+    case QtKdf::Scrypt:
+        return "scrypt";
+    default:
+        return "pbkdf2-sha256";
+    }
+}
+
+QString QtKdf::Params::toString() const
+{
+    return QString("%1$i=%2,m=%3,p=%4$%5")
+            .arg(algorithmName(algorithm))
+            .arg(iterations)
+            .arg(memoryKiB)
+            .arg(parallelism)
+            .arg(QString(salt.toBase64()));
+}
+
+QtKdf::Params QtKdf::Params::fromString(const QString &str)
+{
+    Params params;
+    QStringList parts = str.split("$");
+    if(parts.length() != 3) {
+        return Params();
+    }
+
+    if(parts.at(0) == algorithmName(Argon2id)) {
+        params.algorithm = Argon2id;
+    } else if(parts.at(0) == algorithmName(Argon2d)) {
+        params.algorithm = Argon2d;
+    } else if(parts.at(0) == algorithmName(Scrypt)) {
+        params.algorithm = Scrypt;
+    } else if(parts.at(0) == algorithmName(Pbkdf2Sha256)) {
+        params.algorithm = Pbkdf2Sha256;
+    } else {
+        return Params();
+    }
+
+    for(const QString &field : parts.at(1).split(",")) {
+        quint32 value = field.mid(2).toUInt();
+        if(field.startsWith("i=")) {
+            params.iterations = value;
+        } else if(field.startsWith("m=")) {
+            params.memoryKiB = value;
+        } else if(field.startsWith("p=")) {
+            params.parallelism = qMax<quint32>(value, 1);
+        }
+    }
+    params.salt = QByteArray::fromBase64(parts.at(2).toLatin1());
+    return params;
+}
+
+bool QtKdf::isAvailable(Algorithm algorithm)
+{
+    switch(algorithm) {
+    case Argon2id:
+    case Argon2d: {
+#ifdef QTKDF_HAVE_ARGON2
+        EVP_KDF *kdf = EVP_KDF_fetch(NULL, algorithm == Argon2d ? "ARGON2D" : "ARGON2ID", NULL);
+        EVP_KDF_free(kdf);
+        return kdf != NULL;
+#else
+        return false;
+#endif
+    }
+    case Scrypt:
+#ifndef OPENSSL_NO_SCRYPT
+        return true;
+#else
+        return false;
+#endif
+    default:
+        return true;
+    }
+}
+
+QtKdf::Algorithm QtKdf::preferredAlgorithm()
+{
+    if(isAvailable(Argon2id)) {
+        return Argon2id;
+    }
+    if(isAvailable(Scrypt)) {
+        return Scrypt;
+    }
+    return Pbkdf2Sha256;
+}
+
+QtKdf::Params QtKdf::minimumParams(Algorithm algorithm)
+{
+    // OWASP floors, calibration never goes below these
+    Params params;
+    params.algorithm = algorithm;
+    switch(algorithm) {
+    case Argon2id:
+    case Argon2d:
+        params.iterations = 2;
+        params.memoryKiB = 19 * 1024;
+        break;
+    case Scrypt:
+        params.iterations = 1;
+        params.memoryKiB = (1 << 15) * SCRYPT_R * 128 / 1024;
+        break;
+    default:
+        params.iterations = 600000;
+        break;
+    }
+
+    params.salt.resize(KDF_SALT_SIZE);
+    RAND_bytes((unsigned char *)params.salt.data(), KDF_SALT_SIZE);
+    return params;
+}
+
+QtKdf::Params QtKdf::portableParams()
+{
+    return minimumParams(isAvailable(Scrypt) ? Scrypt : Pbkdf2Sha256);
+}
+
+bool QtKdf::isWithinLimits(const Params &params)
+{
+    if(params.memoryKiB > KDF_MAX_MEMORY_KIB || params.parallelism > KDF_MAX_PARALLELISM) {
+        return false;
+    }
+    return params.iterations <= (params.algorithm == Pbkdf2Sha256 ? KDF_MAX_PBKDF2_ITERATIONS : KDF_MAX_PASSES);
+}
+
+QByteArray QtKdf::derive(const QString &password, const Params &params, int length)
+{
+    QByteArray pass = password.toUtf8();
+    QByteArray out = derive(pass, params, length);
+    pass.fill('\0');
+    return out;
+}
+
+QByteArray QtKdf::derive(const QByteArray &secret, const Params &params, int length)
+{
+    if(!params.isValid()) {
+        return QByteArray();
+    }
+
+    QByteArray pass = secret;
+    QByteArray out(length, '\0');
+    unsigned char *outbuffer = (unsigned char *)out.data();
+    const unsigned char *salt = (const unsigned char *)params.salt.constData();
+    bool ok = false;
+
+    switch(params.algorithm) {
+    case Argon2id:
+    case Argon2d: {
+#ifdef QTKDF_HAVE_ARGON2
+        EVP_KDF *kdf = EVP_KDF_fetch(NULL, params.algorithm == Argon2d ? "ARGON2D" : "ARGON2ID", NULL);
+        if(kdf == NULL) {
+            break;
+        }
+        EVP_KDF_CTX *ctx = EVP_KDF_CTX_new(kdf);
+        uint32_t iter = params.iterations;
+        uint32_t memcost = params.memoryKiB;
+        uint32_t lanes = params.parallelism;
+        OSSL_PARAM ossl[] = {
+            OSSL_PARAM_construct_octet_string(OSSL_KDF_PARAM_PASSWORD, pass.data(), pass.length()),
+            OSSL_PARAM_construct_octet_string(OSSL_KDF_PARAM_SALT, (void *)salt, params.salt.length()),
+            OSSL_PARAM_construct_uint32(OSSL_KDF_PARAM_ITER, &iter),
+            OSSL_PARAM_construct_uint32(OSSL_KDF_PARAM_ARGON2_MEMCOST, &memcost),
+            OSSL_PARAM_construct_uint32(OSSL_KDF_PARAM_ARGON2_LANES, &lanes),
+            OSSL_PARAM_construct_uint32(OSSL_KDF_PARAM_THREADS, &lanes),
+            OSSL_PARAM_construct_end()
+        };
+        ok = EVP_KDF_derive(ctx, outbuffer, length, ossl) > 0;
+        if(!ok) {
+            // no thread pool in this OpenSSL, run the lanes in one thread
+            uint32_t single = 1;
+            ossl[5] = OSSL_PARAM_construct_uint32(OSSL_KDF_PARAM_THREADS, &single);
+            ok = EVP_KDF_derive(ctx, outbuffer, length, ossl) > 0;
+        }
+        EVP_KDF_CTX_free(ctx);
+        EVP_KDF_free(kdf);
+#endif
+        break;
+    }
+    case Scrypt: {
+#ifndef OPENSSL_NO_SCRYPT
+        quint64 n = (quint64)params.memoryKiB * 1024 / (128 * SCRYPT_R);
+        quint64 maxmem = (quint64)params.memoryKiB * 1024 * (params.parallelism + 1) + 1024 * 1024;
+        ok = EVP_PBE_scrypt(pass.constData(), pass.length(), salt, params.salt.length(),
+                            n, SCRYPT_R, params.parallelism, maxmem, outbuffer, length) > 0;
+#endif
+        break;
+    }
+    default:
+        ok = PKCS5_PBKDF2_HMAC(pass.constData(), pass.length(), salt, params.salt.length(),
+                               params.iterations, EVP_sha256(), length, outbuffer) > 0;
+        break;
+    }
+
+    pass.fill('\0');
+    if(!ok) {
+        qDebug() << "Key derivation failed" << algorithmName(params.algorithm);
+        out.fill('\0');
+        return QByteArray();
+    }
+    return out;
+}
+
+QtKdf::Params QtKdf::calibrate(int budgetMs, Algorithm algorithm)
+{
+    Params best = minimumParams(algorithm);
+    Params next = best;
+    QElapsedTimer timer;
+
+    // double the cost until one derivation no longer fits in the budget
+    forever {
+        timer.start();
+        if(derive(QStringLiteral("calibrate"), next, 32).isEmpty()) {
+            break;
+        }
+        qint64 elapsed = timer.elapsed();
+        qDebug() << "KDF calibration" << next.toString() << elapsed << "ms";
+        if(elapsed > budgetMs) {
+            break;
+        }
+        best = next;
+
+        // grow memory first for memory-hard functions, then passes
+        if(algorithm != Pbkdf2Sha256 && next.memoryKiB * 2 <= KDF_MAX_MEMORY_KIB) {
+            next.memoryKiB *= 2;
+        } else if(algorithm == Scrypt) {
+            break;
+        } else {
+            next.iterations *= 2;
+        }
+
+        // the next step roughly doubles the time, stop before overshooting
+        if(elapsed * 2 > budgetMs) {
+            break;
+        }
+    }
+
+    return best;
+}
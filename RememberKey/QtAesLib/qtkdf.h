@@ -0,0 +1,51 @@
+#ifndef QTKDF_H
+#define QTKDF_H
+
+#include <QObject>
+
+class QtKdf
+{
+public:
+    enum Algorithm {
+        Pbkdf2Sha256 = 0,
+        Scrypt = 1,
+        Argon2id = 2,
+        // only to open other programs' files, never chosen for a vault
+        Argon2d = 3
+    };
+
+    // Stored in the vault header as "name$i=..,m=..,p=..$salt"
+    struct Params {
+        Params() : algorithm(Pbkdf2Sha256), iterations(0), memoryKiB(0), parallelism(1) {}
+
+        bool isValid() const { return iterations > 0 && !salt.isEmpty(); }
+        QString toString() const;
+        static Params fromString(const QString &str);
+
+        Algorithm algorithm;
+        quint32 iterations;     // PBKDF2 rounds, Argon2 passes, unused by scrypt
+        quint32 memoryKiB;      // scrypt and Argon2 memory cost
+        quint32 parallelism;
+        QByteArray salt;
+    };
+
+    static bool isAvailable(Algorithm algorithm);
+    static Algorithm preferredAlgorithm();
+    static Params minimumParams(Algorithm algorithm);
+    // Minimum cost of a function every supported OpenSSL has, for files
+    // opened on other machines. Argon2 needs OpenSSL 3.2.
+    static Params portableParams();
+    // Costs a file may ask for, a damaged or hostile header can't make
+    // the derivation run for hours or take all the memory
+    static bool isWithinLimits(const Params &params);
+
+    static QByteArray derive(const QString &password, const Params &params, int length);
+    // for keys that aren't text, like a KeePass composite key
+    static QByteArray derive(const QByteArray &secret, const Params &params, int length);
+
+    // Pick the highest cost whose derivation still fits in budgetMs on this machine
+    static Params calibrate(int budgetMs, Algorithm algorithm);
+    static Params calibrate(int budgetMs) { return calibrate(budgetMs, preferredAlgorithm()); }
+};
+
+#endif // QTKDF_H
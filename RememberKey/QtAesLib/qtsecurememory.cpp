@@ -0,0 +1,272 @@
+#include "qtsecurememory.h"
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <string.h>
+#include <openssl/crypto.h>
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+static const size_t ARENA_REGION_SIZE = 64 * 1024;
+static const size_t ARENA_MIN_CLASS = 32;
+static const int ARENA_CLASS_COUNT = 8;     // 32 bytes .. 4 KiB
+static const size_t ARENA_HEADER_SIZE = 16; // keeps payloads 16-byte aligned
+
+namespace {
+
+struct BlockHeader {
+    size_t size;    // class size or mapped size, header included
+    int sizeClass;  // -1 for blocks with their own mapping
+};
+
+struct FreeBlock {
+    FreeBlock *next;
+};
+
+class Arena
+{
+public:
+    Arena() : current(nullptr), remaining(0), locked(true), locked_bytes(0)
+    {
+        for(int i = 0; i < ARENA_CLASS_COUNT; i++) {
+            freeList[i] = nullptr;
+        }
+    }
+
+    void *allocate(size_t size)
+    {
+        size_t total = size + ARENA_HEADER_SIZE;
+        int sizeClass = 0;
+        while(sizeClass < ARENA_CLASS_COUNT && (ARENA_MIN_CLASS << sizeClass) < total) {
+            sizeClass++;
+        }
+
+        char *block = nullptr;
+        if(sizeClass >= ARENA_CLASS_COUNT) {
+            // big secrets (notes with attachments) get their own locked mapping
+            total = roundToPage(total);
+            block = (char *)mapRegion(total);
+            if(block == nullptr) {
+                return nullptr;
+            }
+            sizeClass = -1;
+        } else {
+            total = ARENA_MIN_CLASS << sizeClass;
+            QMutexLocker locker(&mutex);
+            if(freeList[sizeClass] != nullptr) {
+                block = (char *)freeList[sizeClass];
+                freeList[sizeClass] = freeList[sizeClass]->next;
+            } else {
+                if(remaining < total) {
+                    current = (char *)mapRegion(ARENA_REGION_SIZE);
+                    remaining = current ? ARENA_REGION_SIZE : 0;
+                    if(current == nullptr) {
+                        return nullptr;
+                    }
+                }
+                block = current;
+                current += total;
+                remaining -= total;
+            }
+        }
+
+        BlockHeader *header = (BlockHeader *)block;
+        header->size = total;
+        header->sizeClass = sizeClass;
+        return block + ARENA_HEADER_SIZE;
+    }
+
+    void release(void *ptr)
+    {
+        char *block = (char *)ptr - ARENA_HEADER_SIZE;
+        BlockHeader *header = (BlockHeader *)block;
+        size_t total = header->size;
+        int sizeClass = header->sizeClass;
+        OPENSSL_cleanse(ptr, total - ARENA_HEADER_SIZE);
+
+        if(sizeClass < 0) {
+            unmapRegion(block, total);
+            return;
+        }
+        QMutexLocker locker(&mutex);
+        FreeBlock *free = (FreeBlock *)block;
+        free->next = freeList[sizeClass];
+        freeList[sizeClass] = free;
+    }
+
+    bool isLocked()
+    {
+        QMutexLocker locker(&lockMutex);
+        return locked;
+    }
+
+    size_t lockedBytes()
+    {
+        QMutexLocker locker(&lockMutex);
+        return locked_bytes;
+    }
+
+private:
+    static size_t pageSize()
+    {
+#ifdef Q_OS_WIN
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return info.dwPageSize;
+#else
+        return sysconf(_SC_PAGESIZE);
+#endif
+    }
+
+    static size_t roundToPage(size_t size)
+    {
+        size_t page = pageSize();
+        return (size + page - 1) / page * page;
+    }
+
+    void *mapRegion(size_t size)
+    {
+        bool ok;
+#ifdef Q_OS_WIN
+        void *region = VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+        if(region == NULL) {
+            return nullptr;
+        }
+        ok = VirtualLock(region, size);
+#else
+        void *region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(region == MAP_FAILED) {
+            return nullptr;
+        }
+        ok = mlock(region, size) == 0;
+#ifdef MADV_DONTDUMP
+        madvise(region, size, MADV_DONTDUMP);
+#endif
+#endif
+        QMutexLocker locker(&lockMutex);
+        if(ok) {
+            locked_bytes += size;
+        } else {
+            // still usable and still wiped, just not pinned
+            locked = false;
+        }
+        return region;
+    }
+
+    void unmapRegion(void *region, size_t size)
+    {
+#ifdef Q_OS_WIN
+        bool wasLocked = VirtualUnlock(region, size);
+        VirtualFree(region, 0, MEM_RELEASE);
+#else
+        bool wasLocked = munlock(region, size) == 0;
+        munmap(region, size);
+#endif
+        QMutexLocker locker(&lockMutex);
+        if(wasLocked) {
+            locked_bytes -= size;
+        }
+    }
+
+    QMutex mutex;
+    QMutex lockMutex;
+    FreeBlock *freeList[ARENA_CLASS_COUNT];
+    char *current;
+    size_t remaining;
+    bool locked;
+    size_t locked_bytes;
+};
+
+Arena &arena()
+{
+    static Arena instance;
+    return instance;
+}
+
+}
+
+void *QtSecureMemory::allocate(size_t size)
+{
+    return arena().allocate(size == 0 ? 1 : size);
+}
+
+void QtSecureMemory::release(void *ptr)
+{
+    if(ptr != nullptr) {
+        arena().release(ptr);
+    }
+}
+
+void QtSecureMemory::wipe(void *ptr, size_t size)
+{
+    OPENSSL_cleanse(ptr, size);
+}
+
+bool QtSecureMemory::isLocked()
+{
+    return arena().isLocked();
+}
+
+size_t QtSecureMemory::lockedBytes()
+{
+    return arena().lockedBytes();
+}
+
+QtSecureBuffer::QtSecureBuffer(int size) :
+    buffer(nullptr), length(0)
+{
+    resize(size);
+}
+
+QtSecureBuffer::QtSecureBuffer(const char *data, int size) :
+    buffer(nullptr), length(0)
+{
+    assign(data, size);
+}
+
+bool QtSecureBuffer::assign(const char *data, int size)
+{
+    if(!resize(size)) {
+        return false;
+    }
+    if(size > 0) {
+        memcpy(buffer, data, size);
+    }
+    return true;
+}
+
+bool QtSecureBuffer::resize(int size)
+{
+    if(size == length) {
+        return true;
+    }
+    char *resized = nullptr;
+    if(size > 0) {
+        resized = (char *)QtSecureMemory::allocate(size);
+        if(resized == nullptr) {
+            // the old contents go too, nobody reads a half resized secret
+            QtSecureMemory::release(buffer);
+            buffer = nullptr;
+            length = 0;
+            return false;
+        }
+        memset(resized, 0, size);
+        if(buffer != nullptr) {
+            memcpy(resized, buffer, qMin(size, length));
+        }
+    }
+    QtSecureMemory::release(buffer);
+    buffer = resized;
+    length = size;
+    return true;
+}
+
+void QtSecureBuffer::clear()
+{
+    resize(0);
+}
@@ -0,0 +1,50 @@
+#ifndef QTSECUREMEMORY_H
+#define QTSECUREMEMORY_H
+
+#include <QtGlobal>
+#include <stddef.h>
+
+// Process-wide arena for secrets. Pages are locked in RAM (never swapped,
+// excluded from core dumps where supported) and every block is zeroed when
+// it's released. Small blocks come from size-class free lists, so repeated
+// allocations don't go back to the system.
+class QtSecureMemory
+{
+public:
+    // nullptr when no memory could be mapped
+    static void *allocate(size_t size);
+    static void release(void *ptr);
+    static void wipe(void *ptr, size_t size);
+
+    // false when the OS refused to lock pages (e.g. RLIMIT_MEMLOCK)
+    static bool isLocked();
+    static size_t lockedBytes();
+};
+
+// Owning buffer in the secure arena
+class QtSecureBuffer
+{
+public:
+    QtSecureBuffer() : buffer(nullptr), length(0) {}
+    explicit QtSecureBuffer(int size);
+    QtSecureBuffer(const char *data, int size);
+    ~QtSecureBuffer() { clear(); }
+
+    // false when the arena is out of memory, the buffer is left empty then
+    bool assign(const char *data, int size);
+    bool resize(int size);
+    void clear();
+
+    char *data() { return buffer; }
+    const char *constData() const { return buffer; }
+    int size() const { return length; }
+    bool isEmpty() const { return length == 0; }
+
+private:
+    Q_DISABLE_COPY(QtSecureBuffer)
+
+    char *buffer;
+    int length;
+};
+
+#endif // QTSECUREMEMORY_H
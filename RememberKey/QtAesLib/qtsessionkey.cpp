@@ -0,0 +1,89 @@
+#include "qtsessionkey.h"
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+
+static const int SESSION_KEY_SIZE = 32;
+static const int SESSION_CHECK_SIZE = 32;
+
+QtSessionKey::QtSessionKey(QtAes *aes) :
+    cryptoAes(aes), window(0)
+{
+    expireTimer.setSingleShot(true);
+    QObject::connect(&expireTimer, &QTimer::timeout, [this]() {
+        clear();
+    });
+}
+
+QtSessionKey::~QtSessionKey()
+{
+    expireTimer.stop();
+    hmacKey.clear();
+    check.clear();
+}
+
+void QtSessionKey::hold(const QString &password)
+{
+    expireTimer.stop();
+    // without secure memory nothing is held, the next unlock derives again
+    if(!hmacKey.resize(SESSION_KEY_SIZE) || !check.resize(SESSION_CHECK_SIZE)) {
+        hmacKey.clear();
+        check.clear();
+        return;
+    }
+    RAND_bytes((unsigned char *)hmacKey.data(), SESSION_KEY_SIZE);
+    computeCheck(password, (unsigned char *)check.data());
+}
+
+void QtSessionKey::lock()
+{
+    if(check.isEmpty()) {
+        return;
+    }
+    if(window <= 0) {
+        clear();
+        return;
+    }
+    expireTimer.start(window);
+}
+
+QtSessionKey::Result QtSessionKey::unlock(const QString &password)
+{
+    Result result = matches(password);
+    if(result == Accepted) {
+        expireTimer.stop();
+    }
+    return result;
+}
+
+QtSessionKey::Result QtSessionKey::matches(const QString &password) const
+{
+    if(check.isEmpty()) {
+        return Expired;
+    }
+
+    unsigned char candidate[SESSION_CHECK_SIZE];
+    computeCheck(password, candidate);
+    bool same = CRYPTO_memcmp(candidate, check.constData(), SESSION_CHECK_SIZE) == 0;
+    QtSecureMemory::wipe(candidate, sizeof(candidate));
+    return same ? Accepted : Rejected;
+}
+
+void QtSessionKey::clear()
+{
+    expireTimer.stop();
+    hmacKey.clear();
+    check.clear();
+    cryptoAes->clear();
+}
+
+void QtSessionKey::computeCheck(const QString &password, unsigned char *out) const
+{
+    QByteArray bytes = password.toUtf8();
+    unsigned int length = SESSION_CHECK_SIZE;
+    HMAC(EVP_sha256(), hmacKey.constData(), hmacKey.size(),
+         (const unsigned char *)bytes.constData(), bytes.length(), out, &length);
+    QtSecureMemory::wipe(bytes.data(), bytes.length());
+}
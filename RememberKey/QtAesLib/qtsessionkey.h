@@ -0,0 +1,49 @@
+#ifndef QTSESSIONKEY_H
+#define QTSESSIONKEY_H
+
+#include <QTimer>
+#include "qtaes.h"
+#include "qtsecurememory.h"
+
+// Keeps an unlocked QtAes usable across relocks for a while, so re-entering
+// the password doesn't run the KDF again. The password is checked against
+// an HMAC under a random per-session key, both in the secure arena. When
+// the window runs out, the keys in the QtAes are wiped.
+class QtSessionKey
+{
+public:
+    enum Result {
+        Expired,    // nothing held, derive the key again
+        Accepted,   // same password, the keys are still in place
+        Rejected    // different password
+    };
+
+    explicit QtSessionKey(QtAes *aes);
+    ~QtSessionKey();
+
+    // 0 wipes the keys on every lock
+    void setWindow(int ms) { window = ms; }
+    int getWindow() const { return window; }
+
+    // After the password was proved right
+    void hold(const QString &password);
+    void lock();
+    Result unlock(const QString &password);
+    // Same check as unlock, nothing is unlocked or kept
+    Result matches(const QString &password) const;
+    // Wipes the check value and the keys
+    void clear();
+
+private:
+    Q_DISABLE_COPY(QtSessionKey)
+
+    void computeCheck(const QString &password, unsigned char *out) const;
+
+    QtAes *cryptoAes;
+    QtSecureBuffer hmacKey;
+    QtSecureBuffer check;
+    QTimer expireTimer;
+    int window;
+};
+
+#endif // QTSESSIONKEY_H
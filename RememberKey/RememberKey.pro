@@ -3,4 +3,6 @@ TEMPLATE = subdirs
 SUBDIRS += \
     QtAesLib \
     QtOneDriveLib \
-    RememberKey
+    RememberKey \
+    RememberKeyBench \
+    RememberKeyTest
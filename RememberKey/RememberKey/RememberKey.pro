@@ -4,7 +4,7 @@
 #
 #-------------------------------------------------
 
-QT       += core gui sql network xml
+QT       += core gui sql network xml concurrent
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
@@ -17,7 +17,20 @@ SOURCES += main.cpp\
     editdialog.cpp \
     keydatabase.cpp \
     keyinfo.cpp \
+    keytablemodel.cpp \
+    keyarchive.cpp \
+    keysearchworker.cpp \
+    asynckeydatabase.cpp \
+    keepassximporter.cpp \
+    kdbxreader.cpp \
     ../QtAesLib/qtaes.cpp \
+    ../QtAesLib/qtkdf.cpp \
+    ../QtAesLib/qtbase64.cpp \
+    ../QtAesLib/qtaesstream.cpp \
+    ../QtAesLib/qtsecurememory.cpp \
+    ../QtAesLib/qtcpufeatures.cpp \
+    ../QtAesLib/qthash.cpp \
+    ../QtAesLib/qtsessionkey.cpp \
     ../QtOneDriveLib/qtonedrive.cpp \
     onedrivedialog.cpp \
     createdialog.cpp \
@@ -27,7 +40,22 @@ HEADERS  += mainwindow.h \
     editdialog.h \
     keydatabase.h \
     keyinfo.h \
+    keytablemodel.h \
+    keyarchive.h \
+    keysearchworker.h \
+    asynckeydatabase.h \
+    keepassximporter.h \
+    kdbxreader.h \
+    boundedqueue.h \
+    importpipeline.h \
     ../QtAesLib/qtaes.h \
+    ../QtAesLib/qtkdf.h \
+    ../QtAesLib/qtbase64.h \
+    ../QtAesLib/qtaesstream.h \
+    ../QtAesLib/qtsecurememory.h \
+    ../QtAesLib/qtcpufeatures.h \
+    ../QtAesLib/qthash.h \
+    ../QtAesLib/qtsessionkey.h \
     ../QtOneDriveLib/qtonedrive.h \
     onedrivedialog.h \
     createdialog.h \
@@ -45,12 +73,14 @@ unix {
 #   CONFIG +=  link_pkgconfig
 #   PKGCONFIG += openssl
     INCLUDEPATH += /usr/local/include
-    LIBS += -L/usr/local/lib -L/usr/lib -lcrypto
+    LIBS += -L/usr/local/lib -L/usr/lib -lcrypto -lz
 }
 
 win32 {
-    LIBS += -LC:/OpenSSL-Win32/lib/MinGW/ -leay32
-    INCLUDEPATH += C:/OpenSSL-Win32/include
+    # see QtAesLib.pro
+    isEmpty(WIN_DEPS): WIN_DEPS = C:/msys64/mingw64
+    LIBS += -L$$WIN_DEPS/lib -lcrypto -lz
+    INCLUDEPATH += $$WIN_DEPS/include
 }
 
 CONFIG(release, debug|release):DEFINES += QT_NO_DEBUG_OUTPUT
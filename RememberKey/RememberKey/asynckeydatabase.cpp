@@ -0,0 +1,169 @@
+#include "asynckeydatabase.h"
+
+#include <QtConcurrent>
+
+AsyncKeyDatabase::AsyncKeyDatabase(const QString &connectionName, QObject *parent) :
+    QObject(parent),
+    database(nullptr)
+{
+    // one thread that never expires, so the connection always sees the same one
+    worker.setMaxThreadCount(1);
+    worker.setExpiryTimeout(-1);
+    post([this, connectionName](KeyDatabase *) {
+        database = new KeyDatabase(connectionName);
+    });
+}
+
+AsyncKeyDatabase::~AsyncKeyDatabase()
+{
+    post([this](KeyDatabase *db) {
+        db->close();
+        delete db;
+        database = nullptr;
+    });
+    worker.waitForDone();
+}
+
+QFuture<bool> AsyncKeyDatabase::run(const QString &operation, std::function<bool(KeyDatabase *)> work)
+{
+    return QtConcurrent::run(&worker, [this, operation, work]() {
+        bool ok = work(database);
+        QString message;
+        if(!ok) {
+            message = database->getLastErrorMessage();
+            QMutexLocker locker(&errorMutex);
+            errorMessage = message;
+        }
+        emit finished(operation, ok, message);
+        return ok;
+    });
+}
+
+QFuture<void> AsyncKeyDatabase::post(std::function<void(KeyDatabase *)> work)
+{
+    return QtConcurrent::run(&worker, [this, work]() {
+        work(database);
+    });
+}
+
+void AsyncKeyDatabase::waitForIdle()
+{
+    post([](KeyDatabase *) {}).waitForFinished();
+}
+
+QString AsyncKeyDatabase::getLastErrorMessage()
+{
+    QMutexLocker locker(&errorMutex);
+    return errorMessage;
+}
+
+QFuture<bool> AsyncKeyDatabase::create(const QString &path, const QString &password, const QtAes *aes)
+{
+    return run("create", [path, password, aes](KeyDatabase *db) {
+        return db->create(path, password, aes);
+    });
+}
+
+QFuture<bool> AsyncKeyDatabase::open(const QString &path)
+{
+    return run("open", [path](KeyDatabase *db) {
+        return db->open(path);
+    });
+}
+
+QFuture<bool> AsyncKeyDatabase::activePassword(const QString &pass, const QtAes *aes)
+{
+    return run("activePassword", [pass, aes](KeyDatabase *db) {
+        return db->activePassword(pass, aes);
+    });
+}
+
+QFuture<void> AsyncKeyDatabase::forgetPassword()
+{
+    return post([](KeyDatabase *db) {
+        db->forgetPassword();
+    });
+}
+
+QFuture<void> AsyncKeyDatabase::close()
+{
+    return post([](KeyDatabase *db) {
+        db->close();
+    });
+}
+
+QFuture<void> AsyncKeyDatabase::setConfig(const KeyDatabase::Config &config)
+{
+    return post([config](KeyDatabase *db) {
+        db->setConfig(config);
+    });
+}
+
+QFuture<void> AsyncKeyDatabase::setBatchSize(int size)
+{
+    return post([size](KeyDatabase *db) {
+        db->setBatchSize(size);
+    });
+}
+
+QFuture<bool> AsyncKeyDatabase::addKeyInfo(const KeyInfo &key)
+{
+    return run("addKeyInfo", [key](KeyDatabase *db) {
+        return db->addKeyInfo(key);
+    });
+}
+
+QFuture<bool> AsyncKeyDatabase::addMany(const QList<KeyInfo> &keys)
+{
+    return run("addMany", [keys](KeyDatabase *db) {
+        return db->addMany(keys);
+    });
+}
+
+QFuture<bool> AsyncKeyDatabase::updateKeyInfo(const KeyInfo &old, const KeyInfo &key)
+{
+    return run("updateKeyInfo", [old, key](KeyDatabase *db) {
+        return db->updateKeyInfo(old, key);
+    });
+}
+
+QFuture<bool> AsyncKeyDatabase::deleteKeyInfo(int keyId)
+{
+    return run("deleteKeyInfo", [keyId](KeyDatabase *db) {
+        return db->deleteKeyInfo(keyId);
+    });
+}
+
+QFuture<KeyInfo> AsyncKeyDatabase::getKeyInfo(int id)
+{
+    return QtConcurrent::run(&worker, [this, id]() {
+        KeyInfo key;
+        if(!database->getKeyInfo(id, &key)) {
+            key.reset();
+            key.setId(-1);
+        }
+        return key;
+    });
+}
+
+QFuture<QVector<int> > AsyncKeyDatabase::search(const QString &searchkey)
+{
+    return QtConcurrent::run(&worker, [this, searchkey]() {
+        database->search(searchkey);
+        return database->getQueryModel()->getIds();
+    });
+}
+
+QFuture<bool> AsyncKeyDatabase::exportToFile(QFile *file, const QString &password, bool compress)
+{
+    return run("exportToFile", [file, password, compress](KeyDatabase *db) {
+        return db->exportToFile(file, password, compress);
+    });
+}
+
+QFuture<bool> AsyncKeyDatabase::importFromFile(QFile *file, const QString &password)
+{
+    return run("importFromFile", [file, password](KeyDatabase *db) {
+        return db->importFromFile(file, password);
+    });
+}
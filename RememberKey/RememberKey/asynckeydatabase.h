@@ -0,0 +1,73 @@
+#ifndef ASYNCKEYDATABASE_H
+#define ASYNCKEYDATABASE_H
+
+#include <QObject>
+#include <QFuture>
+#include <QMutex>
+#include <QThreadPool>
+#include <functional>
+
+#include "keydatabase.h"
+
+// KeyDatabase on a worker thread of its own. The connection is created and
+// used only there; every call is queued and runs in the order it was made,
+// so writes never overtake each other. Results come back as futures and
+// through finished(), which is delivered on the caller's thread.
+//
+// Pointers handed in (aes, files) must stay valid until the future is done.
+//
+// Every write goes through here. The GUI connection only reads: the pages
+// of the table, the fields the user copies, and the one-row password check
+// on unlock. The unlock stays there on purpose, its prompt is modal anyway
+// and the key derivation is bounded by the calibrated budget.
+class AsyncKeyDatabase : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit AsyncKeyDatabase(const QString &connectionName, QObject *parent = 0);
+    // waits for the queue, then closes
+    ~AsyncKeyDatabase();
+
+    QFuture<bool> create(const QString &path, const QString &password, const QtAes *aes);
+    QFuture<bool> open(const QString &path);
+    QFuture<bool> activePassword(const QString &pass, const QtAes *aes);
+    QFuture<void> forgetPassword();
+    QFuture<void> close();
+    QFuture<void> setConfig(const KeyDatabase::Config &config);
+    QFuture<void> setBatchSize(int size);
+
+    QFuture<bool> addKeyInfo(const KeyInfo &key);
+    QFuture<bool> addMany(const QList<KeyInfo> &keys);
+    QFuture<bool> updateKeyInfo(const KeyInfo &old, const KeyInfo &key);
+    QFuture<bool> deleteKeyInfo(int keyId);
+    // id -1 when the record can't be read
+    QFuture<KeyInfo> getKeyInfo(int id);
+    QFuture<QVector<int> > search(const QString &searchkey);
+
+    QFuture<bool> exportToFile(QFile *file, const QString &password, bool compress = true);
+    QFuture<bool> importFromFile(QFile *file, const QString &password);
+
+    // Queues any work on the database, for operations made of several calls
+    QFuture<bool> run(const QString &operation, std::function<bool(KeyDatabase *)> work);
+
+    // blocks until everything queued so far has run
+    void waitForIdle();
+    // of the last operation that failed
+    QString getLastErrorMessage();
+
+signals:
+    void finished(const QString &operation, bool ok, const QString &errorMessage);
+
+private:
+    Q_DISABLE_COPY(AsyncKeyDatabase)
+
+    QFuture<void> post(std::function<void(KeyDatabase *)> work);
+
+    QThreadPool worker;
+    KeyDatabase *database;
+    QMutex errorMutex;
+    QString errorMessage;
+};
+
+#endif // ASYNCKEYDATABASE_H
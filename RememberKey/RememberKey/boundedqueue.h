@@ -0,0 +1,78 @@
+#ifndef BOUNDEDQUEUE_H
+#define BOUNDEDQUEUE_H
+
+#include <QQueue>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+
+// Queue between two threads that holds at most capacity items. push blocks
+// while it's full, so a fast producer waits for the consumer instead of
+// buffering the whole input.
+template<typename T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue(int capacity) : capacity(qMax(1, capacity)), closed(false), aborted(false) {}
+
+    // false once the consumer gave up
+    bool push(const T &item)
+    {
+        QMutexLocker locker(&mutex);
+        while(items.size() >= capacity && !aborted) {
+            notFull.wait(&mutex);
+        }
+        if(aborted) {
+            return false;
+        }
+        items.enqueue(item);
+        notEmpty.wakeOne();
+        return true;
+    }
+
+    // false when the producer is done and everything was taken
+    bool pop(T *item)
+    {
+        QMutexLocker locker(&mutex);
+        while(items.isEmpty() && !closed && !aborted) {
+            notEmpty.wait(&mutex);
+        }
+        if(items.isEmpty() || aborted) {
+            return false;
+        }
+        *item = items.dequeue();
+        notFull.wakeOne();
+        return true;
+    }
+
+    // producer side: nothing more is coming
+    void close()
+    {
+        QMutexLocker locker(&mutex);
+        closed = true;
+        notEmpty.wakeAll();
+    }
+
+    // either side: drop what's queued and release everyone waiting
+    void abort()
+    {
+        QMutexLocker locker(&mutex);
+        aborted = true;
+        items.clear();
+        notEmpty.wakeAll();
+        notFull.wakeAll();
+    }
+
+private:
+    Q_DISABLE_COPY(BoundedQueue)
+
+    const int capacity;
+    QQueue<T> items;
+    QMutex mutex;
+    QWaitCondition notEmpty;
+    QWaitCondition notFull;
+    bool closed;
+    bool aborted;
+};
+
+#endif // BOUNDEDQUEUE_H
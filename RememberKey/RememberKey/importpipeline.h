@@ -0,0 +1,109 @@
+#ifndef IMPORTPIPELINE_H
+#define IMPORTPIPELINE_H
+
+#include <QAtomicInt>
+#include <QMap>
+#include <QPair>
+#include <QThread>
+#include <QThreadPool>
+#include <QtConcurrent>
+#include <functional>
+
+#include "boundedqueue.h"
+
+// Three stage import: one producer thread reads the input, a pool of
+// workers transforms each item (decoding, encryption) and the calling
+// thread consumes the results, in the order they were produced. Stages are
+// joined by bounded queues, so a slow writer holds the others back instead
+// of letting the input pile up in memory.
+template<typename In, typename Out>
+class ImportPipeline
+{
+public:
+    static const int QueueSize = 256;
+
+    // hands one item to the workers, false once the consumer stopped
+    typedef std::function<bool(const In &)> Push;
+
+    typedef std::function<void(const Push &)> Produce;
+    // called on several threads at once
+    typedef std::function<Out(const In &)> Transform;
+    // false stops the whole pipeline
+    typedef std::function<bool(const Out &)> Consume;
+
+    explicit ImportPipeline(int workers = QThread::idealThreadCount()) :
+        workers(qMax(1, workers)),
+        input(QueueSize),
+        output(QueueSize)
+    {
+        // own pool, so the stages never wait behind unrelated global tasks
+        pool.setMaxThreadCount(this->workers + 1);
+    }
+
+    ~ImportPipeline()
+    {
+        input.abort();
+        output.abort();
+        pool.waitForDone();
+    }
+
+    // Returns false if consume stopped it, what was consumed before stays
+    bool run(const Produce &produce, const Transform &transform, const Consume &consume)
+    {
+        QAtomicInt running(workers);
+        for(int i = 0; i < workers; i++) {
+            QtConcurrent::run(&pool, [this, &transform, &running]() {
+                Item in;
+                while(input.pop(&in)) {
+                    if(!output.push(qMakePair(in.first, transform(in.second)))) {
+                        break;
+                    }
+                }
+                // the last worker out tells the consumer
+                if(!running.deref()) {
+                    output.close();
+                }
+            });
+        }
+        QtConcurrent::run(&pool, [this, &produce]() {
+            int sequence = 0;
+            produce([this, &sequence](const In &item) {
+                return input.push(qMakePair(sequence++, item));
+            });
+            input.close();
+        });
+
+        // workers finish out of order, results wait here for their turn
+        QMap<int, Out> pending;
+        int next = 0;
+        bool ok = true;
+        Result result;
+        while(ok && output.pop(&result)) {
+            pending.insert(result.first, result.second);
+            while(ok && !pending.isEmpty() && pending.firstKey() == next) {
+                ok = consume(pending.take(next));
+                next++;
+            }
+        }
+
+        if(!ok) {
+            input.abort();
+            output.abort();
+        }
+        pool.waitForDone();
+        return ok;
+    }
+
+private:
+    Q_DISABLE_COPY(ImportPipeline)
+
+    typedef QPair<int, In> Item;
+    typedef QPair<int, Out> Result;
+
+    const int workers;
+    QThreadPool pool;
+    BoundedQueue<Item> input;
+    BoundedQueue<Result> output;
+};
+
+#endif // IMPORTPIPELINE_H
@@ -0,0 +1,907 @@
+#include "kdbxreader.h"
+
+#include <QDebug>
+#include <QtEndian>
+#include <string.h>
+#include <openssl/hmac.h>
+#include <zlib.h>
+#include "../QtAesLib/qthash.h"
+#include "../QtAesLib/qtkdf.h"
+#include "importpipeline.h"
+
+#define KDBX_SIGNATURE1 0x9AA2D903
+#define KDBX_SIGNATURE2 0xB54BFB67
+
+// UUIDs as hex, compared against toHex() of the header values
+#define KDBX_CIPHER_AES256 "31c1f2e6bf714350be5805216afc5aff"
+#define KDBX_CIPHER_CHACHA20 "d6038a2b8b6f4cb5a524339a31dbb59a"
+#define KDBX_KDF_AES_KDBX3 "c9d9f39a628a4460bf740d08c18a4fea"
+#define KDBX_KDF_AES_KDBX4 "7c02bb8279a74ac0927d114a00648238"
+#define KDBX_KDF_ARGON2D "ef636ddf8c29444b91f7a9a403e30a0c"
+#define KDBX_KDF_ARGON2ID "9e298b1956db4773b23dfc3ec6f0a1e6"
+
+#define KDBX_SALSA20_NONCE "\xE8\x30\x09\x4B\x97\x20\x5D\x2A"
+
+enum HeaderField {
+    HeaderEnd = 0,
+    HeaderCipherId = 2,
+    HeaderCompression = 3,
+    HeaderMasterSeed = 4,
+    HeaderTransformSeed = 5,
+    HeaderTransformRounds = 6,
+    HeaderEncryptionIv = 7,
+    HeaderProtectedStreamKey = 8,
+    HeaderStreamStartBytes = 9,
+    HeaderInnerStreamId = 10,
+    HeaderKdfParameters = 11
+};
+
+enum InnerField {
+    InnerEnd = 0,
+    InnerStreamId = 1,
+    InnerStreamKey = 2,
+    InnerBinary = 3
+};
+
+enum InnerStream {
+    InnerSalsa20 = 2,
+    InnerChaCha20 = 3
+};
+
+static const int READ_SIZE = 64 * 1024;
+static const int INFLATE_SIZE = 64 * 1024;
+static const quint32 MAX_HEADER_FIELD = 1024 * 1024;
+static const qint32 MAX_BLOCK_SIZE = 64 * 1024 * 1024;
+static const int ARGON2_VERSION = 0x13;
+// seconds of work on current hardware, well past what KeePass calibrates
+// for a one second unlock. A damaged or hostile header can't hang the import.
+static const quint64 MAX_AES_KDF_ROUNDS = 200000000;
+
+static quint32 u32(const QByteArray &data, int pos)
+{
+    return qFromLittleEndian<quint32>((const uchar *)data.constData() + pos);
+}
+
+static quint64 u64(const QByteArray &data, int pos)
+{
+    return qFromLittleEndian<quint64>((const uchar *)data.constData() + pos);
+}
+
+// KDBX 4 "variant dictionary", values are kept as raw bytes
+static bool readVariants(const QByteArray &data, QHash<QString, QByteArray> *values)
+{
+    if(data.size() < 2 || (uchar)data.at(1) != 0x01) {
+        return false;
+    }
+    int pos = 2;
+    while(pos < data.size()) {
+        int type = (uchar)data.at(pos++);
+        if(type == 0) {
+            return true;
+        }
+        if(pos + 4 > data.size()) {
+            return false;
+        }
+        qint32 nameLength = u32(data, pos);
+        pos += 4;
+        if(nameLength < 0 || pos + nameLength + 4 > data.size()) {
+            return false;
+        }
+        QString name = QString::fromUtf8(data.mid(pos, nameLength));
+        pos += nameLength;
+        qint32 valueLength = u32(data, pos);
+        pos += 4;
+        if(valueLength < 0 || pos + valueLength > data.size()) {
+            return false;
+        }
+        values->insert(name, data.mid(pos, valueLength));
+        pos += valueLength;
+    }
+    return false;
+}
+
+static quint64 variantNumber(const QHash<QString, QByteArray> &values, const QString &name)
+{
+    QByteArray value = values.value(name);
+    if(value.size() == 8) {
+        return u64(value, 0);
+    }
+    return value.size() == 4 ? u32(value, 0) : 0;
+}
+
+static bool aesKdf(const QByteArray &key, const QByteArray &seed, quint64 rounds, QByteArray *out)
+{
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    bool ok = ctx != NULL && seed.size() == 32 && key.size() == 32
+            && EVP_EncryptInit_ex(ctx, EVP_aes_256_ecb(), NULL, (const uchar *)seed.constData(), NULL) > 0;
+    if(ok) {
+        EVP_CIPHER_CTX_set_padding(ctx, 0);
+    }
+
+    // both halves are ECB blocks, encrypted in place round after round
+    uchar data[32];
+    memcpy(data, key.constData(), qMin(key.size(), 32));
+    int length = 0;
+    for(quint64 i = 0; ok && i < rounds; i++) {
+        ok = EVP_EncryptUpdate(ctx, data, &length, data, sizeof(data)) > 0;
+    }
+    EVP_CIPHER_CTX_free(ctx);
+
+    if(ok) {
+        *out = QtHash::hash(QByteArray::fromRawData((const char *)data, sizeof(data)),
+                            QCryptographicHash::Sha256);
+    }
+    QtSecureMemory::wipe(data, sizeof(data));
+    return ok;
+}
+
+#define SALSA_ROTATE(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+// one 64-byte block of Salsa20/20 keystream, then the counter moves on
+static void salsa20Block(quint32 state[16], uchar out[64])
+{
+    quint32 x[16];
+    memcpy(x, state, sizeof(x));
+    for(int i = 0; i < 10; i++) {
+        // columns
+        x[4] ^= SALSA_ROTATE(x[0] + x[12], 7);   x[8] ^= SALSA_ROTATE(x[4] + x[0], 9);
+        x[12] ^= SALSA_ROTATE(x[8] + x[4], 13);  x[0] ^= SALSA_ROTATE(x[12] + x[8], 18);
+        x[9] ^= SALSA_ROTATE(x[5] + x[1], 7);    x[13] ^= SALSA_ROTATE(x[9] + x[5], 9);
+        x[1] ^= SALSA_ROTATE(x[13] + x[9], 13);  x[5] ^= SALSA_ROTATE(x[1] + x[13], 18);
+        x[14] ^= SALSA_ROTATE(x[10] + x[6], 7);  x[2] ^= SALSA_ROTATE(x[14] + x[10], 9);
+        x[6] ^= SALSA_ROTATE(x[2] + x[14], 13);  x[10] ^= SALSA_ROTATE(x[6] + x[2], 18);
+        x[3] ^= SALSA_ROTATE(x[15] + x[11], 7);  x[7] ^= SALSA_ROTATE(x[3] + x[15], 9);
+        x[11] ^= SALSA_ROTATE(x[7] + x[3], 13);  x[15] ^= SALSA_ROTATE(x[11] + x[7], 18);
+        // rows
+        x[1] ^= SALSA_ROTATE(x[0] + x[3], 7);    x[2] ^= SALSA_ROTATE(x[1] + x[0], 9);
+        x[3] ^= SALSA_ROTATE(x[2] + x[1], 13);   x[0] ^= SALSA_ROTATE(x[3] + x[2], 18);
+        x[6] ^= SALSA_ROTATE(x[5] + x[4], 7);    x[7] ^= SALSA_ROTATE(x[6] + x[5], 9);
+        x[4] ^= SALSA_ROTATE(x[7] + x[6], 13);   x[5] ^= SALSA_ROTATE(x[4] + x[7], 18);
+        x[11] ^= SALSA_ROTATE(x[10] + x[9], 7);  x[8] ^= SALSA_ROTATE(x[11] + x[10], 9);
+        x[9] ^= SALSA_ROTATE(x[8] + x[11], 13);  x[10] ^= SALSA_ROTATE(x[9] + x[8], 18);
+        x[12] ^= SALSA_ROTATE(x[15] + x[14], 7); x[13] ^= SALSA_ROTATE(x[12] + x[15], 9);
+        x[14] ^= SALSA_ROTATE(x[13] + x[12], 13); x[15] ^= SALSA_ROTATE(x[14] + x[13], 18);
+    }
+    for(int i = 0; i < 16; i++) {
+        qToLittleEndian<quint32>(x[i] + state[i], out + 4 * i);
+    }
+    QtSecureMemory::wipe(x, sizeof(x));
+
+    if(++state[8] == 0) {
+        state[9]++;
+    }
+}
+
+KdbxReader::KdbxReader(QObject *parent) :
+    QObject(parent),
+    succeeded(0),
+    failed(0),
+    cipherCtx(nullptr),
+    inflater(nullptr),
+    innerCtx(nullptr)
+{
+    reset();
+}
+
+KdbxReader::~KdbxReader()
+{
+    reset();
+}
+
+bool KdbxReader::isKdbx(QIODevice *in)
+{
+    QByteArray start = in->peek(8);
+    return start.size() == 8 && u32(start, 0) == KDBX_SIGNATURE1 && u32(start, 4) == KDBX_SIGNATURE2;
+}
+
+bool KdbxReader::import(QIODevice *in, const QString &password, KeyDatabase *database)
+{
+    succeeded = 0;
+    failed = 0;
+    errorMessage.clear();
+
+    // read and parsed on one thread, encrypted on the others, written on this one
+    typedef ImportPipeline<KeyInfo, KeyDatabase::SealedKey> Pipeline;
+    Pipeline pipeline;
+    KeyDatabase::Batch batch(database);
+    pipeline.run([this, in, &password](const Pipeline::Push &push) {
+        read(in, password, push);
+    }, [database](const KeyInfo &key) {
+        return database->sealKeyInfo(key);
+    }, [this, database](const KeyDatabase::SealedKey &sealed) {
+        if(!database->addSealedKey(sealed)) {
+            qDebug() << "Failed to add key" << database->getLastErrorMessage();
+            failed++;
+        } else {
+            succeeded++;
+        }
+        return true;
+    });
+
+    if(!batch.commit()) {
+        errorMessage = database->getLastErrorMessage();
+        return false;
+    }
+    return errorMessage.isEmpty();
+}
+
+void KdbxReader::read(QIODevice *in, const QString &password, const Push &push)
+{
+    bool ok = readHeader(in) && deriveKeys(password) && startBody(in);
+    QByteArray block;
+    bool last = false;
+    while(ok && !last) {
+        ok = readBlock(in, &block, &last) && inflateBlock(block, last, push);
+        emit progress(in->pos(), in->size());
+    }
+
+    if(ok && !rootClosed) {
+        errorMessage = tr("The database ends in the middle of its document");
+    }
+    block.fill('\0');
+    reset();
+}
+
+void KdbxReader::reset()
+{
+    header = Header();
+    headerBytes.clear();
+    cipherKey.clear();
+    hmacKey.clear();
+
+    EVP_CIPHER_CTX_free(cipherCtx);
+    cipherCtx = nullptr;
+    cipherDone = false;
+    blockIndex = 0;
+    plain.fill('\0');
+    plain.clear();
+    plainPos = 0;
+
+    if(inflater != nullptr) {
+        inflateEnd(inflater);
+        delete inflater;
+        inflater = nullptr;
+    }
+    inflateDone = false;
+
+    innerDone = false;
+    inner.fill('\0');
+    inner.clear();
+    EVP_CIPHER_CTX_free(innerCtx);
+    innerCtx = nullptr;
+    QtSecureMemory::wipe(salsaState, sizeof(salsaState));
+    QtSecureMemory::wipe(salsaStream, sizeof(salsaStream));
+    salsaPos = 0;
+
+    xml.clear();
+    path.clear();
+    text.clear();
+    textProtected = false;
+    rootClosed = false;
+    recycleBin.clear();
+    skipped.clear();
+    entryDepth = 0;
+    entry.reset();
+    stringKey.clear();
+    stringValue.clear();
+    extraFields.clear();
+}
+
+bool KdbxReader::readHeader(QIODevice *in)
+{
+    QByteArray start = in->read(12);
+    if(start.size() < 12 || u32(start, 0) != KDBX_SIGNATURE1 || u32(start, 4) != KDBX_SIGNATURE2) {
+        errorMessage = tr("Not a KeePass 2 database");
+        return false;
+    }
+    quint32 version = u32(start, 8);
+    majorVersion = version >> 16;
+    if(majorVersion != 3 && majorVersion != 4) {
+        errorMessage = tr("Unsupported KDBX version %1.%2").arg(majorVersion).arg(version & 0xFFFF);
+        return false;
+    }
+
+    // KDBX 4 widened the field length and authenticates the raw header
+    headerBytes = start;
+    int lengthSize = majorVersion == 3 ? 2 : 4;
+    forever {
+        QByteArray field = in->read(1 + lengthSize);
+        if(field.size() < 1 + lengthSize) {
+            errorMessage = tr("The database header is truncated");
+            return false;
+        }
+        quint32 size = lengthSize == 2 ? qFromLittleEndian<quint16>((const uchar *)field.constData() + 1)
+                                       : u32(field, 1);
+        if(size > MAX_HEADER_FIELD) {
+            errorMessage = tr("The database header is damaged");
+            return false;
+        }
+        QByteArray data = in->read(size);
+        if(data.size() != (int)size) {
+            errorMessage = tr("The database header is truncated");
+            return false;
+        }
+        headerBytes += field;
+        headerBytes += data;
+
+        switch((uchar)field.at(0)) {
+        case HeaderEnd:
+            return checkHeader();
+        case HeaderCipherId:
+            header.cipherId = data;
+            break;
+        case HeaderCompression:
+            header.compressed = data.size() == 4 && u32(data, 0) == 1;
+            break;
+        case HeaderMasterSeed:
+            header.masterSeed = data;
+            break;
+        case HeaderTransformSeed:
+            header.transformSeed = data;
+            break;
+        case HeaderTransformRounds:
+            header.transformRounds = data.size() == 8 ? u64(data, 0) : 0;
+            break;
+        case HeaderEncryptionIv:
+            header.encryptionIv = data;
+            break;
+        case HeaderProtectedStreamKey:
+            header.protectedStreamKey = data;
+            break;
+        case HeaderStreamStartBytes:
+            header.streamStartBytes = data;
+            break;
+        case HeaderInnerStreamId:
+            header.innerStreamId = data.size() == 4 ? u32(data, 0) : 0;
+            break;
+        case HeaderKdfParameters:
+            header.kdfParameters = data;
+            break;
+        default:
+            // comments and public custom data
+            break;
+        }
+    }
+}
+
+bool KdbxReader::checkHeader()
+{
+    QByteArray cipher = header.cipherId.toHex();
+    int ivSize = cipher == KDBX_CIPHER_AES256 ? 16 : 12;
+    if(cipher != KDBX_CIPHER_AES256 && cipher != KDBX_CIPHER_CHACHA20) {
+        errorMessage = tr("Unsupported cipher, only AES-256 and ChaCha20 are");
+        return false;
+    }
+
+    bool ok = header.masterSeed.size() == 32 && header.encryptionIv.size() == ivSize;
+    if(majorVersion == 3) {
+        ok = ok && header.transformSeed.size() == 32 && header.streamStartBytes.size() == 32
+                && !header.protectedStreamKey.isEmpty();
+    } else {
+        ok = ok && !header.kdfParameters.isEmpty();
+    }
+    if(!ok) {
+        errorMessage = tr("The database header is damaged");
+    }
+    return ok;
+}
+
+bool KdbxReader::deriveKeys(const QString &password)
+{
+    // a password only composite key, hashed once as a component and once as the whole
+    QByteArray pass = password.toUtf8();
+    QByteArray component = QtHash::hash(pass, QCryptographicHash::Sha256);
+    QByteArray composite = QtHash::hash(component, QCryptographicHash::Sha256);
+    QByteArray transformed;
+    bool ok = transformKey(composite, &transformed);
+    pass.fill('\0');
+    component.fill('\0');
+    composite.fill('\0');
+    if(!ok) {
+        return false;
+    }
+
+    QByteArray seeded = header.masterSeed + transformed;
+    QByteArray key = QtHash::hash(seeded, QCryptographicHash::Sha256);
+    ok = cipherKey.assign(key.constData(), key.size());
+    key.fill('\0');
+    seeded.append('\x01');
+    key = QtHash::hash(seeded, QCryptographicHash::Sha512);
+    ok = hmacKey.assign(key.constData(), key.size()) && ok;
+    key.fill('\0');
+    seeded.fill('\0');
+    transformed.fill('\0');
+    if(!ok) {
+        errorMessage = tr("Out of secure memory for the database keys");
+    }
+    return ok;
+}
+
+bool KdbxReader::transformKey(const QByteArray &composite, QByteArray *transformed)
+{
+    if(majorVersion == 3) {
+        return aesTransform(composite, header.transformSeed, header.transformRounds, transformed);
+    }
+
+    QHash<QString, QByteArray> params;
+    if(!readVariants(header.kdfParameters, &params)) {
+        errorMessage = tr("The database header is damaged");
+        return false;
+    }
+    QByteArray uuid = params.value("$UUID").toHex();
+    if(uuid == KDBX_KDF_AES_KDBX3 || uuid == KDBX_KDF_AES_KDBX4) {
+        return aesTransform(composite, params.value("S"), variantNumber(params, "R"), transformed);
+    }
+    if(uuid != KDBX_KDF_ARGON2D && uuid != KDBX_KDF_ARGON2ID) {
+        errorMessage = tr("Unsupported key derivation function");
+        return false;
+    }
+
+    QtKdf::Params kdf;
+    kdf.algorithm = uuid == KDBX_KDF_ARGON2D ? QtKdf::Argon2d : QtKdf::Argon2id;
+    kdf.iterations = variantNumber(params, "I");
+    kdf.memoryKiB = variantNumber(params, "M") / 1024;
+    kdf.parallelism = qMax<quint32>(variantNumber(params, "P"), 1);
+    kdf.salt = params.value("S");
+    if(variantNumber(params, "V") != ARGON2_VERSION) {
+        errorMessage = tr("Unsupported Argon2 version");
+        return false;
+    }
+    if(!QtKdf::isAvailable(kdf.algorithm)) {
+        errorMessage = tr("Argon2 needs OpenSSL 3.2 or later");
+        return false;
+    }
+    *transformed = QtKdf::derive(composite, kdf, 32);
+    if(transformed->isEmpty()) {
+        errorMessage = tr("Can't derive the database key");
+        return false;
+    }
+    return true;
+}
+
+bool KdbxReader::aesTransform(const QByteArray &composite, const QByteArray &seed, quint64 rounds,
+                              QByteArray *transformed)
+{
+    if(rounds > MAX_AES_KDF_ROUNDS) {
+        errorMessage = tr("The database asks for %1 key transformation rounds, at most %2 are allowed")
+                .arg(rounds).arg(MAX_AES_KDF_ROUNDS);
+        return false;
+    }
+    if(!aesKdf(composite, seed, rounds, transformed)) {
+        errorMessage = tr("Can't derive the database key");
+        return false;
+    }
+    return true;
+}
+
+QByteArray KdbxReader::blockHmac(quint64 index, const QByteArray &data) const
+{
+    // every block has its own key, bound to its index
+    uchar indexBytes[8];
+    qToLittleEndian<quint64>(index, indexBytes);
+    QByteArray keySource = QByteArray((const char *)indexBytes, 8) + QByteArray(hmacKey.constData(), hmacKey.size());
+    QByteArray key = QtHash::hash(keySource, QCryptographicHash::Sha512);
+    keySource.fill('\0');
+
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int length = 0;
+    HMAC(EVP_sha256(), key.constData(), key.size(),
+         (const unsigned char *)data.constData(), data.size(), digest, &length);
+    key.fill('\0');
+    return QByteArray((const char *)digest, length);
+}
+
+bool KdbxReader::startBody(QIODevice *in)
+{
+    if(majorVersion == 4) {
+        QByteArray check = in->read(64);
+        if(check.size() < 64) {
+            errorMessage = tr("The database header is truncated");
+            return false;
+        }
+        if(check.left(32) != QtHash::hash(headerBytes, QCryptographicHash::Sha256)) {
+            errorMessage = tr("The database header is damaged");
+            return false;
+        }
+        if(check.mid(32) != blockHmac(Q_UINT64_C(0xFFFFFFFFFFFFFFFF), headerBytes)) {
+            errorMessage = tr("Wrong password or damaged database");
+            return false;
+        }
+    }
+
+    // ChaCha20 takes a 4-byte block counter in front of the 12-byte nonce
+    bool aes = header.cipherId.toHex() == KDBX_CIPHER_AES256;
+    QByteArray iv = aes ? header.encryptionIv : QByteArray(4, '\0') + header.encryptionIv;
+    cipherCtx = EVP_CIPHER_CTX_new();
+    if(cipherCtx == NULL || EVP_DecryptInit_ex(cipherCtx, aes ? EVP_aes_256_cbc() : EVP_chacha20(), NULL,
+                                               (const uchar *)cipherKey.constData(),
+                                               (const uchar *)iv.constData()) <= 0) {
+        errorMessage = tr("Can't start decryption");
+        return false;
+    }
+
+    if(header.compressed) {
+        inflater = new z_stream();
+        // 16 + window bits reads a gzip wrapper
+        if(inflateInit2(inflater, 16 + MAX_WBITS) != Z_OK) {
+            delete inflater;
+            inflater = nullptr;
+            errorMessage = tr("Can't start decompression");
+            return false;
+        }
+    }
+
+    if(majorVersion == 4) {
+        // the inner stream is set up from the inner header
+        return true;
+    }
+    innerDone = true;
+    QByteArray startBytes;
+    if(!readPlain(in, 32, &startBytes)) {
+        return false;
+    }
+    if(startBytes != header.streamStartBytes) {
+        errorMessage = tr("Wrong password or damaged database");
+        return false;
+    }
+    return startInnerStream();
+}
+
+bool KdbxReader::readBlock(QIODevice *in, QByteArray *block, bool *last)
+{
+    if(majorVersion == 4) {
+        // hmac | size | ciphertext, the hmac also covers the index and size
+        QByteArray head = in->read(36);
+        if(head.size() < 36) {
+            errorMessage = tr("The database is truncated");
+            return false;
+        }
+        qint32 size = u32(head, 32);
+        if(size < 0 || size > MAX_BLOCK_SIZE) {
+            errorMessage = tr("Block %1 is damaged").arg(blockIndex);
+            return false;
+        }
+        QByteArray data = in->read(size);
+        if(data.size() != size) {
+            errorMessage = tr("The database is truncated");
+            return false;
+        }
+        uchar indexBytes[8];
+        qToLittleEndian<quint64>(blockIndex, indexBytes);
+        if(blockHmac(blockIndex, QByteArray((const char *)indexBytes, 8) + head.mid(32) + data) != head.left(32)) {
+            errorMessage = tr("Block %1 is damaged").arg(blockIndex);
+            return false;
+        }
+        blockIndex++;
+        *last = size == 0;
+        return decrypt(data, *last, block);
+    }
+
+    // index | sha256 | size | data, inside the decrypted stream
+    QByteArray head;
+    if(!readPlain(in, 40, &head)) {
+        return false;
+    }
+    qint32 size = u32(head, 36);
+    if(u32(head, 0) != blockIndex || size < 0 || size > MAX_BLOCK_SIZE) {
+        errorMessage = tr("Block %1 is damaged").arg(blockIndex);
+        return false;
+    }
+    blockIndex++;
+    *last = size == 0;
+    if(*last) {
+        block->clear();
+        return true;
+    }
+    if(!readPlain(in, size, block)) {
+        return false;
+    }
+    if(QtHash::hash(*block, QCryptographicHash::Sha256) != head.mid(4, 32)) {
+        errorMessage = tr("Block %1 is damaged").arg(blockIndex - 1);
+        return false;
+    }
+    return true;
+}
+
+bool KdbxReader::readPlain(QIODevice *in, int size, QByteArray *out)
+{
+    while(plain.size() - plainPos < size) {
+        if(cipherDone) {
+            errorMessage = tr("The database is truncated");
+            return false;
+        }
+        QByteArray data = in->read(READ_SIZE);
+        QByteArray decrypted;
+        if(!decrypt(data, data.isEmpty(), &decrypted)) {
+            return false;
+        }
+        plain += decrypted;
+        decrypted.fill('\0');
+    }
+
+    *out = plain.mid(plainPos, size);
+    plainPos += size;
+    // drop what was read once it's worth a copy
+    if(plainPos >= READ_SIZE) {
+        QtSecureMemory::wipe(plain.data(), plainPos);
+        plain.remove(0, plainPos);
+        plainPos = 0;
+    }
+    return true;
+}
+
+bool KdbxReader::decrypt(const QByteArray &data, bool last, QByteArray *out)
+{
+    out->resize(data.size() + EVP_MAX_BLOCK_LENGTH);
+    int length = 0;
+    int finalLength = 0;
+    bool ok = EVP_DecryptUpdate(cipherCtx, (uchar *)out->data(), &length,
+                                (const uchar *)data.constData(), data.size()) > 0;
+    if(ok && last) {
+        // AES padding is checked here, a wrong key usually fails on it
+        ok = EVP_DecryptFinal_ex(cipherCtx, (uchar *)out->data() + length, &finalLength) > 0;
+        cipherDone = true;
+    }
+    if(!ok) {
+        errorMessage = tr("Wrong password or damaged database");
+        return false;
+    }
+    out->resize(length + finalLength);
+    return true;
+}
+
+bool KdbxReader::inflateBlock(const QByteArray &block, bool last, const Push &push)
+{
+    if(inflater == nullptr) {
+        return readPayload(block, push);
+    }
+
+    QByteArray out(INFLATE_SIZE, '\0');
+    inflater->next_in = (Bytef *)block.constData();
+    inflater->avail_in = block.size();
+    while(!inflateDone && (inflater->avail_in > 0 || inflater->avail_out == 0)) {
+        inflater->next_out = (Bytef *)out.data();
+        inflater->avail_out = out.size();
+        int ret = inflate(inflater, Z_NO_FLUSH);
+        if(ret == Z_STREAM_END) {
+            inflateDone = true;
+        } else if(ret != Z_OK && ret != Z_BUF_ERROR) {
+            errorMessage = tr("Can't decompress the database : %1").arg(inflater->msg ? inflater->msg : "");
+            return false;
+        }
+        int produced = out.size() - inflater->avail_out;
+        if(produced > 0 && !readPayload(QByteArray::fromRawData(out.constData(), produced), push)) {
+            out.fill('\0');
+            return false;
+        }
+        if(ret == Z_BUF_ERROR) {
+            break;
+        }
+    }
+    out.fill('\0');
+
+    if(last && !inflateDone) {
+        errorMessage = tr("The database is truncated");
+        return false;
+    }
+    return true;
+}
+
+bool KdbxReader::readPayload(const QByteArray &data, const Push &push)
+{
+    QByteArray payload = data;
+    if(!innerDone) {
+        inner += data;
+        if(!readInnerHeader(&payload)) {
+            return false;
+        }
+        if(!innerDone) {
+            return true;
+        }
+    }
+
+    xml.addData(payload);
+    return parseXml(push);
+}
+
+bool KdbxReader::readInnerHeader(QByteArray *rest)
+{
+    // id | size | data fields, only complete ones are taken
+    int pos = 0;
+    while(inner.size() - pos >= 5) {
+        qint32 size = u32(inner, pos + 1);
+        if(size < 0) {
+            errorMessage = tr("The database inner header is damaged");
+            return false;
+        }
+        if(inner.size() - pos - 5 < size) {
+            break;
+        }
+        int id = (uchar)inner.at(pos);
+        QByteArray data = inner.mid(pos + 5, size);
+        pos += 5 + size;
+
+        switch(id) {
+        case InnerEnd:
+            *rest = inner.mid(pos);
+            inner.fill('\0');
+            inner.clear();
+            innerDone = true;
+            return startInnerStream();
+        case InnerStreamId:
+            header.innerStreamId = data.size() == 4 ? u32(data, 0) : 0;
+            break;
+        case InnerStreamKey:
+            header.protectedStreamKey = data;
+            break;
+        default:
+            // attachments aren't imported
+            break;
+        }
+    }
+    inner.remove(0, pos);
+    return true;
+}
+
+bool KdbxReader::startInnerStream()
+{
+    if(header.innerStreamId == InnerSalsa20) {
+        QByteArray key = QtHash::hash(header.protectedStreamKey, QCryptographicHash::Sha256);
+        const uchar *k = (const uchar *)key.constData();
+        const uchar *nonce = (const uchar *)KDBX_SALSA20_NONCE;
+        salsaState[0] = 0x61707865;
+        salsaState[5] = 0x3320646e;
+        salsaState[10] = 0x79622d32;
+        salsaState[15] = 0x6b206574;
+        for(int i = 0; i < 4; i++) {
+            salsaState[1 + i] = qFromLittleEndian<quint32>(k + 4 * i);
+            salsaState[11 + i] = qFromLittleEndian<quint32>(k + 16 + 4 * i);
+        }
+        salsaState[6] = qFromLittleEndian<quint32>(nonce);
+        salsaState[7] = qFromLittleEndian<quint32>(nonce + 4);
+        salsaState[8] = 0;
+        salsaState[9] = 0;
+        salsaPos = sizeof(salsaStream);
+        key.fill('\0');
+        return true;
+    }
+
+    if(header.innerStreamId == InnerChaCha20) {
+        // key and nonce both come out of one SHA-512
+        QByteArray hash = QtHash::hash(header.protectedStreamKey, QCryptographicHash::Sha512);
+        QByteArray iv = QByteArray(4, '\0') + hash.mid(32, 12);
+        innerCtx = EVP_CIPHER_CTX_new();
+        bool ok = innerCtx != NULL && EVP_EncryptInit_ex(innerCtx, EVP_chacha20(), NULL,
+                                                         (const uchar *)hash.constData(),
+                                                         (const uchar *)iv.constData()) > 0;
+        hash.fill('\0');
+        if(!ok) {
+            errorMessage = tr("Can't start the inner stream cipher");
+        }
+        return ok;
+    }
+
+    errorMessage = tr("Unsupported inner stream cipher %1").arg(header.innerStreamId);
+    return false;
+}
+
+QString KdbxReader::unprotect(const QString &text)
+{
+    QByteArray data = QByteArray::fromBase64(text.toLatin1());
+    uchar *bytes = (uchar *)data.data();
+    if(innerCtx != nullptr) {
+        int length = 0;
+        EVP_EncryptUpdate(innerCtx, bytes, &length, bytes, data.size());
+    } else {
+        for(int i = 0; i < data.size(); i++) {
+            if(salsaPos == sizeof(salsaStream)) {
+                salsa20Block(salsaState, salsaStream);
+                salsaPos = 0;
+            }
+            bytes[i] ^= salsaStream[salsaPos++];
+        }
+    }
+
+    QString value = QString::fromUtf8(data);
+    data.fill('\0');
+    return value;
+}
+
+bool KdbxReader::parseXml(const Push &push)
+{
+    // runs until the parser wants more data than has been added
+    while(!rootClosed) {
+        QXmlStreamReader::TokenType token = xml.readNext();
+        if(token == QXmlStreamReader::Invalid) {
+            break;
+        }
+
+        if(token == QXmlStreamReader::StartElement) {
+            QString name = xml.name().toString();
+            text.clear();
+            if(name == QLatin1String("Group")) {
+                skipped.append(!skipped.isEmpty() && skipped.last());
+            } else if(name == QLatin1String("Entry")) {
+                // entries inside History are older copies of this one
+                if(++entryDepth == 1) {
+                    entry.reset();
+                    extraFields.clear();
+                }
+            }
+            // values, and KDBX 3 attachments, share the inner stream
+            textProtected = xml.attributes().value("Protected") == QLatin1String("True");
+            path.append(name);
+        } else if(token == QXmlStreamReader::Characters) {
+            text.append(xml.text());
+        } else if(token == QXmlStreamReader::EndElement) {
+            QString name = path.takeLast();
+            if(!endElement(name, push)) {
+                return false;
+            }
+            rootClosed = path.isEmpty();
+        }
+    }
+
+    if(xml.hasError() && xml.error() != QXmlStreamReader::PrematureEndOfDocumentError) {
+        errorMessage = tr("Error Message line %1 column %2 : %3")
+                .arg(xml.lineNumber()).arg(xml.columnNumber()).arg(xml.errorString());
+        return false;
+    }
+    return true;
+}
+
+bool KdbxReader::endElement(const QString &name, const Push &push)
+{
+    QString parent = path.isEmpty() ? QString() : path.last();
+    QString value = text;
+    if(textProtected) {
+        // every protected element takes its share of the stream, wanted or not
+        value = unprotect(text);
+        textProtected = false;
+    }
+
+    if(name == QLatin1String("Value")) {
+        stringValue = value;
+    } else if(name == QLatin1String("Key")) {
+        stringKey = text;
+    } else if(name == QLatin1String("String") && entryDepth == 1) {
+        if(stringKey == QLatin1String("Title")) {
+            entry.setName(stringValue);
+        } else if(stringKey == QLatin1String("UserName")) {
+            entry.setUsername(stringValue);
+        } else if(stringKey == QLatin1String("Password")) {
+            entry.setPassword(stringValue);
+        } else if(stringKey == QLatin1String("URL")) {
+            entry.setSite(stringValue);
+        } else if(stringKey == QLatin1String("Notes")) {
+            entry.setNotes(stringValue);
+        } else if(!stringValue.isEmpty()) {
+            extraFields << QString("%1: %2").arg(stringKey).arg(stringValue);
+        }
+        stringKey.clear();
+        stringValue.clear();
+    } else if(name == QLatin1String("Entry")) {
+        bool wanted = --entryDepth == 0 && !(!skipped.isEmpty() && skipped.last());
+        if(wanted && !extraFields.isEmpty()) {
+            QString notes = entry.getNotes();
+            if(!notes.isEmpty()) {
+                notes.append('\n');
+            }
+            entry.setNotes(notes + extraFields.join("\n"));
+        }
+        if(wanted && !push(entry)) {
+            // the writer gave up
+            return false;
+        }
+    } else if(name == QLatin1String("UUID") && parent == QLatin1String("Group")) {
+        // KeePass writes a group's UUID before its entries
+        if(!recycleBin.isEmpty() && text == recycleBin && !skipped.isEmpty()) {
+            skipped.last() = true;
+        }
+    } else if(name == QLatin1String("RecycleBinUUID") && parent == QLatin1String("Meta")) {
+        recycleBin = text;
+    } else if(name == QLatin1String("Group") && !skipped.isEmpty()) {
+        skipped.removeLast();
+    }
+    return true;
+}
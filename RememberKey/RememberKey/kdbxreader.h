@@ -0,0 +1,136 @@
+#ifndef KDBXREADER_H
+#define KDBXREADER_H
+
+#include <QObject>
+#include <QIODevice>
+#include <QHash>
+#include <QXmlStreamReader>
+#include <functional>
+#include <openssl/evp.h>
+
+#include "keydatabase.h"
+#include "../QtAesLib/qtsecurememory.h"
+
+typedef struct z_stream_s z_stream;
+
+// Imports a KeePass 2 database (KDBX 3.1 and 4) directly, no XML export
+// in between. The file is read a block at a time: each block is checked,
+// decrypted, inflated and handed to an incremental XML parser, so neither
+// the file nor the document is ever held whole. Entries then go through
+// the same encrypt and write pipeline as KeePassXImporter.
+//
+// Only password keys are supported, not key files, and Twofish isn't.
+// History and the recycle bin are skipped, attachments are dropped.
+class KdbxReader : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit KdbxReader(QObject *parent = 0);
+    ~KdbxReader();
+
+    // Runs on the thread that owns database and returns when the file is done
+    bool import(QIODevice *in, const QString &password, KeyDatabase *database);
+
+    int getSucceeded() const { return succeeded; }
+    int getFailed() const { return failed; }
+    QString getLastErrorMessage() const { return errorMessage; }
+
+    // only peeks at the signature
+    static bool isKdbx(QIODevice *in);
+
+signals:
+    // emitted from the reading thread
+    void progress(qint64 bytesRead, qint64 bytesTotal);
+
+private:
+    typedef std::function<bool(const KeyInfo &)> Push;
+
+    struct Header {
+        Header() : compressed(false), transformRounds(0), innerStreamId(0) {}
+
+        QByteArray cipherId;
+        bool compressed;
+        QByteArray masterSeed;
+        QByteArray encryptionIv;
+        // KDBX 3, KDBX 4 moved these to kdfParameters and the inner header
+        QByteArray transformSeed;
+        quint64 transformRounds;
+        QByteArray protectedStreamKey;
+        QByteArray streamStartBytes;
+        quint32 innerStreamId;
+        // KDBX 4
+        QByteArray kdfParameters;
+    };
+
+    void read(QIODevice *in, const QString &password, const Push &push);
+    void reset();
+
+    bool readHeader(QIODevice *in);
+    bool checkHeader();
+    bool deriveKeys(const QString &password);
+    bool transformKey(const QByteArray &composite, QByteArray *transformed);
+    bool aesTransform(const QByteArray &composite, const QByteArray &seed, quint64 rounds,
+                      QByteArray *transformed);
+    bool startBody(QIODevice *in);
+    QByteArray blockHmac(quint64 index, const QByteArray &data) const;
+
+    // verified, decrypted and still compressed payload
+    bool readBlock(QIODevice *in, QByteArray *block, bool *last);
+    bool readPlain(QIODevice *in, int size, QByteArray *out);
+    bool decrypt(const QByteArray &data, bool last, QByteArray *out);
+    bool inflateBlock(const QByteArray &block, bool last, const Push &push);
+    bool readPayload(const QByteArray &data, const Push &push);
+    bool readInnerHeader(QByteArray *rest);
+    bool startInnerStream();
+    QString unprotect(const QString &text);
+
+    bool parseXml(const Push &push);
+    bool endElement(const QString &name, const Push &push);
+
+    int succeeded;
+    int failed;
+    QString errorMessage;
+
+    int majorVersion;
+    Header header;
+    QByteArray headerBytes;
+    QtSecureBuffer cipherKey;
+    QtSecureBuffer hmacKey;
+
+    EVP_CIPHER_CTX *cipherCtx;
+    bool cipherDone;
+    quint64 blockIndex;
+    // KDBX 3 decrypts before it splits blocks
+    QByteArray plain;
+    int plainPos;
+
+    z_stream *inflater;
+    bool inflateDone;
+
+    // KDBX 4 inner header, until its end field
+    bool innerDone;
+    QByteArray inner;
+
+    // protected values are xored with one stream, in document order
+    EVP_CIPHER_CTX *innerCtx;
+    quint32 salsaState[16];
+    uchar salsaStream[64];
+    int salsaPos;
+
+    QXmlStreamReader xml;
+    QStringList path;
+    QString text;
+    bool textProtected;
+    bool rootClosed;
+    QString recycleBin;
+    // one flag per open group, set when it or a parent is the recycle bin
+    QVector<bool> skipped;
+    int entryDepth;
+    KeyInfo entry;
+    QString stringKey;
+    QString stringValue;
+    QStringList extraFields;
+};
+
+#endif // KDBXREADER_H
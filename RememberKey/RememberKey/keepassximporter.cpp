@@ -0,0 +1,151 @@
+#include "keepassximporter.h"
+
+#include <QDebug>
+
+// how often progress is reported, in bytes
+static const qint64 PROGRESS_STEP = 256 * 1024;
+
+KeePassXImporter::KeePassXImporter(QObject *parent) :
+    QObject(parent),
+    succeeded(0),
+    failed(0)
+{
+}
+
+bool KeePassXImporter::import(QIODevice *in, KeyDatabase *database)
+{
+    succeeded = 0;
+    failed = 0;
+    errorMessage.clear();
+
+    // parsed on one thread, encrypted on the others, written on this one
+    typedef ImportPipeline<KeyInfo, KeyDatabase::SealedKey> Pipeline;
+    Pipeline pipeline;
+    KeyDatabase::Batch batch(database);
+    pipeline.run([this, in](const Pipeline::Push &push) {
+        parse(in, push);
+    }, [database](const KeyInfo &key) {
+        return database->sealKeyInfo(key);
+    }, [this, database](const KeyDatabase::SealedKey &sealed) {
+        if(!database->addSealedKey(sealed)) {
+            qDebug() << "Failed to add key" << database->getLastErrorMessage();
+            failed++;
+        } else {
+            succeeded++;
+        }
+        return true;
+    });
+
+    if(!batch.commit()) {
+        errorMessage = database->getLastErrorMessage();
+        return false;
+    }
+    return errorMessage.isEmpty();
+}
+
+void KeePassXImporter::parse(QIODevice *in, const std::function<bool(const KeyInfo &)> &push)
+{
+    QXmlStreamReader xml(in);
+    qint64 total = in->size();
+    qint64 reported = 0;
+    // one flag per open group, set when it or a parent is skipped
+    QVector<bool> skipped;
+
+    while(!xml.atEnd()) {
+        xml.readNext();
+        if(xml.isStartElement()) {
+            if(xml.name() == QLatin1String("group")) {
+                skipped.append(!skipped.isEmpty() && skipped.last());
+            } else if(xml.name() == QLatin1String("title") && !skipped.isEmpty()) {
+                // KeePassX writes a group's title before its entries
+                if(readText(xml) == "Backup") {
+                    skipped.last() = true;
+                }
+            } else if(xml.name() == QLatin1String("entry")) {
+                KeyInfo key;
+                bool skip = !skipped.isEmpty() && skipped.last();
+                if(!parseEntry(xml, &key)) {
+                    break;
+                }
+                if(!skip && !push(key)) {
+                    // the writer gave up
+                    break;
+                }
+            }
+        } else if(xml.isEndElement() && xml.name() == QLatin1String("group") && !skipped.isEmpty()) {
+            skipped.removeLast();
+        }
+
+        if(in->pos() - reported >= PROGRESS_STEP) {
+            reported = in->pos();
+            emit progress(reported, total);
+        }
+    }
+
+    if(xml.hasError()) {
+        errorMessage = tr("Error Message line %1 column %2 : %3")
+                .arg(xml.lineNumber()).arg(xml.columnNumber()).arg(xml.errorString());
+    }
+    emit progress(total, total);
+}
+
+bool KeePassXImporter::parseEntry(QXmlStreamReader &xml, KeyInfo *key)
+{
+    QString comment;
+    QString bindesc;
+    QString bin;
+    bool hasBin = false;
+
+    while(xml.readNextStartElement()) {
+        if(xml.name() == QLatin1String("title")) {
+            key->setName(readText(xml));
+        } else if(xml.name() == QLatin1String("username")) {
+            key->setUsername(readText(xml));
+        } else if(xml.name() == QLatin1String("password")) {
+            key->setPassword(readText(xml));
+        } else if(xml.name() == QLatin1String("url")) {
+            key->setSite(readText(xml));
+        } else if(xml.name() == QLatin1String("comment")) {
+            comment = readText(xml);
+        } else if(xml.name() == QLatin1String("bindesc")) {
+            bindesc = readText(xml);
+            hasBin = true;
+        } else if(xml.name() == QLatin1String("bin")) {
+            bin = readText(xml);
+        } else {
+            xml.skipCurrentElement();
+        }
+    }
+
+    QString notes;
+    if(!comment.isEmpty()) {
+        notes.append(QString("Comment: %1\n").arg(comment));
+    }
+    if(hasBin) {
+        notes.append(QString("Filename %1\n").arg(bindesc));
+        notes.append(QString("FileData: %1\n").arg(bin));
+    }
+    key->setNotes(notes);
+
+    return !xml.hasError();
+}
+
+QString KeePassXImporter::readText(QXmlStreamReader &xml)
+{
+    // comments keep their line breaks as <br/>
+    QString text;
+    while(!xml.atEnd()) {
+        xml.readNext();
+        if(xml.isCharacters()) {
+            text.append(xml.text());
+        } else if(xml.isStartElement()) {
+            if(xml.name() == QLatin1String("br")) {
+                text.append('\n');
+            }
+            xml.skipCurrentElement();
+        } else if(xml.isEndElement()) {
+            break;
+        }
+    }
+    return text;
+}
@@ -0,0 +1,45 @@
+#ifndef KEEPASSXIMPORTER_H
+#define KEEPASSXIMPORTER_H
+
+#include <QObject>
+#include <QIODevice>
+#include <QXmlStreamReader>
+
+#include "keydatabase.h"
+#include "importpipeline.h"
+
+// Imports a KeePassX 0.4 XML export. The file is parsed as a stream on a
+// thread of its own, entries are encrypted on a pool of workers and reach
+// the database through bounded queues, so memory stays flat however big
+// the dump is. Entries under a group titled
+// "Backup" are skipped, like KeePassX's own recycle bin.
+class KeePassXImporter : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit KeePassXImporter(QObject *parent = 0);
+
+    // Runs on the thread that owns database and returns when the file is done.
+    // Entries that can't be written are counted, a broken file fails it.
+    bool import(QIODevice *in, KeyDatabase *database);
+
+    int getSucceeded() const { return succeeded; }
+    int getFailed() const { return failed; }
+    QString getLastErrorMessage() const { return errorMessage; }
+
+signals:
+    // emitted from the parsing thread
+    void progress(qint64 bytesRead, qint64 bytesTotal);
+
+private:
+    void parse(QIODevice *in, const std::function<bool(const KeyInfo &)> &push);
+    bool parseEntry(QXmlStreamReader &xml, KeyInfo *key);
+    static QString readText(QXmlStreamReader &xml);
+
+    int succeeded;
+    int failed;
+    QString errorMessage;
+};
+
+#endif // KEEPASSXIMPORTER_H
@@ -0,0 +1,538 @@
+#include "keyarchive.h"
+
+#include <QtEndian>
+#include <openssl/rand.h>
+#include <zlib.h>
+#include "../QtAesLib/qtsecurememory.h"
+
+static const char ARCHIVE_MAGIC[] = "RKB2";
+static const char ARCHIVE_VAULT_MAGIC[] = "RKB1";
+static const char ARCHIVE_END_MAGIC[] = "RKBE";
+static const int ARCHIVE_MAGIC_SIZE = 4;
+static const int ARCHIVE_PREFIX_SIZE = 8;
+static const int ARCHIVE_HEADER_SIZE = ARCHIVE_MAGIC_SIZE + 4 + ARCHIVE_PREFIX_SIZE;
+static const int ARCHIVE_FOOTER_SIZE = 8 + ARCHIVE_MAGIC_SIZE;
+static const quint32 ARCHIVE_TRAILER = 0x80000000u;
+static const quint32 ARCHIVE_TRAILER_FRAME = 0xFFFFFFFFu;
+static const int ARCHIVE_MAX_FRAME = 64 * 1024 * 1024;
+// id, frame, offset
+static const int ARCHIVE_ENTRY_SIZE = 4 + 4 + 8;
+// raw records per compressed frame, small ones compress poorly alone
+static const int ARCHIVE_BLOCK_SIZE = 64 * 1024;
+static const int ARCHIVE_MAX_KDF_SIZE = 256;
+
+// QIODevice::read may return less than asked for on sequential devices
+static QByteArray readFull(QIODevice *in, qint64 size)
+{
+    QByteArray data = in->read(size);
+    while(data.length() < size) {
+        if(!in->waitForReadyRead(-1) && in->bytesAvailable() <= 0) {
+            break;
+        }
+        QByteArray more = in->read(size - data.length());
+        if(more.isEmpty()) {
+            break;
+        }
+        data.append(more);
+    }
+    return data;
+}
+
+static void appendNumber(QByteArray *data, quint32 value)
+{
+    uchar bytes[4];
+    qToBigEndian<quint32>(value, bytes);
+    data->append((const char *)bytes, 4);
+}
+
+static void appendString(QByteArray *data, const QString &value)
+{
+    QByteArray utf8 = value.toUtf8();
+    appendNumber(data, utf8.length());
+    data->append(utf8);
+    utf8.fill('\0');
+}
+
+static bool takeString(const QByteArray &data, int *pos, QString *value)
+{
+    if(*pos + 4 > data.length()) {
+        return false;
+    }
+    quint32 length = qFromBigEndian<quint32>((const uchar *)data.constData() + *pos);
+    *pos += 4;
+    if(length > (quint32)(data.length() - *pos)) {
+        return false;
+    }
+    *value = QString::fromUtf8(data.constData() + *pos, length);
+    *pos += length;
+    return true;
+}
+
+static void appendRecord(QByteArray *data, const KeyInfo &key)
+{
+    appendNumber(data, key.getId());
+    appendString(data, key.getName());
+    appendString(data, key.getSite());
+    appendString(data, key.getUsername());
+    appendString(data, key.getPassword());
+    appendString(data, key.getNotes());
+}
+
+static bool takeRecord(const QByteArray &data, int *pos, KeyInfo *key)
+{
+    if(*pos + 4 > data.length()) {
+        return false;
+    }
+    key->setId((qint32)qFromBigEndian<quint32>((const uchar *)data.constData() + *pos));
+    *pos += 4;
+    QString values[5];
+    for(int i = 0; i < 5; i++) {
+        if(!takeString(data, pos, &values[i])) {
+            return false;
+        }
+    }
+    key->setName(values[0]);
+    key->setSite(values[1]);
+    key->setUsername(values[2]);
+    key->setPassword(values[3]);
+    key->setNotes(values[4]);
+    return true;
+}
+
+// raw size (u32 BE) | zlib data
+static bool inflateRecords(const QByteArray &plain, QByteArray *raw)
+{
+    if(plain.length() < 4) {
+        return false;
+    }
+    quint32 size = qFromBigEndian<quint32>((const uchar *)plain.constData());
+    if(size == 0 || size > (quint32)ARCHIVE_MAX_FRAME) {
+        return false;
+    }
+    raw->resize(size);
+    uLongf length = size;
+    if(uncompress((Bytef *)raw->data(), &length, (const Bytef *)plain.constData() + 4, plain.length() - 4) != Z_OK
+            || length != size) {
+        QtSecureMemory::wipe(raw->data(), raw->length());
+        return false;
+    }
+    return true;
+}
+
+KeyArchive::KeyArchive(const QString &password, const QtAes *vaultAes) :
+    cryptoAes(nullptr), vaultAes(vaultAes), password(password), mode(QtAes::detectCipherMode()),
+    flags(0), device(nullptr), frames(0)
+{
+}
+
+bool KeyArchive::isArchive(QIODevice *in)
+{
+    QByteArray magic = in->peek(ARCHIVE_MAGIC_SIZE);
+    return magic == QByteArray(ARCHIVE_MAGIC) || magic == QByteArray(ARCHIVE_VAULT_MAGIC);
+}
+
+bool KeyArchive::deriveKey(const QtKdf::Params &params)
+{
+    if(!fileKey.initialize(password, params)) {
+        errorMessage = QtKdf::isAvailable(params.algorithm)
+                ? QObject::tr("Can't derive the archive key")
+                : QObject::tr("Can't derive the archive key, its key derivation function isn't supported by this OpenSSL");
+        return false;
+    }
+    cryptoAes = &fileKey;
+    return true;
+}
+
+bool KeyArchive::begin(QIODevice *out, int flags)
+{
+    errorMessage.clear();
+    device = out;
+    this->flags = flags;
+    frames = 0;
+    index.clear();
+    block.clear();
+    blockIds.clear();
+    if(flags & Compressed) {
+        // growing would leave copies of the records behind
+        block.reserve(2 * ARCHIVE_BLOCK_SIZE);
+    }
+
+    // a fresh salt for every file, only the password is shared
+    QtKdf::Params params = QtKdf::portableParams();
+    if(!deriveKey(params)) {
+        return false;
+    }
+    QByteArray kdf = params.toString().toLatin1();
+
+    noncePrefix.resize(ARCHIVE_PREFIX_SIZE);
+    RAND_bytes((unsigned char *)noncePrefix.data(), ARCHIVE_PREFIX_SIZE);
+    header = QByteArray(ARCHIVE_MAGIC, ARCHIVE_MAGIC_SIZE);
+    header.append((char)mode);
+    header.append((char)flags);
+    header.append(2, '\0');
+    header.append(noncePrefix);
+    uchar kdfSize[2];
+    qToBigEndian<quint16>(kdf.length(), kdfSize);
+    header.append((const char *)kdfSize, 2);
+    header.append(kdf);
+    if(out->write(header) != header.length()) {
+        errorMessage = QObject::tr("Can't write archive header");
+        return false;
+    }
+    return true;
+}
+
+bool KeyArchive::write(const KeyInfo &key)
+{
+    if(flags & Compressed) {
+        appendRecord(&block, key);
+        blockIds.append(key.getId());
+        return block.length() < ARCHIVE_BLOCK_SIZE || flushBlock();
+    }
+
+    QByteArray plain;
+    appendRecord(&plain, key);
+
+    Entry entry;
+    entry.frame = frames;
+    entry.offset = device->pos();
+    bool ok = writeFrame(frames, plain, false);
+    plain.fill('\0');
+    if(!ok) {
+        return false;
+    }
+    index.insert(key.getId(), entry);
+    frames++;
+    return true;
+}
+
+bool KeyArchive::flushBlock()
+{
+    if(block.isEmpty()) {
+        return true;
+    }
+
+    uLongf size = compressBound(block.length());
+    QByteArray plain;
+    appendNumber(&plain, block.length());
+    plain.resize(4 + size);
+    int result = compress2((Bytef *)plain.data() + 4, &size, (const Bytef *)block.constData(), block.length(),
+                           Z_DEFAULT_COMPRESSION);
+    QtSecureMemory::wipe(block.data(), block.length());
+    // keeps the reserved capacity
+    block.truncate(0);
+    if(result != Z_OK) {
+        plain.fill('\0');
+        errorMessage = QObject::tr("Can't compress archive record %1").arg(frames);
+        return false;
+    }
+    plain.resize(4 + size);
+
+    Entry entry;
+    entry.frame = frames;
+    entry.offset = device->pos();
+    bool ok = writeFrame(frames, plain, false);
+    plain.fill('\0');
+    if(!ok) {
+        return false;
+    }
+    foreach(int id, blockIds) {
+        index.insert(id, entry);
+    }
+    blockIds.clear();
+    frames++;
+    return true;
+}
+
+bool KeyArchive::finish()
+{
+    if(!flushBlock()) {
+        return false;
+    }
+
+    QByteArray plain;
+    appendNumber(&plain, frames);
+    if(flags & Indexed) {
+        QHash<int, Entry>::const_iterator it;
+        for(it = index.constBegin(); it != index.constEnd(); ++it) {
+            appendNumber(&plain, it.key());
+            appendNumber(&plain, it.value().frame);
+            appendNumber(&plain, it.value().offset >> 32);
+            appendNumber(&plain, it.value().offset & 0xFFFFFFFF);
+        }
+    }
+
+    qint64 offset = device->pos();
+    if(!writeFrame(ARCHIVE_TRAILER_FRAME, plain, true)) {
+        return false;
+    }
+    QByteArray footer;
+    appendNumber(&footer, offset >> 32);
+    appendNumber(&footer, offset & 0xFFFFFFFF);
+    footer.append(ARCHIVE_END_MAGIC, ARCHIVE_MAGIC_SIZE);
+    if(device->write(footer) != footer.length()) {
+        errorMessage = QObject::tr("Can't write archive output");
+        return false;
+    }
+    return true;
+}
+
+bool KeyArchive::writeFrame(quint32 frame, const QByteArray &plain, bool trailer)
+{
+    QByteArray sealed;
+    if(plain.length() > ARCHIVE_MAX_FRAME || !seal(frame, plain, &sealed)) {
+        errorMessage = QObject::tr("Can't encrypt archive record %1").arg(frame);
+        return false;
+    }
+
+    QByteArray length;
+    appendNumber(&length, trailer ? (plain.length() | ARCHIVE_TRAILER) : plain.length());
+    if(device->write(length) != length.length() || device->write(sealed) != sealed.length()) {
+        errorMessage = QObject::tr("Can't write archive output");
+        return false;
+    }
+    return true;
+}
+
+bool KeyArchive::readHeader(QIODevice *in)
+{
+    errorMessage.clear();
+    device = in;
+    frames = 0;
+
+    header = readFull(in, ARCHIVE_HEADER_SIZE);
+    if(header.length() != ARCHIVE_HEADER_SIZE
+            || (!header.startsWith(ARCHIVE_MAGIC) && !header.startsWith(ARCHIVE_VAULT_MAGIC))) {
+        errorMessage = QObject::tr("Not an archive");
+        return false;
+    }
+    mode = (QtAes::CipherMode)header.at(ARCHIVE_MAGIC_SIZE);
+    flags = (uchar)header.at(ARCHIVE_MAGIC_SIZE + 1);
+    noncePrefix = header.right(ARCHIVE_PREFIX_SIZE);
+
+    if(header.startsWith(ARCHIVE_VAULT_MAGIC)) {
+        if(vaultAes == nullptr) {
+            errorMessage = QObject::tr("The archive is sealed with a vault key");
+            return false;
+        }
+        cryptoAes = vaultAes;
+        return true;
+    }
+    return readKdf(in);
+}
+
+bool KeyArchive::readKdf(QIODevice *in)
+{
+    QByteArray kdfSize = readFull(in, 2);
+    int size = kdfSize.length() == 2 ? qFromBigEndian<quint16>((const uchar *)kdfSize.constData()) : -1;
+    QByteArray kdf = size > 0 && size <= ARCHIVE_MAX_KDF_SIZE ? readFull(in, size) : QByteArray();
+    if(kdf.length() != size) {
+        errorMessage = QObject::tr("Archive truncated");
+        return false;
+    }
+    // authenticated with the rest of the header by every frame
+    header.append(kdfSize);
+    header.append(kdf);
+
+    QtKdf::Params params = QtKdf::Params::fromString(QString::fromLatin1(kdf));
+    if(!params.isValid() || !QtKdf::isWithinLimits(params)) {
+        errorMessage = QObject::tr("Bad archive key parameters");
+        return false;
+    }
+    return deriveKey(params);
+}
+
+bool KeyArchive::readFrame(quint32 *frame, QByteArray *data, bool *trailer)
+{
+    QByteArray lengthBytes = readFull(device, 4);
+    if(lengthBytes.length() != 4) {
+        errorMessage = QObject::tr("Archive truncated");
+        return false;
+    }
+    quint32 length = qFromBigEndian<quint32>((const uchar *)lengthBytes.constData());
+    *trailer = (length & ARCHIVE_TRAILER) != 0;
+    length &= ~ARCHIVE_TRAILER;
+    if((int)length > ARCHIVE_MAX_FRAME) {
+        errorMessage = QObject::tr("Bad archive record length");
+        return false;
+    }
+    *data = readFull(device, length + QtAes::tagSize());
+    if(data->length() != (int)length + QtAes::tagSize()) {
+        errorMessage = QObject::tr("Archive truncated");
+        return false;
+    }
+    *frame = *trailer ? ARCHIVE_TRAILER_FRAME : frames++;
+    return true;
+}
+
+bool KeyArchive::openRecords(quint32 frame, const QByteArray &data, QList<KeyInfo> *keys) const
+{
+    QByteArray plain;
+    if(!open(frame, data, &plain)) {
+        return false;
+    }
+    QByteArray records;
+    bool ok = true;
+    if(flags & Compressed) {
+        ok = inflateRecords(plain, &records);
+        plain.fill('\0');
+    } else {
+        records.swap(plain);
+    }
+
+    int pos = 0;
+    while(ok && pos < records.length()) {
+        KeyInfo key;
+        ok = takeRecord(records, &pos, &key);
+        keys->append(key);
+    }
+    records.fill('\0');
+    return ok && !keys->isEmpty();
+}
+
+bool KeyArchive::openTrailer(const QByteArray &data, quint32 records)
+{
+    quint32 count;
+    if(!readTrailer(data, &count)) {
+        return false;
+    }
+    // records cut off the end would otherwise go unnoticed
+    if(count != records) {
+        errorMessage = QObject::tr("Archive truncated");
+        return false;
+    }
+    return true;
+}
+
+bool KeyArchive::readTrailer(const QByteArray &data, quint32 *records)
+{
+    QByteArray plain;
+    if(!open(ARCHIVE_TRAILER_FRAME, data, &plain) || plain.length() < 4) {
+        errorMessage = QObject::tr("Archive trailer failed authentication");
+        return false;
+    }
+    *records = qFromBigEndian<quint32>((const uchar *)plain.constData());
+
+    index.clear();
+    if(!(flags & Indexed)) {
+        return true;
+    }
+    // a compressed frame holds several records, so several entries
+    int entries = (plain.length() - 4) / ARCHIVE_ENTRY_SIZE;
+    if((plain.length() - 4) % ARCHIVE_ENTRY_SIZE != 0
+            || (!(flags & Compressed) && entries != (int)*records)) {
+        errorMessage = QObject::tr("Bad archive index");
+        return false;
+    }
+    const uchar *bytes = (const uchar *)plain.constData() + 4;
+    for(int i = 0; i < entries; i++, bytes += ARCHIVE_ENTRY_SIZE) {
+        Entry entry;
+        entry.frame = qFromBigEndian<quint32>(bytes + 4);
+        entry.offset = qFromBigEndian<quint64>(bytes + 8);
+        if(entry.frame >= *records) {
+            errorMessage = QObject::tr("Bad archive index");
+            return false;
+        }
+        index.insert((qint32)qFromBigEndian<quint32>(bytes), entry);
+    }
+    return true;
+}
+
+bool KeyArchive::openIndex(QIODevice *in)
+{
+    if(!readHeader(in)) {
+        return false;
+    }
+    if(!(flags & Indexed) || in->isSequential()) {
+        errorMessage = QObject::tr("Archive has no index");
+        return false;
+    }
+
+    QByteArray footer;
+    if(in->size() >= ARCHIVE_HEADER_SIZE + ARCHIVE_FOOTER_SIZE && in->seek(in->size() - ARCHIVE_FOOTER_SIZE)) {
+        footer = readFull(in, ARCHIVE_FOOTER_SIZE);
+    }
+    if(footer.length() != ARCHIVE_FOOTER_SIZE || !footer.endsWith(ARCHIVE_END_MAGIC)) {
+        errorMessage = QObject::tr("Archive truncated");
+        return false;
+    }
+    qint64 offset = qFromBigEndian<quint64>((const uchar *)footer.constData());
+    if(offset < ARCHIVE_HEADER_SIZE || offset >= in->size() - ARCHIVE_FOOTER_SIZE || !in->seek(offset)) {
+        errorMessage = QObject::tr("Bad archive index");
+        return false;
+    }
+
+    // the records aren't read, so there's nothing to check the count against
+    quint32 frame;
+    QByteArray data;
+    bool trailer = false;
+    if(!readFrame(&frame, &data, &trailer) || !trailer) {
+        errorMessage = QObject::tr("Bad archive index");
+        return false;
+    }
+    quint32 records;
+    return readTrailer(data, &records);
+}
+
+bool KeyArchive::readRecord(int id, KeyInfo *key)
+{
+    if(!index.contains(id)) {
+        errorMessage = QObject::tr("No record %1 in archive").arg(id);
+        return false;
+    }
+
+    Entry entry = index.value(id);
+    quint32 frame;
+    QByteArray data;
+    bool trailer = false;
+    if(!device->seek(entry.offset) || !readFrame(&frame, &data, &trailer) || trailer) {
+        errorMessage = QObject::tr("Bad archive index");
+        return false;
+    }
+    QList<KeyInfo> keys;
+    if(!openRecords(entry.frame, data, &keys)) {
+        errorMessage = QObject::tr("Archive record %1 failed authentication").arg(id);
+        return false;
+    }
+    foreach(const KeyInfo &found, keys) {
+        if(found.getId() == id) {
+            *key = found;
+            return true;
+        }
+    }
+    errorMessage = QObject::tr("Bad archive index");
+    return false;
+}
+
+bool KeyArchive::seal(quint32 frame, const QByteArray &plain, QByteArray *sealed) const
+{
+    unsigned char nonce[12];
+    frameNonce(frame, nonce);
+    sealed->resize(plain.length() + QtAes::tagSize());
+    return cryptoAes->seal(mode, nonce, frameAad(frame), plain.constData(), plain.length(), sealed->data());
+}
+
+bool KeyArchive::open(quint32 frame, const QByteArray &sealed, QByteArray *plain) const
+{
+    unsigned char nonce[12];
+    frameNonce(frame, nonce);
+    plain->resize(qMax(sealed.length() - QtAes::tagSize(), 0));
+    if(!cryptoAes->open(mode, nonce, frameAad(frame), sealed.constData(), sealed.length(), plain->data())) {
+        QtSecureMemory::wipe(plain->data(), plain->length());
+        return false;
+    }
+    return true;
+}
+
+QByteArray KeyArchive::frameAad(quint32 frame) const
+{
+    QByteArray aad = header;
+    appendNumber(&aad, frame);
+    return aad;
+}
+
+void KeyArchive::frameNonce(quint32 frame, unsigned char *nonce) const
+{
+    memcpy(nonce, noncePrefix.constData(), ARCHIVE_PREFIX_SIZE);
+    qToBigEndian<quint32>(frame, nonce + ARCHIVE_PREFIX_SIZE);
+}
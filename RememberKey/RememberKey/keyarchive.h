@@ -0,0 +1,99 @@
+#ifndef KEYARCHIVE_H
+#define KEYARCHIVE_H
+
+#include <QIODevice>
+#include <QHash>
+#include "keyinfo.h"
+#include "../QtAesLib/qtaes.h"
+
+// Binary export file, each record sealed once with a key derived from a
+// password. The KDF parameters travel in the header, so another vault that
+// knows the password imports the file, whatever its own salt.
+//
+// Layout: "RKB2" | mode | flags | 2 reserved | 8-byte nonce prefix | KDF length
+// (u16 BE) | KDF parameters as QtKdf::Params::toString, with a fresh salt,
+// then one frame per record: length (u32 BE, top bit marks the trailer) |
+// ciphertext | tag.
+// Frame i uses nonce prefix | i (u32 BE) and authenticates the header and i,
+// the trailer uses index 0xFFFFFFFF. The trailer holds the record count and,
+// with the Indexed flag, id | frame | offset for every record, so one record
+// can be read without the others. The file ends with the trailer's offset
+// (u64 BE) and "RKBE".
+//
+// With the Compressed flag, records are packed back to back into blocks of
+// about 64 KiB and each block is deflated before it's sealed, so a frame
+// holds raw size (u32 BE) | zlib data for several records. Only one block is
+// ever in memory, and index entries point at the block of the record.
+//
+// "RKB1" files have no KDF parameters, they were sealed with the vault key.
+class KeyArchive
+{
+public:
+    enum Flag {
+        Indexed = 0x01,
+        Compressed = 0x02
+    };
+
+    // vaultAes is only needed to read RKB1 files
+    explicit KeyArchive(const QString &password, const QtAes *vaultAes = nullptr);
+
+    static bool isArchive(QIODevice *in);
+
+    // Writing, records go out in the order they're written
+    bool begin(QIODevice *out, int flags = Indexed);
+    bool write(const KeyInfo &key);
+    bool finish();
+
+    // Reading front to back. Frames can be opened on other threads, the
+    // trailer is checked against the number of records before it.
+    bool readHeader(QIODevice *in);
+    bool readFrame(quint32 *index, QByteArray *frame, bool *trailer);
+    // one record per frame, or a whole block of them when compressed
+    bool openRecords(quint32 index, const QByteArray &frame, QList<KeyInfo> *keys) const;
+    bool openTrailer(const QByteArray &frame, quint32 records);
+
+    // Random access, needs an indexed file on a seekable device
+    bool openIndex(QIODevice *in);
+    QList<int> getIds() const { return index.keys(); }
+    bool readRecord(int id, KeyInfo *key);
+
+    QString getLastErrorMessage() const { return errorMessage; }
+
+private:
+    Q_DISABLE_COPY(KeyArchive)
+
+    struct Entry {
+        quint32 frame;
+        qint64 offset;
+    };
+
+    bool deriveKey(const QtKdf::Params &params);
+    bool readKdf(QIODevice *in);
+    bool flushBlock();
+    bool readTrailer(const QByteArray &frame, quint32 *records);
+    bool writeFrame(quint32 frame, const QByteArray &plain, bool trailer);
+    bool seal(quint32 frame, const QByteArray &plain, QByteArray *sealed) const;
+    bool open(quint32 frame, const QByteArray &sealed, QByteArray *plain) const;
+    QByteArray frameAad(quint32 frame) const;
+    void frameNonce(quint32 frame, unsigned char *nonce) const;
+
+    // the key frames are sealed with, fileKey or vaultAes
+    const QtAes *cryptoAes;
+    const QtAes *vaultAes;
+    QtAes fileKey;
+    QString password;
+    QtAes::CipherMode mode;
+    int flags;
+    QByteArray header;
+    QByteArray noncePrefix;
+    QIODevice *device;
+    quint32 frames;
+    QHash<int, Entry> index;
+    // records waiting to be compressed
+    QByteArray block;
+    QList<int> blockIds;
+
+    QString errorMessage;
+};
+
+#endif // KEYARCHIVE_H
@@ -2,29 +2,393 @@
 
 #include <QDebug>
 #include <QCryptographicHash>
+#include <QBuffer>
+#include "../QtAesLib/qtbase64.h"
+#include "../QtAesLib/qthash.h"
+#include "../QtAesLib/qtaesstream.h"
+#include "importpipeline.h"
+#include "keyarchive.h"
 
 #define KEY_PASSWORD_ID 1
-#define NONE_QUERY "select * from keypass where id < 0"
+#define NONE_QUERY "select id from keypass where id < 0"
 
 #define EXPORT_FILE_TOKEN "RememberKey"
 
-KeyDatabase::KeyDatabase()
+#define HEADER_KDF "kdf"
+
+// statement shapes, each is prepared once per connection
+#define SQL_ADD_KEY "insert into keypass (id, name, site, other, username, password, notes) " \
+    "values (:id, :name, :site, :other, :username, :password, :notes)"
+#define SQL_GET_KEY "select * from keypass where id = :id"
+#define SQL_HAS_KEY "select id from keypass where id = :id"
+#define SQL_DELETE_KEY "delete from keypass where id = :id"
+#define SQL_UPDATE_KEY "update keypass set name = :name, site = :site, other = :other, " \
+    "username = :username, password = :password, notes = :notes where id = :id"
+#define SQL_SPLIT_KEY "update keypass set other = '', username = :username, password = :password, " \
+    "notes = :notes where id = :id"
+#define SQL_IS_LEGACY "select other != '' from keypass where id = :id"
+#define SQL_GET_HEADER "select value from keymeta where name = :name"
+#define SQL_SAVE_HEADER "insert or replace into keymeta values (:name, :value)"
+// listings only fetch ids, the model reads the rows it shows
+#define SQL_LIST_KEYS "select id from keypass where name != ''"
+#define SQL_SEARCH_KEYS "select id from keypass where name like :pattern or site like :sitepattern"
+#define SQL_NAMED_KEYS "select id from keypass where name = :pattern"
+#define SQL_GET_FIELD "select other, %1 from keypass where id = :id"
+#define SQL_CONFIRM_FIELD "select id, other, %1 from keypass where id in (%2)"
+// name weighs more than site in the ranking
+#define SQL_INDEX_KEYS "select rowid from keysearch where keysearch match :pattern " \
+    "order by bm25(keysearch, 10.0, 1.0)"
+
+// trigram index over name and site, the rows stay in keypass
+#define SEARCH_TABLE "keysearch"
+#define SEARCH_MIN_LENGTH 3
+#define SQL_CREATE_SEARCH "create virtual table keysearch using fts5(name, site, " \
+    "content = 'keypass', content_rowid = 'id', tokenize = 'trigram')"
+#define SQL_REBUILD_SEARCH "insert into keysearch(keysearch) values ('rebuild')"
+
+// keyed trigram tokens of the secret fields, see KeyDatabase::blindSearch
+#define BLIND_TABLE "keyblind"
+#define BLIND_MAX_TOKENS 8
+#define SQL_CREATE_BLIND "create table keyblind (token blob not null, id integer not null, " \
+    "primary key (token, id)) without rowid"
+#define SQL_CREATE_BLIND_ID "create index keyblind_id on keyblind (id)"
+#define SQL_ADD_BLIND "insert or ignore into keyblind (token, id) values (:token, :id)"
+#define SQL_DELETE_BLIND "delete from keyblind where id = :id"
+#define SQL_FIND_BLIND "select id from keyblind where token in (%1) group by id having count(*) = %2"
+
+static const char *const SEARCH_TRIGGERS[] = {
+    "create trigger if not exists keysearch_insert after insert on keypass begin "
+        "insert into keysearch(rowid, name, site) values (new.id, new.name, new.site); end",
+    "create trigger if not exists keysearch_delete after delete on keypass begin "
+        "insert into keysearch(keysearch, rowid, name, site) values ('delete', old.id, old.name, old.site); end",
+    "create trigger if not exists keysearch_update after update of name, site on keypass begin "
+        "insert into keysearch(keysearch, rowid, name, site) values ('delete', old.id, old.name, old.site); "
+        "insert into keysearch(rowid, name, site) values (new.id, new.name, new.site); end"
+};
+static const char *const SEARCH_TRIGGER_NAMES[] = { "keysearch_insert", "keysearch_delete", "keysearch_update" };
+
+// encrypted column of each KeyDatabase::Field
+static const char *const FIELD_COLUMNS[] = { "username", "password", "notes" };
+static const int FIELD_COUNT = 3;
+static const int ALL_FIELDS = (1 << KeyDatabase::UsernameField) | (1 << KeyDatabase::PasswordField)
+        | (1 << KeyDatabase::NotesField);
+// fields searchable through the blind index, passwords never are
+static const KeyDatabase::Field BLIND_FIELDS[] = { KeyDatabase::UsernameField, KeyDatabase::NotesField };
+
+// distinct lower case trigrams, tagged with the field so a username
+// token never matches a notes token
+static QList<QByteArray> blindGrams(int field, const QString &text)
 {
-    db = QSqlDatabase::addDatabase("QSQLITE");
-    queryModel = new QSqlQueryModel();
-    cryptoHash = new QCryptographicHash(QCryptographicHash::Sha1);
+    QList<QByteArray> grams;
+    QSet<QString> seen;
+    const QString lower = text.toLower();
+    for(int i = 0; i + 3 <= lower.length(); i++) {
+        QString gram = lower.mid(i, 3);
+        if(!seen.contains(gram)) {
+            seen.insert(gram);
+            grams << QByteArray(1, (char)('0' + field)) + gram.toUtf8();
+        }
+    }
+    return grams;
+}
+
+KeyDatabase::KeyDatabase(const QString &connectionName)
+{
+    db = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+    queryModel = new KeyTableModel(this);
     cryptoAes = NULL;
+    verified = false;
+    searchIndex = false;
+    blindIndex = false;
+    defaultBatchSize = DefaultBatchSize;
+    batchDepth = 0;
+    batchSize = DefaultBatchSize;
+    batchPending = 0;
+    keyCache.setMaxCost(DefaultCacheSize);
+    writeGeneration = 0;
+    cacheHits = 0;
+    cacheMisses = 0;
+}
+
+KeyDatabase::Batch::Batch(KeyDatabase *database, int batchSize) :
+    database(database)
+{
+    active = database->beginBatch(batchSize);
+}
+
+KeyDatabase::Batch::~Batch()
+{
+    if(active) {
+        database->commit();
+    }
+}
+
+bool KeyDatabase::Batch::commit()
+{
+    if(!active) {
+        return false;
+    }
+    active = false;
+    return database->commit();
+}
+
+bool KeyDatabase::beginBatch(int size)
+{
+    if(batchDepth > 0) {
+        batchDepth++;
+        return true;
+    }
+    if(!db.transaction()) {
+        setErrorMessage(QObject::tr("Can't begin transaction"), db.lastError().text());
+        return false;
+    }
+    batchDepth = 1;
+    batchSize = size > 0 ? size : defaultBatchSize;
+    batchPending = 0;
+    return true;
+}
+
+bool KeyDatabase::addMany(const QList<KeyInfo> &keys)
+{
+    Batch batch(this);
+    for(const KeyInfo &key : keys) {
+        if(!addKeyInfo(key)) {
+            return false;
+        }
+    }
+    return batch.commit();
+}
+
+bool KeyDatabase::commit()
+{
+    if(batchDepth == 0 || --batchDepth > 0) {
+        return true;
+    }
+    batchPending = 0;
+    if(!db.commit()) {
+        setErrorMessage(QObject::tr("Can't commit transaction"), db.lastError().text());
+        db.rollback();
+        return false;
+    }
+    return true;
+}
+
+bool KeyDatabase::batchWritten()
+{
+    // one fsync per batchSize rows instead of one per row
+    if(batchDepth == 0 || ++batchPending < batchSize) {
+        return true;
+    }
+    batchPending = 0;
+    if(!db.commit() || !db.transaction()) {
+        setErrorMessage(QObject::tr("Can't commit transaction"), db.lastError().text());
+        return false;
+    }
+    return true;
+}
+
+QSqlQuery &KeyDatabase::statement(const QString &sql)
+{
+    QSqlQuery *query = statements.value(sql);
+    if(query == nullptr) {
+        query = new QSqlQuery(db);
+        if(!query->prepare(sql)) {
+            // exec reports it, the next close drops the broken statement
+            qDebug() << "Can't prepare" << sql << query->lastError().text();
+        }
+        statements.insert(sql, query);
+    }
+    return *query;
+}
+
+void KeyDatabase::clearStatements()
+{
+    qDeleteAll(statements);
+    statements.clear();
+}
+
+void KeyDatabase::setModelQuery(const QString &sql, const QString &pattern, const QString &term)
+{
+    QSqlQuery &query = statement(sql);
+    if(sql.contains(":pattern")) {
+        query.bindValue(":pattern", pattern);
+    }
+    if(sql.contains(":sitepattern")) {
+        query.bindValue(":sitepattern", pattern);
+    }
+    QVector<int> ids;
+    if(query.exec()) {
+        while(query.next()) {
+            ids.append(query.value(0).toInt());
+        }
+    } else {
+        qDebug() << "Can't list keys" << query.lastError().text();
+    }
+    query.finish();
+    if(!term.isEmpty()) {
+        blindSearch(term, &ids);
+    }
+    queryModel->setIds(ids);
 }
 
-QSqlQueryModel* KeyDatabase::getQueryModel()
+KeyTableModel* KeyDatabase::getQueryModel()
 {
     return queryModel;
 }
 
 void KeyDatabase::getKeyInQueryModel(int row, KeyInfo *key)
 {
-    QSqlRecord record = queryModel->record(row);
-    decryptRecord(record, key);
+    queryModel->getKeyInfo(row, key);
+}
+
+bool KeyDatabase::getFieldInQueryModel(int row, Field field, QString *value)
+{
+    return queryModel->getField(row, field, value);
+}
+
+static bool setCachedValue(QtSecureBuffer *buffer, const QString &value)
+{
+    QByteArray utf8 = value.toUtf8();
+    bool ok = buffer->assign(utf8.constData(), utf8.length());
+    QtSecureMemory::wipe(utf8.data(), utf8.length());
+    return ok;
+}
+
+static QString cachedValue(const QtSecureBuffer &buffer)
+{
+    return QString::fromUtf8(buffer.constData(), buffer.size());
+}
+
+bool KeyDatabase::getKeyField(int id, Field field, QString *value)
+{
+    errorMessage.clear();
+    CachedKey *cached = cachedKey(id);
+    if(cached != nullptr && (cached->fields & (1 << field)) != 0) {
+        cacheHits++;
+        *value = cachedValue(cached->values[field]);
+        return true;
+    }
+    cacheMisses++;
+
+    QSqlQuery &query = statement(QString(SQL_GET_FIELD).arg(FIELD_COLUMNS[field]));
+    query.bindValue(":id", id);
+    if(!query.exec() || !query.next()) {
+        setErrorMessage("Can't get KeyInfo", query.lastError().text());
+        query.finish();
+        return false;
+    }
+    const QString other = query.value(0).toString();
+    const QString encrypted = query.value(1).toString();
+    query.finish();
+
+    // not split yet, the whole record goes through the blob path
+    if(!other.isEmpty()) {
+        KeyInfo key;
+        if(!getKeyInfo(id, &key)) {
+            return false;
+        }
+        const QString values[] = { key.getUsername(), key.getPassword(), key.getNotes() };
+        *value = values[field];
+        return true;
+    }
+    if(!decryptField(encrypted, value)) {
+        return false;
+    }
+
+    // copying a username doesn't decrypt the password, but keeps the username
+    if(verified) {
+        if(cached == nullptr) {
+            cached = new CachedKey();
+            cached->generation = writeGeneration;
+            keyCache.insert(id, cached);
+        }
+        // out of locked memory, the field just isn't cached
+        if(setCachedValue(&cached->values[field], *value)) {
+            cached->fields |= 1 << field;
+        }
+    }
+    return true;
+}
+
+KeyDatabase::CachedKey *KeyDatabase::cachedKey(int id)
+{
+    // nothing is kept or served before the key is proved right
+    if(!verified) {
+        return nullptr;
+    }
+    CachedKey *cached = keyCache.object(id);
+    if(cached != nullptr && cached->generation < rowGenerations.value(id, 0)) {
+        keyCache.remove(id);
+        return nullptr;
+    }
+    return cached;
+}
+
+void KeyDatabase::touchRow(int id)
+{
+    rowGenerations.insert(id, ++writeGeneration);
+    // dropped right away too, the old secret shouldn't wait for eviction
+    keyCache.remove(id);
+}
+
+void KeyDatabase::forgetRow(int id)
+{
+    touchRow(id);
+    queryModel->forget(id);
+}
+
+void KeyDatabase::clearCache()
+{
+    // the secure buffers are wiped as the entries go
+    keyCache.clear();
+    rowGenerations.clear();
+}
+
+KeyDatabase::CacheStats KeyDatabase::getCacheStats() const
+{
+    CacheStats stats;
+    stats.hits = cacheHits;
+    stats.misses = cacheMisses;
+    stats.size = keyCache.size();
+    stats.capacity = keyCache.maxCost();
+    return stats;
+}
+
+bool KeyDatabase::getKeyNames(const QVector<int> &ids, QStringList *names, QStringList *sites)
+{
+    // padded to a full page so there is a single statement shape
+    QStringList placeholders;
+    for(int i = 0; i < KeyTableModel::PageSize; i++) {
+        placeholders << "?";
+    }
+    QSqlQuery &query = statement(QString("select id, name, site from keypass where id in (%1)")
+                                 .arg(placeholders.join(", ")));
+    for(int i = 0; i < KeyTableModel::PageSize; i++) {
+        query.addBindValue(i < ids.size() ? ids.at(i) : -1);
+    }
+    if(!query.exec()) {
+        setErrorMessage("Can't list keys", query.lastError().text());
+        return false;
+    }
+    QHash<int, int> rows;
+    for(int i = 0; i < ids.size(); i++) {
+        rows.insert(ids.at(i), i);
+    }
+    names->clear();
+    sites->clear();
+    for(int i = 0; i < ids.size(); i++) {
+        names->append(QString());
+        sites->append(QString());
+    }
+    while(query.next()) {
+        int row = rows.value(query.value(0).toInt(), -1);
+        if(row >= 0) {
+            (*names)[row] = query.value(1).toString();
+            (*sites)[row] = query.value(2).toString();
+        }
+    }
+    query.finish();
+    return true;
 }
 
 bool KeyDatabase::decryptRecord(const QSqlRecord &record, KeyInfo *key)
@@ -32,18 +396,33 @@ bool KeyDatabase::decryptRecord(const QSqlRecord &record, KeyInfo *key)
     key->setId(record.value("id").toInt());
     key->setName(record.value("name").toString());
     key->setSite(record.value("site").toString());
-    const QString &other = record.value("other").toString();
-    return setDecryptedOther(other, *key);
+
+    // rows written before the split keep every field in one blob
+    const QString other = record.value("other").toString();
+    if(!other.isEmpty()) {
+        if(!setDecryptedOther(other, *key)) {
+            return false;
+        }
+        migrateOther(key->getId(), *key);
+        return true;
+    }
+
+    QString values[FIELD_COUNT];
+    for(int i = 0; i < FIELD_COUNT; i++) {
+        if(!decryptField(record.value(FIELD_COLUMNS[i]).toString(), &values[i])) {
+            return false;
+        }
+    }
+    key->setUsername(values[UsernameField]);
+    key->setPassword(values[PasswordField]);
+    key->setNotes(values[NotesField]);
+    return true;
 }
 
 bool KeyDatabase::decryptQuery(QSqlQuery &query, KeyInfo *key)
 {
-    while(query.next()) {
-        key->setId(query.value("id").toInt());
-        key->setName(query.value("name").toString());
-        key->setSite(query.value("site").toString());
-        const QString &other = query.value("other").toString();
-        return setDecryptedOther(other, *key);
+    if(query.next()) {
+        return decryptRecord(query.record(), key);
     }
 
     setErrorMessage(QObject::tr("Can't decrypt query"), QObject::tr("No record"));
@@ -55,6 +434,8 @@ void KeyDatabase::forgetPassword()
     if(cryptoAes != NULL) {
         cryptoAes = nullptr;
    }
+    verified = false;
+    clearCache();
 }
 
 bool KeyDatabase::activePassword(const QString &pass, const QtAes *aes)
@@ -62,8 +443,10 @@ bool KeyDatabase::activePassword(const QString &pass, const QtAes *aes)
     errorMessage.clear();
     cryptoAes = aes;
     if(checkPassword(pass)) {
-        queryModel->setQuery(NONE_QUERY, db);
         lastQuery = NONE_QUERY;
+        lastPattern.clear();
+        lastTerm.clear();
+        setModelQuery(lastQuery, lastPattern);
         return true;
     } else {
         forgetPassword();
@@ -95,13 +478,28 @@ bool KeyDatabase::checkPassword(const QString &pass)
         setErrorMessage(QObject::tr("Check password failed"), QObject::tr("password mismatched"));
         return false;
     }
+
+    // the key is proved right, rows from before the split can be rewritten
+    verified = true;
+    migrateRecords();
+    openBlindIndex();
     return true;
 }
 
 void KeyDatabase::close()
 {
+    if(cacheHits + cacheMisses > 0) {
+        qDebug() << "Record cache" << cacheHits << "hits" << cacheMisses << "misses, size" << keyCache.maxCost();
+    }
     forgetPassword();
     queryModel->clear();
+    searchIndex = false;
+    blindIndex = false;
+    clearStatements();
+    if(batchDepth > 0) {
+        db.commit();
+        batchDepth = 0;
+    }
     if(db.isOpen()) {
         db.close();
     }
@@ -119,6 +517,9 @@ bool KeyDatabase::create(const QString &path, const QString &password, const QtA
         setErrorMessage(QObject::tr("Can't create database"), db.lastError().text());
         return false;
     }
+    if(!applyConfig()) {
+        return false;
+    }
 
     QSqlQuery query(db);
     if(!query.exec(
@@ -126,21 +527,52 @@ bool KeyDatabase::create(const QString &path, const QString &password, const QtA
                     "id integer primary key, "
                     "name varchar(256) not null, "
                     "site varchar(256), "
-                    "other clob not null"
+                    "other clob not null default '', "
+                    "username clob, "
+                    "password clob, "
+                    "notes clob"
                 ")")) {
         setErrorMessage(QObject::tr("Can't create table"), db.lastError().text());
         return false;
     }
 
+    if(!query.exec(
+                "create table keymeta ("
+                    "name varchar(64) primary key, "
+                    "value text not null"
+                ")")) {
+        setErrorMessage(QObject::tr("Can't create table"), db.lastError().text());
+        return false;
+    }
+
+    // key derivation parameters live in the vault header
+    kdfParams = aes->getKdfParams();
+    if(aes->hasKdf() && !saveHeader(HEADER_KDF, kdfParams.toString())) {
+        setErrorMessage(QObject::tr("Can't save header"), errorMessage);
+        return false;
+    }
+
     cryptoAes = aes;
+    verified = true;
+
+    if(!openSearchIndex()) {
+        return false;
+    }
+    if(!query.exec(SQL_CREATE_BLIND) || !query.exec(SQL_CREATE_BLIND_ID)) {
+        setErrorMessage(QObject::tr("Can't create table"), query.lastError().text());
+        return false;
+    }
+    blindIndex = true;
 
     if(!savePassword(password)) {
         setErrorMessage(QObject::tr("Can't save password"), errorMessage);
         return false;
     }
 
-    queryModel->setQuery(NONE_QUERY, db);
     lastQuery = NONE_QUERY;
+    lastPattern.clear();
+    lastTerm.clear();
+    setModelQuery(lastQuery, lastPattern);
 
     return true;
 }
@@ -158,91 +590,499 @@ bool KeyDatabase::open(const QString &path)
         return false;
     }
 
+    return applyConfig() && upgradeSchema() && openSearchIndex() && loadHeader();
+}
+
+bool KeyDatabase::applyConfig()
+{
+    static const QStringList journalModes = QStringList()
+            << "WAL" << "DELETE" << "TRUNCATE" << "PERSIST" << "MEMORY" << "OFF";
+    static const QStringList syncModes = QStringList() << "OFF" << "NORMAL" << "FULL" << "EXTRA";
+    static const QStringList tempStores = QStringList() << "DEFAULT" << "FILE" << "MEMORY";
+
+    // values come from the .rkini, only known words get into the SQL
+    QString journalMode = config.journalMode.toUpper();
+    QString synchronous = config.synchronous.toUpper();
+    QString tempStore = config.tempStore.toUpper();
+    if(!journalModes.contains(journalMode)) {
+        qDebug() << "Unknown journal mode" << config.journalMode;
+        journalMode = Config().journalMode;
+    }
+    if(!synchronous.isEmpty() && !syncModes.contains(synchronous)) {
+        qDebug() << "Unknown synchronous mode" << config.synchronous;
+        synchronous.clear();
+    }
+    if(!tempStores.contains(tempStore)) {
+        qDebug() << "Unknown temp store" << config.tempStore;
+        tempStore = "DEFAULT";
+    }
+
+    QSqlQuery query(db);
+    if(!query.exec(QString("pragma journal_mode = %1").arg(journalMode))) {
+        setErrorMessage("Can't configure database", query.lastError().text());
+        return false;
+    }
+    // sqlite answers with the mode it really took, WAL fails on some network shares
+    QString actualMode = query.next() ? query.value(0).toString().toUpper() : QString();
+    if(actualMode != journalMode) {
+        qDebug() << "Journal mode" << journalMode << "not available, using" << actualMode;
+    }
+    query.finish();
+
+    // NORMAL is durable enough under WAL, rollback journals need FULL
+    if(synchronous.isEmpty()) {
+        synchronous = actualMode == "WAL" ? "NORMAL" : "FULL";
+    }
+
+    QStringList pragmas;
+    pragmas << QString("pragma synchronous = %1").arg(synchronous)
+            << QString("pragma temp_store = %1").arg(tempStore)
+            << QString("pragma cache_size = %1").arg(config.cacheSize)
+            << QString("pragma mmap_size = %1").arg(qMax<qint64>(0, config.mmapSize));
+    for(const QString &pragma : pragmas) {
+        if(!query.exec(pragma)) {
+            setErrorMessage("Can't configure database", query.lastError().text());
+            return false;
+        }
+        query.finish();
+    }
+    return true;
+}
+
+bool KeyDatabase::upgradeSchema()
+{
+    if(db.record("keypass").contains(FIELD_COLUMNS[UsernameField])) {
+        return true;
+    }
+
+    // only adds the columns, the rows move over once the password is known
+    QSqlQuery query(db);
+    db.transaction();
+    for(const char *column : FIELD_COLUMNS) {
+        if(!query.exec(QString("alter table keypass add column %1 clob").arg(column))) {
+            setErrorMessage("Can't upgrade database", query.lastError().text());
+            db.rollback();
+            return false;
+        }
+    }
+    if(!db.commit()) {
+        setErrorMessage("Can't upgrade database", db.lastError().text());
+        return false;
+    }
+    return true;
+}
+
+bool KeyDatabase::openSearchIndex()
+{
+    searchIndex = false;
+
+    // FTS5 with the trigram tokenizer needs SQLite 3.34, older builds keep the LIKE scan
+    QSqlQuery query(db);
+    bool exists = db.tables().contains(SEARCH_TABLE);
+    if(!query.exec(exists ? "select rowid from keysearch where 0" : SQL_CREATE_SEARCH)) {
+        qDebug() << "Search index not available" << query.lastError().text();
+        // the triggers would fail every write on a build without FTS5
+        for(const char *name : SEARCH_TRIGGER_NAMES) {
+            query.exec(QString("drop trigger if exists %1").arg(name));
+        }
+        return true;
+    }
+    query.finish();
+
+    // a vault written without the triggers has to be indexed again
+    query.exec("select count(*) from sqlite_master where type = 'trigger' and name like 'keysearch_%'");
+    bool synced = exists && query.next() && query.value(0).toInt() == 3;
+    query.finish();
+    if(!synced) {
+        db.transaction();
+        for(const char *trigger : SEARCH_TRIGGERS) {
+            if(!query.exec(trigger)) {
+                setErrorMessage("Can't create search index", query.lastError().text());
+                db.rollback();
+                return false;
+            }
+        }
+        if(!query.exec(SQL_REBUILD_SEARCH) || !db.commit()) {
+            setErrorMessage("Can't create search index", query.lastError().text());
+            db.rollback();
+            return false;
+        }
+    }
+
+    searchIndex = true;
+    return true;
+}
+
+bool KeyDatabase::openBlindIndex()
+{
+    // tokens come from the key, so the index is built once it's proved right
+    blindIndex = db.tables().contains(BLIND_TABLE);
+    if(blindIndex) {
+        return true;
+    }
+
+    QSqlQuery query(db);
+    if(!query.exec(SQL_CREATE_BLIND) || !query.exec(SQL_CREATE_BLIND_ID)) {
+        setErrorMessage("Can't create blind index", query.lastError().text());
+        return false;
+    }
+    blindIndex = true;
+    return rebuildBlindIndex();
+}
+
+bool KeyDatabase::rebuildBlindIndex()
+{
+    if(!blindIndex) {
+        return true;
+    }
+
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    Batch batch(this);
+    if(!query.exec("delete from keyblind") || !query.exec("select * from keypass where name != ''")) {
+        setErrorMessage("Can't build blind index", query.lastError().text());
+        return false;
+    }
+    KeyInfo key;
+    while(query.next()) {
+        if(!decryptRecord(query.record(), &key) || !indexRecord(key.getId(), key)) {
+            qDebug() << "Can't index record" << query.value("id").toInt() << errorMessage;
+        }
+    }
+    query.finish();
+    return batch.commit();
+}
+
+bool KeyDatabase::indexRecord(int id, const KeyInfo &key)
+{
+    return writeBlindTokens(id, blindTokens(key));
+}
+
+bool KeyDatabase::writeBlindTokens(int id, const QList<QByteArray> &tokens)
+{
+    if(!unindexRecord(id)) {
+        return false;
+    }
+
+    QSqlQuery &query = statement(SQL_ADD_BLIND);
+    for(const QByteArray &token : tokens) {
+        query.bindValue(":token", token);
+        query.bindValue(":id", id);
+        if(!query.exec()) {
+            setErrorMessage("Can't index KeyInfo", query.lastError().text());
+            return false;
+        }
+    }
+    return true;
+}
+
+QList<QByteArray> KeyDatabase::blindTokens(const KeyInfo &key) const
+{
+    const QString values[] = { key.getUsername(), key.getPassword(), key.getNotes() };
+    QList<QByteArray> tokens;
+    for(Field field : BLIND_FIELDS) {
+        for(const QByteArray &gram : blindGrams(field, values[field])) {
+            tokens << cryptoAes->blindToken(gram);
+        }
+    }
+    return tokens;
+}
+
+bool KeyDatabase::unindexRecord(int id)
+{
+    QSqlQuery &query = statement(SQL_DELETE_BLIND);
+    query.bindValue(":id", id);
+    if(!query.exec()) {
+        setErrorMessage("Can't index KeyInfo", query.lastError().text());
+        return false;
+    }
+    return true;
+}
+
+QList<KeyDatabase::BlindLookup> KeyDatabase::blindLookups(const QString &term)
+{
+    QList<BlindLookup> lookups;
+    if(!blindIndex || cryptoAes == NULL) {
+        return lookups;
+    }
+
+    for(Field field : BLIND_FIELDS) {
+        // a few trigrams narrow it down enough, confirmBlind checks the rest
+        QList<QByteArray> grams = blindGrams(field, term).mid(0, BLIND_MAX_TOKENS);
+        if(grams.isEmpty()) {
+            break;
+        }
+        QStringList placeholders;
+        BlindLookup lookup;
+        lookup.field = field;
+        for(const QByteArray &gram : grams) {
+            placeholders << "?";
+            lookup.tokens << cryptoAes->blindToken(gram);
+        }
+        lookup.sql = QString(SQL_FIND_BLIND).arg(placeholders.join(", ")).arg(grams.size());
+        lookups << lookup;
+    }
+    return lookups;
+}
+
+QVector<int> KeyDatabase::confirmBlind(const QString &term, Field field,
+                                       const QVector<int> &candidates, const QVector<int> &known)
+{
+    QVector<int> matches;
+    if(cryptoAes == NULL) {
+        return matches;
+    }
+
+    QSet<int> found;
+    for(int id : known) {
+        found.insert(id);
+    }
+    // the tokens only say the trigrams are there, not in that order
+    for(int id : candidates) {
+        QString value;
+        if(!found.contains(id) && getKeyField(id, field, &value)
+                && value.contains(term, Qt::CaseInsensitive)) {
+            found.insert(id);
+            matches.append(id);
+        }
+    }
+    return matches;
+}
+
+void KeyDatabase::blindSearch(const QString &term, QVector<int> *ids)
+{
+    for(const BlindLookup &lookup : blindLookups(term)) {
+        QSqlQuery &query = statement(lookup.sql);
+        for(const QByteArray &token : lookup.tokens) {
+            query.addBindValue(token);
+        }
+        if(!query.exec()) {
+            qDebug() << "Can't search blind index" << query.lastError().text();
+            continue;
+        }
+        QVector<int> candidates;
+        while(query.next()) {
+            candidates.append(query.value(0).toInt());
+        }
+        query.finish();
+        *ids += confirmBlind(term, lookup.field, candidates, *ids);
+    }
+}
+
+bool KeyDatabase::migrateRecords()
+{
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    if(!query.exec("select * from keypass where other != ''")) {
+        setErrorMessage("Can't migrate records", query.lastError().text());
+        return false;
+    }
+
+    // decryptRecord rewrites each row it reads
+    Batch batch(this);
+    KeyInfo key;
+    while(query.next()) {
+        if(!decryptRecord(query.record(), &key)) {
+            qDebug() << "Can't migrate record" << query.value("id").toInt() << errorMessage;
+        }
+    }
+    query.finish();
+    return batch.commit();
+}
+
+bool KeyDatabase::loadHeader()
+{
+    kdfParams = QtKdf::Params();
+
+    // old vaults have no header and keep the legacy key derivation
+    if(!db.tables().contains("keymeta")) {
+        return true;
+    }
+
+    QSqlQuery &query = statement(SQL_GET_HEADER);
+    query.bindValue(":name", HEADER_KDF);
+    if(!query.exec()) {
+        setErrorMessage("Can't read header", query.lastError().text());
+        return false;
+    }
+    bool found = query.next();
+    if(found) {
+        kdfParams = QtKdf::Params::fromString(query.value(0).toString());
+    }
+    query.finish();
+    if(found && !kdfParams.isValid()) {
+        setErrorMessage("Can't read header", QObject::tr("unknown key derivation"));
+        return false;
+    }
+    return true;
+}
+
+bool KeyDatabase::saveHeader(const QString &name, const QString &value)
+{
+    QSqlQuery &query = statement(SQL_SAVE_HEADER);
+    query.bindValue(":name", name);
+    query.bindValue(":value", value);
+    if(!query.exec()) {
+        setErrorMessage("Can't save header", query.lastError().text());
+        return false;
+    }
     return true;
 }
 
 bool KeyDatabase::addKeyInfo(const KeyInfo &key)
+{
+    return addSealedKey(sealKeyInfo(key));
+}
+
+KeyDatabase::SealedKey KeyDatabase::sealKeyInfo(const KeyInfo &key) const
+{
+    SealedKey sealed;
+    sealed.name = key.getName();
+    sealed.site = key.getSite();
+    sealed.fields << encryptField(key.getUsername()) << encryptField(key.getPassword())
+                  << encryptField(key.getNotes());
+    if(blindIndex && !key.getName().isEmpty()) {
+        sealed.tokens = blindTokens(key);
+    }
+    return sealed;
+}
+
+bool KeyDatabase::addSealedKey(const SealedKey &sealed)
 {
     errorMessage.clear();
-    QSqlQuery query(db);
-    QString addsql = QString(
-        "insert into keypass values (null, \"%1\", \"%2\", \"%3\")")
-            .arg(key.getName())
-            .arg(key.getSite())
-            .arg(getEncryptedOther(key));
-
-    qDebug() << addsql;
-    if(!query.exec(addsql)) {
+    QSqlQuery &query = statement(SQL_ADD_KEY);
+    query.bindValue(":id", QVariant(QVariant::Int));
+    query.bindValue(":name", sealed.name);
+    query.bindValue(":site", sealed.site);
+    query.bindValue(":other", QString(""));
+    for(int i = 0; i < FIELD_COUNT; i++) {
+        query.bindValue(QString(":%1").arg(FIELD_COLUMNS[i]), sealed.fields.value(i));
+    }
+    if(!query.exec()) {
         setErrorMessage("Can't add KeyInfo", query.lastError().text());
         return false;
     }
+    int id = query.lastInsertId().toInt();
+    touchRow(id);
+    if(blindIndex && !sealed.tokens.isEmpty() && !writeBlindTokens(id, sealed.tokens)) {
+        return false;
+    }
 
-    return true;
+    return batchWritten();
 }
 
 bool KeyDatabase::getKeyInfo(int id, KeyInfo *key)
 {
     errorMessage.clear();
-    QSqlQuery query(db);
-    QString getsql = QString(
-                "select * from keypass where id = %1").arg(id);
-    if(!query.exec(getsql)) {
+    CachedKey *cached = cachedKey(id);
+    if(cached != nullptr && cached->fields == ALL_FIELDS) {
+        cacheHits++;
+        key->setId(id);
+        key->setName(cached->name);
+        key->setSite(cached->site);
+        key->setUsername(cachedValue(cached->values[UsernameField]));
+        key->setPassword(cachedValue(cached->values[PasswordField]));
+        key->setNotes(cachedValue(cached->values[NotesField]));
+        return true;
+    }
+    cacheMisses++;
+
+    QSqlQuery &query = statement(SQL_GET_KEY);
+    query.bindValue(":id", id);
+    if(!query.exec()) {
         setErrorMessage("Can't get KeyInfo", query.lastError().text());
         return false;
     }
 
-    return decryptQuery(query, key);
+    bool ok = decryptQuery(query, key);
+    query.finish();
+    if(ok && verified) {
+        cached = new CachedKey();
+        cached->name = key->getName();
+        cached->site = key->getSite();
+        cached->generation = writeGeneration;
+        if(setCachedValue(&cached->values[UsernameField], key->getUsername())
+                && setCachedValue(&cached->values[PasswordField], key->getPassword())
+                && setCachedValue(&cached->values[NotesField], key->getNotes())) {
+            cached->fields = ALL_FIELDS;
+            keyCache.insert(id, cached);
+        } else {
+            delete cached;
+        }
+    }
+    return ok;
 }
 
 bool KeyDatabase::updateKeyInfo(const KeyInfo &old, const KeyInfo &key)
 {
     errorMessage.clear();
-    QString update = "";
-    bool first = true;
-    if(old.getName() != key.getName()) {
-        if(!first) {
-            update += ", ";
-        } else {
-            first = false;
-        }
-        update += QString("name = \"%1\"").arg(key.getName());
+    const QString values[] = { key.getUsername(), key.getPassword(), key.getNotes() };
+    const QString oldValues[] = { old.getUsername(), old.getPassword(), old.getNotes() };
+    bool secretChanged = false;
+    for(int i = 0; i < FIELD_COUNT; i++) {
+        secretChanged = secretChanged || values[i] != oldValues[i];
     }
 
-    if(old.getSite() != key.getSite()) {
-        if(!first) {
-            update += ", ";
-        } else {
-            first = false;
-        }
-        update += QString("site = \"%1\"").arg(key.getSite());
+    // a row still in the old blob gets all of its fields written
+    bool legacy = false;
+    if(secretChanged) {
+        QSqlQuery &check = statement(SQL_IS_LEGACY);
+        check.bindValue(":id", key.getId());
+        legacy = check.exec() && check.next() && check.value(0).toBool();
+        check.finish();
     }
 
-    if(old.getUsername() != key.getUsername() ||
-            old.getPassword() != key.getPassword() ||
-            old.getNotes() != key.getNotes()) {
-        if(!first) {
-            update += ", ";
-        } else {
-            first = false;
+    QStringList columns;
+    if(old.getName() != key.getName()) {
+        columns << "name";
+    }
+    if(old.getSite() != key.getSite()) {
+        columns << "site";
+    }
+    for(int i = 0; i < FIELD_COUNT; i++) {
+        if(legacy || values[i] != oldValues[i]) {
+            columns << FIELD_COLUMNS[i];
         }
-        update += QString("other = \"%1\"")
-                .arg(getEncryptedOther(key));
     }
-
-    if(update.isEmpty()) {
+    if(legacy) {
+        columns << "other";
+    }
+    if(columns.isEmpty()) {
         return true;
     }
 
-    QSqlQuery query(db);
-    QString updatesql = QString(
-                "update keypass set %1 where id = %2")
-            .arg(update)
-            .arg(key.getId());
-    qDebug() << updatesql;
-    if(!query.exec(updatesql)) {
+    // only what changed is encrypted and written, one cached shape per column set
+    QStringList assignments;
+    for(const QString &column : columns) {
+        assignments << QString("%1 = :%1").arg(column);
+    }
+    QSqlQuery &query = statement(QString("update keypass set %1 where id = :id").arg(assignments.join(", ")));
+    for(const QString &column : columns) {
+        if(column == "name") {
+            query.bindValue(":name", key.getName());
+        } else if(column == "site") {
+            query.bindValue(":site", key.getSite());
+        } else if(column == "other") {
+            query.bindValue(":other", QString(""));
+        }
+    }
+    for(int i = 0; i < FIELD_COUNT; i++) {
+        if(columns.contains(FIELD_COLUMNS[i])) {
+            query.bindValue(QString(":%1").arg(FIELD_COLUMNS[i]), encryptField(values[i]));
+        }
+    }
+    query.bindValue(":id", key.getId());
+    if(!query.exec()) {
         setErrorMessage("Can't update KeyInfo", query.lastError().text());
         return false;
     }
+    touchRow(key.getId());
+    queryModel->forget(key.getId());
+    bool blindChanged = legacy || values[UsernameField] != oldValues[UsernameField]
+            || values[NotesField] != oldValues[NotesField];
+    if(blindIndex && blindChanged && !indexRecord(key.getId(), key)) {
+        return false;
+    }
 
     return true;
 }
@@ -262,13 +1102,17 @@ bool KeyDatabase::addOrUpdateKeyInfo(const KeyInfo &key)
 bool KeyDatabase::deleteKeyInfo(int keyId)
 {
     errorMessage.clear();
-    QSqlQuery query(db);
-    QString deletesql = QString(
-                "delete from keypass where id = %1").arg(keyId);
-    if(!query.exec(deletesql)) {
+    QSqlQuery &query = statement(SQL_DELETE_KEY);
+    query.bindValue(":id", keyId);
+    if(!query.exec()) {
         setErrorMessage("Can't delete KeyInfo", query.lastError().text());
         return false;
     }
+    touchRow(keyId);
+    queryModel->forget(keyId);
+    if(blindIndex && !unindexRecord(keyId)) {
+        return false;
+    }
 
     return true;
 }
@@ -276,26 +1120,43 @@ bool KeyDatabase::deleteKeyInfo(int keyId)
 bool KeyDatabase::search(const QString &searchkey)
 {
     errorMessage.clear();
-    QString sql;
+    planSearch(searchkey);
+    setModelQuery(lastQuery, lastPattern, lastTerm);
+
+    return true;
+}
+
+KeyDatabase::SearchPlan KeyDatabase::planSearch(const QString &searchkey)
+{
+    lastTerm = searchkey;
     if(searchkey.isEmpty()) {
-        sql = QString("select * from keypass where name != \"\"");
+        lastQuery = SQL_LIST_KEYS;
+        lastPattern.clear();
+    } else if(searchIndex && searchkey.length() >= SEARCH_MIN_LENGTH) {
+        // one quoted phrase is a substring match for the trigram tokenizer
+        lastQuery = SQL_INDEX_KEYS;
+        lastPattern = QString("\"%1\"").arg(QString(searchkey).replace("\"", "\"\""));
     } else {
-        sql = QString("select * from keypass "
-                                 "where name like \"%%1%\" "
-                                 "or site like \"%%1%\"")
-            .arg(searchkey);
+        // shorter than a trigram, nothing to look up
+        lastQuery = SQL_SEARCH_KEYS;
+        lastPattern = QString("%%1%").arg(searchkey);
     }
-    qDebug() << sql;
 
-    queryModel->setQuery(sql, db);
-    lastQuery = sql;
-
-    return true;
+    SearchPlan plan;
+    plan.term = lastTerm;
+    plan.sql = lastQuery;
+    plan.pattern = lastPattern;
+    if(!searchkey.isEmpty()) {
+        plan.blind = blindLookups(searchkey);
+        plan.aes = cryptoAes;
+    }
+    return plan;
 }
 
 bool KeyDatabase::reverseKey(int count)
 {
     KeyInfo key;
+    Batch batch(this);
 
     for(int i = KEY_PASSWORD_ID + 1; i < count; i++) {
         key.setId(i);
@@ -305,140 +1166,453 @@ bool KeyDatabase::reverseKey(int count)
         }
     }
 
-    return true;
+    return batch.commit();
 }
 
 void KeyDatabase::updateQueryModel(const QString &name)
 {
     if(name.isEmpty()) {
-        queryModel->setQuery(lastQuery, db);
+        setModelQuery(lastQuery, lastPattern, lastTerm);
     } else {
-        queryModel->setQuery(QString("select * from keypass where name = \"%1\"").arg(name));
+        setModelQuery(SQL_NAMED_KEYS, name);
     }
 }
 
 QString KeyDatabase::getCryptoHash(const QString &source)
 {
-    QByteArray bytes;
-    bytes.append(source);
-    cryptoHash->reset();
-    cryptoHash->addData(bytes);
-    return QString(cryptoHash->result().toBase64());
+    // derived by the KDF together with the key, no extra hashing
+    if(cryptoAes != NULL && cryptoAes->hasKdf()) {
+        return cryptoAes->getVerifier();
+    }
+
+    return QString(QtHash::hash(source.toUtf8(), QCryptographicHash::Sha1).toBase64());
 }
 
-QString KeyDatabase::encryptByAES(const QString &source)
+QString KeyDatabase::encryptField(const QString &value) const
 {
-    return cryptoAes->encrypt(source);
+    QByteArray source = value.toUtf8();
+    QByteArray encrypted;
+    cryptoAes->encrypt(source, &encrypted);
+    source.fill('\0');
+    return QString::fromLatin1(encrypted);
 }
 
-QString KeyDatabase::decryptByAES(const QString &source)
+bool KeyDatabase::decryptField(const QString &encrypted, QString *value)
 {
-    return cryptoAes->decrypt(source);
+    QByteArray decrypted;
+    if(!cryptoAes->decrypt(encrypted.toLatin1(), &decrypted)) {
+        // auth tag mismatched
+        setErrorMessage(QObject::tr("Can't decrypt data"), QObject::tr("wrong password"));
+        return false;
+    }
+    *value = QString::fromUtf8(decrypted);
+    decrypted.fill('\0');
+    return true;
 }
 
-QString KeyDatabase::getEncryptedOther(const KeyInfo &key)
+// username|password|notes of the rows from before the split columns
+static bool decodeOther(const QtAes *aes, const QString &other, QString values[FIELD_COUNT])
 {
-    QString source = QString("%1|%2|%3")
-            .arg(key.getUsername())
-            .arg(key.getPassword())
-            .arg(key.getNotes());
-    return encryptByAES(source);
+    QByteArray decryptedOther;
+    if(!aes->decrypt(other.toLatin1(), &decryptedOther)) {
+        // auth tag mismatched
+        return false;
+    }
+
+    // split on bytes, each field is transcoded once
+    int first = decryptedOther.indexOf('|');
+    int second = first < 0 ? -1 : decryptedOther.indexOf('|', first + 1);
+    bool broken = second < 0;
+    if(QtAes::isLegacy(other)) {
+        // ECB rows have no tag, a wrong password shows up as garbage here
+        broken = broken || decryptedOther.indexOf('|', second + 1) >= 0;
+    }
+    if(broken) {
+        decryptedOther.fill('\0');
+        return false;
+    }
+
+    const char *data = decryptedOther.constData();
+    values[KeyDatabase::UsernameField] = QString::fromUtf8(data, first);
+    values[KeyDatabase::PasswordField] = QString::fromUtf8(data + first + 1, second - first - 1);
+    values[KeyDatabase::NotesField] = QString::fromUtf8(data + second + 1, decryptedOther.length() - second - 1);
+    decryptedOther.fill('\0');
+    return true;
 }
 
 bool KeyDatabase::setDecryptedOther(const QString &other, KeyInfo &key)
 {
-    QString decryptedOther = decryptByAES(other);
-    const QStringList &strlist = decryptedOther.split("|");
-    if(strlist.length() != 3) {
+    QString values[FIELD_COUNT];
+    if(!decodeOther(cryptoAes, other, values)) {
         setErrorMessage(QObject::tr("Can't decrypt data"), QObject::tr("wrong password"));
         return false;
     }
-    key.setUsername(strlist.at(0));
-    key.setPassword(strlist.at(1));
-    key.setNotes(strlist.at(2));
+    key.setUsername(values[UsernameField]);
+    key.setPassword(values[PasswordField]);
+    key.setNotes(values[NotesField]);
+    return true;
+}
+
+QString KeyDatabase::confirmSql(Field field, int count)
+{
+    QStringList placeholders;
+    for(int i = 0; i < count; i++) {
+        placeholders << "?";
+    }
+    return QString(SQL_CONFIRM_FIELD).arg(FIELD_COLUMNS[field]).arg(placeholders.join(", "));
+}
+
+bool KeyDatabase::decryptStored(const QtAes *aes, const QString &other, const QString &encrypted,
+                                Field field, QString *value)
+{
+    if(!other.isEmpty()) {
+        QString values[FIELD_COUNT];
+        if(!decodeOther(aes, other, values)) {
+            return false;
+        }
+        *value = values[field];
+        return true;
+    }
+    QByteArray decrypted;
+    if(!aes->decrypt(encrypted.toLatin1(), &decrypted)) {
+        return false;
+    }
+    *value = QString::fromUtf8(decrypted);
+    decrypted.fill('\0');
     return true;
 }
 
+bool KeyDatabase::migrateOther(int id, const KeyInfo &key)
+{
+    // only after the password is proved right, or garbage would be written back
+    if(!verified) {
+        return true;
+    }
+
+    // split an old blob row into its own columns, with the AEAD engine
+    QSqlQuery &query = statement(SQL_SPLIT_KEY);
+    query.bindValue(":username", encryptField(key.getUsername()));
+    query.bindValue(":password", encryptField(key.getPassword()));
+    query.bindValue(":notes", encryptField(key.getNotes()));
+    query.bindValue(":id", id);
+    if(!query.exec()) {
+        qDebug() << "Can't migrate record" << id << query.lastError().text();
+        return false;
+    }
+    return batchWritten();
+}
+
 void KeyDatabase::setErrorMessage(const QString &header, const QString &msg)
 {
     errorMessage = QString("%1: { %2}").arg(header).arg(msg);
     qDebug() << errorMessage;
 }
 
-bool KeyDatabase::exportToFile(QFile *file)
+bool KeyDatabase::exportToFile(QFile *file, const QString &password, bool compress)
 {
     QSqlQuery query(db);
+    query.setForwardOnly(true);
     if(!query.exec("select * from keypass")) {
         setErrorMessage("Can't export", query.lastError().text());
         return false;
     }
-    QString token = cryptoAes->encrypt(cryptoAes->encrypt(EXPORT_FILE_TOKEN)) + "\n";
-    file->write(token.toUtf8());
+
+    // one sealed frame per record, the fields aren't encrypted a second time
+    KeyArchive archive(password);
+    if(!archive.begin(file, compress ? KeyArchive::Indexed | KeyArchive::Compressed : KeyArchive::Indexed)) {
+        setErrorMessage("Can't export", archive.getLastErrorMessage());
+        return false;
+    }
+    KeyInfo key;
     while(query.next()) {
-        QString id = QString::number(query.value("id").toInt());
-        QString name = query.value("name").toString();
-        QString site = query.value("site").toString();
-        QString other = query.value("other").toString();
-
-        QString toWrite = cryptoAes->encrypt(QString("%1|%2|%3|%4")
-                .arg(cryptoAes->encrypt(id))
-                .arg(cryptoAes->encrypt(name))
-                .arg(cryptoAes->encrypt(site))
-                .arg(cryptoAes->encrypt(other))) + "\n";
-        file->write(toWrite.toUtf8());
+        if(!decryptRecord(query.record(), &key)) {
+            setErrorMessage("Can't export", errorMessage);
+            return false;
+        }
+        if(!archive.write(key)) {
+            setErrorMessage("Can't export", archive.getLastErrorMessage());
+            return false;
+        }
+    }
+    query.finish();
+
+    if(!archive.finish()) {
+        setErrorMessage("Can't export", archive.getLastErrorMessage());
+        return false;
     }
     return true;
 }
 
-bool KeyDatabase::importFromFile(QFile *file)
+bool KeyDatabase::importFromFile(QFile *file, const QString &password)
 {
     qDebug() << "Start Importing";
-    QString token = cryptoAes->decrypt(cryptoAes->decrypt(QString::fromUtf8(file->readLine(256))));
+    // imported rows may replace ones already decrypted
+    clearCache();
+    Batch batch(this);
+    if(KeyArchive::isArchive(file)) {
+        return importFromArchive(file, password) && batch.commit();
+    }
+    // text exports from before the archive format
+    if(QtAesStream::isStream(file)) {
+        return importFromStream(file, password) && batch.commit();
+    }
+
+    // files written before the stream format
+    QByteArray token;
+    QByteArray data;
+    cryptoAes->decrypt(file->readLine(256), &data);
+    cryptoAes->decrypt(data, &token);
     if(!token.startsWith(EXPORT_FILE_TOKEN)) {
         errorMessage = QObject::tr("Unrecognize token, not the proper file or error password");
         return false;
     }
 
-    QSqlQuery query(db);
-    while(!file->atEnd()) {
-        QString data = cryptoAes->decrypt(QString::fromUtf8(file->readLine()));
+    return importLines(file, true) && batch.commit();
+}
 
-        QStringList strlist = data.split("|");
-        if(strlist.length() != 4) {
-            errorMessage = QObject::tr("Error format line : ") + data;
-            return false;
-        }
+bool KeyDatabase::importFromStream(QFile *file, const QString &password)
+{
+    QBuffer body;
+    body.open(QIODevice::ReadWrite);
+    QtAesStream stream(password, cryptoAes);
+    if(!stream.decrypt(file, &body)) {
+        errorMessage = QObject::tr("Can't decrypt file, not the proper file or error password : %1")
+                .arg(stream.getLastErrorMessage());
+        return false;
+    }
+    body.seek(0);
 
-        QString id = cryptoAes->decrypt(strlist.at(0));
-        QString name = cryptoAes->decrypt(strlist.at(1));
-        QString site = cryptoAes->decrypt(strlist.at(2));
-        QString other = cryptoAes->decrypt(strlist.at(3));
+    bool ok = true;
+    if(body.readLine().trimmed() != EXPORT_FILE_TOKEN) {
+        errorMessage = QObject::tr("Unrecognize token, not the proper file or error password");
+        ok = false;
+    }
+    ok = ok && importLines(&body, false);
 
-        QString getSql = QString("select id from keypass where id = %1").arg(id);
-        if(!query.exec(getSql) || !query.next()) {
-            // Use add
-            QString addSql = QString("insert into keypass values (%1,\"%2\",\"%3\",\"%4\")")
-                    .arg(id, name, site, other);
-            qDebug() << addSql;
-            if(!query.exec(addSql)) {
-                setErrorMessage(QObject::tr("Can't add record"), query.lastError().text());
-                return false;
+    body.buffer().fill('\0');
+    return ok;
+}
+
+bool KeyDatabase::importFromArchive(QFile *file, const QString &password)
+{
+    KeyArchive archive(password, cryptoAes);
+    if(!archive.readHeader(file)) {
+        errorMessage = archive.getLastErrorMessage();
+        return false;
+    }
+
+    // frames are opened, inflated and their fields encrypted on the workers
+    typedef QPair<quint32, QByteArray> Frame;
+    typedef ImportPipeline<Frame, QList<ImportedRecord> > Pipeline;
+    Pipeline pipeline;
+    bool complete = false;
+    bool ok = pipeline.run([&archive, &complete](const Pipeline::Push &push) {
+        quint32 records = 0;
+        Frame frame;
+        bool trailer = false;
+        while(archive.readFrame(&frame.first, &frame.second, &trailer)) {
+            if(trailer) {
+                complete = archive.openTrailer(frame.second, records);
+                break;
             }
-        } else {
-            // use update
-            QString updateSql = QString(
-                        "update keypass set name = \"%2\", site = \"%3\","
-                        " other = \"%4\" where id = %1"
-                        )
-                    .arg(id, name, site, other);
-            qDebug() << updateSql;
-            if(!query.exec(updateSql)) {
-                setErrorMessage(QObject::tr("Can't update record"), query.lastError().text());
+            records++;
+            if(!push(frame)) {
+                break;
+            }
+        }
+    }, [this, &archive](const Frame &frame) -> QList<ImportedRecord> {
+        QList<ImportedRecord> records;
+        QList<KeyInfo> keys;
+        if(!archive.openRecords(frame.first, frame.second, &keys)) {
+            ImportedRecord record;
+            record.error = QObject::tr("Archive record %1 failed authentication, not the proper file or error password")
+                    .arg(frame.first);
+            records.append(record);
+            return records;
+        }
+        foreach(const KeyInfo &key, keys) {
+            records.append(sealImported(key));
+        }
+        return records;
+    }, [this](const QList<ImportedRecord> &records) -> bool {
+        foreach(const ImportedRecord &record, records) {
+            if(!importRecord(record)) {
                 return false;
             }
         }
+        return true;
+    });
+
+    if(ok && !complete) {
+        errorMessage = archive.getLastErrorMessage();
+        return false;
     }
+    return ok;
+}
 
-    return true;
+bool KeyDatabase::restoreKeyInfo(QFile *file, int id, const QString &password)
+{
+    errorMessage.clear();
+    KeyArchive archive(password, cryptoAes);
+    KeyInfo key;
+    if(!archive.openIndex(file) || !archive.readRecord(id, &key)) {
+        setErrorMessage(QObject::tr("Can't restore record"), archive.getLastErrorMessage());
+        return false;
+    }
+
+    Batch batch(this);
+    return importRecord(sealImported(key)) && batch.commit();
+}
+
+bool KeyDatabase::importLines(QIODevice *in, bool legacy)
+{
+    // lines are decoded on a pool of workers and written here in file order
+    typedef ImportPipeline<QByteArray, ImportedRecord> Pipeline;
+    Pipeline pipeline;
+    // every record is sealed again with this vault's key, tokens included
+    return pipeline.run([in](const Pipeline::Push &push) {
+        while(!in->atEnd() && push(in->readLine())) {
+        }
+    }, [this, legacy](const QByteArray &line) {
+        return legacy ? decodeLegacyLine(line) : decodeStreamLine(line);
+    }, [this](const ImportedRecord &record) {
+        return importRecord(record);
+    });
 }
 
+KeyDatabase::ImportedRecord KeyDatabase::decodeStreamLine(const QByteArray &line) const
+{
+    // id|name|site|other, then username|password|notes since the column split
+    QList<QByteArray> strlist = line.trimmed().split('|');
+    if(strlist.length() != 4 && strlist.length() != 4 + FIELD_COUNT) {
+        ImportedRecord record;
+        record.error = QObject::tr("Error format line in stream");
+        return record;
+    }
+    QStringList fields;
+    for(int i = 4; i < strlist.length(); i++) {
+        fields << QString::fromLatin1(strlist.at(i));
+    }
+    return resealImported(QString::fromLatin1(strlist.at(0)), QString::fromUtf8(QtBase64::decode(strlist.at(1))),
+                          QString::fromUtf8(QtBase64::decode(strlist.at(2))), QString::fromLatin1(strlist.at(3)),
+                          fields);
+}
+
+KeyDatabase::ImportedRecord KeyDatabase::resealImported(const QString &id, const QString &name, const QString &site,
+                                                        const QString &other, const QStringList &fields) const
+{
+    ImportedRecord record;
+    bool isNumber;
+    KeyInfo key;
+    key.setId(id.toInt(&isNumber));
+    if(!isNumber) {
+        record.error = QObject::tr("Can't import record: { bad id %1}").arg(id);
+        return record;
+    }
+    key.setName(name);
+    key.setSite(site);
+
+    // the stored fields are sealed with the exporting vault's key, they are
+    // opened here and sealed again, never copied as they are
+    QString values[FIELD_COUNT];
+    bool ok;
+    if(!other.isEmpty()) {
+        ok = decodeOther(cryptoAes, other, values);
+    } else {
+        ok = fields.length() == FIELD_COUNT;
+        for(int i = 0; ok && i < FIELD_COUNT; i++) {
+            ok = cryptoAes->decrypt(fields.at(i), &values[i]);
+        }
+    }
+    if(!ok) {
+        record.error = QObject::tr("Can't import record: { id %1 doesn't decrypt with this vault's key, "
+                                   "it was exported from another vault}").arg(id);
+        return record;
+    }
+    key.setUsername(values[UsernameField]);
+    key.setPassword(values[PasswordField]);
+    key.setNotes(values[NotesField]);
+    return sealImported(key);
+}
+
+KeyDatabase::ImportedRecord KeyDatabase::sealImported(const KeyInfo &key) const
+{
+    ImportedRecord record;
+    record.id = QString::number(key.getId());
+    record.name = key.getName();
+    record.site = key.getSite();
+    record.fields << encryptField(key.getUsername()) << encryptField(key.getPassword())
+                  << encryptField(key.getNotes());
+    if(blindIndex && !key.getName().isEmpty()) {
+        record.tokens = blindTokens(key);
+    }
+    record.indexed = true;
+    return record;
+}
+
+KeyDatabase::ImportedRecord KeyDatabase::decodeLegacyLine(const QByteArray &line) const
+{
+    ImportedRecord record;
+    QByteArray data;
+    cryptoAes->decrypt(line, &data);
+
+    QList<QByteArray> strlist = data.split('|');
+    if(strlist.length() != 4) {
+        record.error = QObject::tr("Error format line : ") + QString::fromUtf8(data);
+        return record;
+    }
+
+    QList<QByteArray> fields;
+    if(!cryptoAes->decryptList(strlist, &fields)) {
+        record.error = QObject::tr("Error format line, a field doesn't decrypt");
+        return record;
+    }
+    return resealImported(QString::fromLatin1(fields.at(0)), QString::fromUtf8(fields.at(1)),
+                          QString::fromUtf8(fields.at(2)), QString::fromLatin1(fields.at(3)), QStringList());
+}
+
+bool KeyDatabase::importRecord(const ImportedRecord &record)
+{
+    if(!record.error.isEmpty()) {
+        errorMessage = record.error;
+        return false;
+    }
+
+    bool isNumber;
+    int keyId = record.id.toInt(&isNumber);
+    if(!isNumber) {
+        setErrorMessage(QObject::tr("Can't import record"), QObject::tr("bad id %1").arg(record.id));
+        return false;
+    }
+    if(record.other.isEmpty() && record.fields.length() != FIELD_COUNT) {
+        setErrorMessage(QObject::tr("Can't import record"), QObject::tr("no data for id %1").arg(record.id));
+        return false;
+    }
+
+    QSqlQuery &has = statement(SQL_HAS_KEY);
+    has.bindValue(":id", keyId);
+    bool exists = has.exec() && has.next();
+    has.finish();
+
+    // Use update when the id is taken, add otherwise
+    QSqlQuery &query = statement(exists ? SQL_UPDATE_KEY : SQL_ADD_KEY);
+    query.bindValue(":id", keyId);
+    query.bindValue(":name", record.name);
+    query.bindValue(":site", record.site);
+    query.bindValue(":other", record.other);
+    for(int i = 0; i < FIELD_COUNT; i++) {
+        // old blob rows get their columns on the next migration pass
+        query.bindValue(QString(":%1").arg(FIELD_COLUMNS[i]),
+                        i < record.fields.length() ? QVariant(record.fields.at(i)) : QVariant(QVariant::String));
+    }
+    if(!query.exec()) {
+        setErrorMessage(exists ? QObject::tr("Can't update record") : QObject::tr("Can't add record"),
+                        query.lastError().text());
+        return false;
+    }
+    touchRow(keyId);
+    if(blindIndex && record.indexed && !writeBlindTokens(keyId, record.tokens)) {
+        return false;
+    }
+    return batchWritten();
+}
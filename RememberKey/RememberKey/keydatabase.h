@@ -5,59 +5,258 @@
 #include <QCryptographicHash>
 
 #include "keyinfo.h"
+#include "keytablemodel.h"
 #include "../QtAesLib/qtaes.h"
+#include "../QtAesLib/qtsecurememory.h"
 
 class KeyDatabase
 {
 public:
-    KeyDatabase();
+    static const int DefaultBatchSize = 500;
+    static const int DefaultCacheSize = 64;
 
-    QSqlQueryModel *getQueryModel();
+    // Groups bulk writes into transactions of batchSize rows (0 for the
+    // size set with setBatchSize). Nested
+    // batches join the outer one. Leaving the scope commits what was
+    // written so far, like the autocommit mode it replaces.
+    class Batch
+    {
+    public:
+        explicit Batch(KeyDatabase *database, int batchSize = 0);
+        ~Batch();
+
+        bool commit();
+
+    private:
+        Q_DISABLE_COPY(Batch)
+
+        KeyDatabase *database;
+        bool active;
+    };
+
+    // Connection settings applied as PRAGMAs on every open
+    struct Config {
+        Config() : journalMode("WAL"), mmapSize(64 * 1024 * 1024), cacheSize(-8192),
+            tempStore("MEMORY") {}
+
+        QString journalMode;    // WAL, DELETE, TRUNCATE, PERSIST, MEMORY, OFF
+        qint64 mmapSize;        // bytes, 0 turns mmap off
+        int cacheSize;          // pages, or KiB when negative
+        QString synchronous;    // OFF, NORMAL, FULL, EXTRA; empty picks by journal mode
+        QString tempStore;      // DEFAULT, FILE, MEMORY
+    };
+
+    // Secret fields, each in its own encrypted column
+    enum Field {
+        UsernameField = 0,
+        PasswordField = 1,
+        NotesField = 2
+    };
+
+    // Decrypted record cache counters, for sizing it
+    struct CacheStats {
+        CacheStats() : hits(0), misses(0), size(0), capacity(0) {}
+
+        qint64 hits;
+        qint64 misses;
+        int size;
+        int capacity;
+    };
+
+    // Blind index query for one field, see blindLookups
+    struct BlindLookup {
+        Field field;
+        QString sql;
+        QList<QByteArray> tokens;
+    };
+
+    // Everything a search runs, so it can run on another connection
+    struct SearchPlan {
+        SearchPlan() : aes(nullptr) {}
+
+        QString term;
+        QString sql;        // ids in result order, binds :pattern and :sitepattern
+        QString pattern;
+        QList<BlindLookup> blind;
+        const QtAes *aes;   // confirms the blind candidates, thread safe
+    };
+
+    // A new record encrypted ahead of its write, so the cipher work can run
+    // on other threads than the connection's
+    struct SealedKey {
+        QString name;
+        QString site;
+        QStringList fields;         // username, password, notes, encrypted
+        QList<QByteArray> tokens;   // blind index
+    };
+
+    // Each instance needs its own connection name to live beside another one
+    explicit KeyDatabase(const QString &connectionName = QLatin1String(QSqlDatabase::defaultConnection));
+
+    KeyTableModel *getQueryModel();
 
     void updateQueryModel(const QString &name);
     void getKeyInQueryModel(int row, KeyInfo *key);
+    // Decrypts only the one field
+    bool getFieldInQueryModel(int row, Field field, QString *value);
     QString getFilePath() { return filepath; }
+    bool hasKdf() const { return kdfParams.isValid(); }
+    const QtKdf::Params &getKdfParams() const { return kdfParams; }
 
     bool create(const QString &path, const QString &password, const QtAes *aes);
     bool open(const QString &path);
     bool addKeyInfo(const KeyInfo &key);
+    // thread safe, it only uses the key
+    SealedKey sealKeyInfo(const KeyInfo &key) const;
+    bool addSealedKey(const SealedKey &sealed);
+    // One column value as stored, without going through SQL
+    QString encryptField(const QString &value) const;
+    bool decryptField(const QString &encrypted, QString *value);
     bool updateKeyInfo(const KeyInfo &old, const KeyInfo &key);
     //bool addOrUpdateKeyInfo(const KeyInfo &key);
     bool deleteKeyInfo(int keyId);
     bool getKeyInfo(int id, KeyInfo *key);
+    // a row written on another connection, drops what was read of it
+    void forgetRow(int id);
+    bool getKeyField(int id, Field field, QString *value);
+    // names and sites in the order of ids, nothing is decrypted
+    bool getKeyNames(const QVector<int> &ids, QStringList *names, QStringList *sites);
     bool search(const QString &searchkey);
+    // Remembered like search, for updateQueryModel
+    SearchPlan planSearch(const QString &searchkey);
+    // Candidates of a blind lookup that really contain the term, minus known
+    QVector<int> confirmBlind(const QString &term, Field field,
+                              const QVector<int> &candidates, const QVector<int> &known);
+    // id, other and the field's column of count ids bound in order, for
+    // confirming candidates on another connection
+    static QString confirmSql(Field field, int count);
+    // One field from those two columns, touches nothing but the key
+    static bool decryptStored(const QtAes *aes, const QString &other, const QString &encrypted,
+                              Field field, QString *value);
     bool reverseKey(int count);
 
     void forgetPassword();
     bool activePassword(const QString &pass, const QtAes *aes);
     void close();
-    bool exportToFile(QFile *file);
-    bool importFromFile(QFile *file);
+    // Sealed with a key derived from password and a fresh salt, so any
+    // vault with the same password imports it. compress packs records into
+    // deflated blocks, for smaller uploads.
+    bool exportToFile(QFile *file, const QString &password, bool compress = true);
+    // password opens exports, older files are opened with the vault key
+    bool importFromFile(QFile *file, const QString &password);
+    // Brings back one record from an indexed export, nothing else is decrypted
+    bool restoreKeyInfo(QFile *file, int id, const QString &password);
+
+    void setBatchSize(int size) { defaultBatchSize = qMax(1, size); }
+    void setConfig(const Config &c) { config = c; }
+    const Config &getConfig() const { return config; }
+    bool beginBatch(int batchSize = 0);
+    bool addMany(const QList<KeyInfo> &keys);
+    bool commit();
+    bool isBatching() const { return batchDepth > 0; }
+
+    void setCacheSize(int entries) { keyCache.setMaxCost(qMax(1, entries)); }
+    CacheStats getCacheStats() const;
+    // wipes every decrypted record it holds
+    void clearCache();
 
     QString getLastErrorMessage() { return errorMessage; }
 
 private:
+    // a decrypted record, or the fields of it read so far. The secrets are
+    // kept as UTF-8 in the locked arena, never as heap QStrings.
+    struct CachedKey {
+        CachedKey() : fields(0), generation(0) {}
+
+        QString name;
+        QString site;
+        QtSecureBuffer values[3];   // indexed by Field
+        int fields;                 // one bit per Field
+        quint64 generation;         // writeGeneration when it was read
+    };
+
+    // one line of an export file, decoded off the writer thread
+    struct ImportedRecord {
+        ImportedRecord() : indexed(false) {}
 
+        QString id;
+        QString name;
+        QString site;
+        QString other;
+        QStringList fields;
+        QList<QByteArray> tokens;
+        bool indexed;           // tokens are known, else the index is rebuilt
+        QString error;
+    };
+
+    CachedKey *cachedKey(int id);
+    void touchRow(int id);
     bool decryptRecord(const QSqlRecord &record, KeyInfo *key);
     bool decryptQuery(QSqlQuery &query, KeyInfo *key);
+    bool applyConfig();
+    bool upgradeSchema();
+    bool openSearchIndex();
+    bool openBlindIndex();
+    bool rebuildBlindIndex();
+    bool indexRecord(int id, const KeyInfo &key);
+    bool writeBlindTokens(int id, const QList<QByteArray> &tokens);
+    QList<QByteArray> blindTokens(const KeyInfo &key) const;
+    bool unindexRecord(int id);
+    QList<BlindLookup> blindLookups(const QString &term);
+    void blindSearch(const QString &term, QVector<int> *ids);
+    bool migrateRecords();
+    bool loadHeader();
+    bool saveHeader(const QString &name, const QString &value);
     bool savePassword(const QString &pass);
     bool checkPassword(const QString &pass);
     QString getCryptoHash(const QString &source);
-    QString encryptByAES(const QString &source);
-    QString decryptByAES(const QString &source);
-    QString getEncryptedOther(const KeyInfo &key);
     bool setDecryptedOther(const QString &source, KeyInfo &key);
+    bool migrateOther(int id, const KeyInfo &key);
+    bool importFromStream(QFile *file, const QString &password);
+    bool importFromArchive(QFile *file, const QString &password);
+    bool importLines(QIODevice *in, bool legacy);
+    ImportedRecord sealImported(const KeyInfo &key) const;
+    ImportedRecord resealImported(const QString &id, const QString &name, const QString &site,
+                                  const QString &other, const QStringList &fields) const;
+    ImportedRecord decodeStreamLine(const QByteArray &line) const;
+    ImportedRecord decodeLegacyLine(const QByteArray &line) const;
+    bool importRecord(const ImportedRecord &record);
+    QSqlQuery &statement(const QString &sql);
+    void clearStatements();
+    void setModelQuery(const QString &sql, const QString &pattern, const QString &term = QString());
     void setErrorMessage(const QString &header, const QString &msg);
+    bool batchWritten();
 
     QSqlDatabase db;
-    QSqlQueryModel *queryModel;
-    QCryptographicHash *cryptoHash;
+    KeyTableModel *queryModel;
     const QtAes *cryptoAes;
+    bool verified;
+    bool searchIndex;
+    bool blindIndex;
     QString filepath;
+    QtKdf::Params kdfParams;
 
     QString errorMessage;
 
+    QHash<QString, QSqlQuery *> statements;
+
+    QCache<int, CachedKey> keyCache;
+    QHash<int, quint64> rowGenerations;
+    quint64 writeGeneration;
+    qint64 cacheHits;
+    qint64 cacheMisses;
+
+    Config config;
+    int defaultBatchSize;
+    int batchDepth;
+    int batchSize;
+    int batchPending;
+
     QString lastQuery;
+    QString lastPattern;
+    QString lastTerm;
 };
 
+Q_DECLARE_METATYPE(KeyDatabase::SearchPlan)
+
 #endif // KEYDATABASE_H
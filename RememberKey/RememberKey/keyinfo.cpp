@@ -1,4 +1,15 @@
 #include "keyinfo.h"
+#include "../QtAesLib/qtsecurememory.h"
+
+// Overwrite the characters if this is the only copy. Shared data is left
+// alone, the other owner still needs it and wipes it when it lets go.
+static void wipeString(QString &s)
+{
+    if(!s.isEmpty() && s.isDetached()) {
+        QtSecureMemory::wipe(s.data(), s.length() * sizeof(QChar));
+    }
+    s = "";
+}
 
 KeyInfo::KeyInfo():
     id(-1), name(""), site(""), username(""), password(""), notes("")
@@ -6,8 +17,18 @@ KeyInfo::KeyInfo():
 
 }
 
+KeyInfo::~KeyInfo()
+{
+    reset();
+}
+
 KeyInfo &KeyInfo::operator=(const KeyInfo &k)
 {
+    if(this == &k) {
+        return *this;
+    }
+    wipeString(password);
+    wipeString(notes);
     this->id = k.id;
     this->name = k.name;
     this->site = k.site;
@@ -23,7 +44,7 @@ void KeyInfo::reset()
     name = "";
     site = "";
     username = "";
-    password = "";
-    notes = "";
+    wipeString(password);
+    wipeString(notes);
 }
 
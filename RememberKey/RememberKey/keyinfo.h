@@ -7,6 +7,7 @@ class KeyInfo
 {
 public:
     explicit KeyInfo();
+    ~KeyInfo();
 
     void setId(int i) { id = i; }
     int getId() const { return id; }
@@ -0,0 +1,158 @@
+#include "keysearchworker.h"
+
+#include <QDebug>
+
+KeySearchWorker::KeySearchWorker(QObject *parent) :
+    QObject(parent),
+    connectionName(QString("rk.search.%1").arg((quintptr)this)),
+    latest(0)
+{
+    qRegisterMetaType<KeyDatabase::SearchPlan>("KeyDatabase::SearchPlan");
+    qRegisterMetaType<QVector<int> >("QVector<int>");
+}
+
+KeySearchWorker::~KeySearchWorker()
+{
+    close();
+}
+
+void KeySearchWorker::open(const QString &path)
+{
+    close();
+
+    // WAL lets this reader run beside the writer on the GUI thread
+    db = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+    db.setDatabaseName(path);
+    db.setConnectOptions("QSQLITE_OPEN_READONLY");
+    if(!db.open()) {
+        qDebug() << "Can't open search connection" << db.lastError().text();
+        return;
+    }
+}
+
+void KeySearchWorker::close()
+{
+    if(!db.isValid()) {
+        return;
+    }
+    db.close();
+    db = QSqlDatabase();
+    QSqlDatabase::removeDatabase(connectionName);
+}
+
+void KeySearchWorker::cancel(int serial)
+{
+    latest.store(serial);
+}
+
+void KeySearchWorker::search(int serial, const KeyDatabase::SearchPlan &plan)
+{
+    if(superseded(serial) || !db.isOpen()) {
+        return;
+    }
+
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    query.prepare(plan.sql);
+    if(plan.sql.contains(":pattern")) {
+        query.bindValue(":pattern", plan.pattern);
+    }
+    if(plan.sql.contains(":sitepattern")) {
+        query.bindValue(":sitepattern", plan.pattern);
+    }
+    if(!query.exec() && !superseded(serial)) {
+        qDebug() << "Can't search" << query.lastError().text();
+    }
+
+    QSet<int> known;
+    QVector<int> chunk;
+    while(query.next()) {
+        if(superseded(serial)) {
+            return;
+        }
+        int id = query.value(0).toInt();
+        known.insert(id);
+        chunk.append(id);
+        if(chunk.size() >= ChunkSize) {
+            emit found(serial, chunk);
+            chunk.clear();
+        }
+    }
+    query.finish();
+    if(superseded(serial)) {
+        return;
+    }
+    emit found(serial, chunk);
+
+    // a short term can match most of the vault, every page is one read
+    // and the search can be dropped between any two rows
+    if(plan.aes == nullptr) {
+        return;
+    }
+    for(const KeyDatabase::BlindLookup &lookup : plan.blind) {
+        if(superseded(serial)) {
+            return;
+        }
+        query.prepare(lookup.sql);
+        for(const QByteArray &token : lookup.tokens) {
+            query.addBindValue(token);
+        }
+        if(!query.exec()) {
+            if(!superseded(serial)) {
+                qDebug() << "Can't search blind index" << query.lastError().text();
+            }
+            continue;
+        }
+        QVector<int> candidates;
+        while(query.next()) {
+            int id = query.value(0).toInt();
+            if(!known.contains(id)) {
+                candidates.append(id);
+            }
+        }
+        query.finish();
+
+        for(int start = 0; start < candidates.size(); start += ChunkSize) {
+            if(superseded(serial)) {
+                return;
+            }
+            QVector<int> matches = confirm(serial, plan, lookup.field, candidates.mid(start, ChunkSize), &known);
+            if(!matches.isEmpty() && !superseded(serial)) {
+                emit found(serial, matches);
+            }
+        }
+    }
+}
+
+QVector<int> KeySearchWorker::confirm(int serial, const KeyDatabase::SearchPlan &plan, KeyDatabase::Field field,
+                                      const QVector<int> &candidates, QSet<int> *known)
+{
+    QVector<int> matches;
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    query.prepare(KeyDatabase::confirmSql(field, candidates.size()));
+    for(int id : candidates) {
+        query.addBindValue(id);
+    }
+    if(!query.exec()) {
+        if(!superseded(serial)) {
+            qDebug() << "Can't read blind candidates" << query.lastError().text();
+        }
+        return matches;
+    }
+
+    // the tokens only say the trigrams are there, not in that order
+    while(query.next() && !superseded(serial)) {
+        int id = query.value(0).toInt();
+        QString value;
+        if(!known->contains(id)
+                && KeyDatabase::decryptStored(plan.aes, query.value(1).toString(), query.value(2).toString(),
+                                              field, &value)
+                && value.contains(plan.term, Qt::CaseInsensitive)) {
+            known->insert(id);
+            matches.append(id);
+        }
+    }
+    query.finish();
+    return matches;
+}
@@ -0,0 +1,49 @@
+#ifndef KEYSEARCHWORKER_H
+#define KEYSEARCHWORKER_H
+
+#include <QObject>
+#include <QAtomicInt>
+#include <QtSql>
+
+#include "keydatabase.h"
+
+// Runs search plans on its own read-only connection, so it lives on a thread
+// of its own. Ids come back in chunks as sqlite steps through the result,
+// then blind index candidates are confirmed here a page at a time. cancel()
+// only bumps the serial, it is checked at every row and between the steps, so
+// a superseded search stops at the next one. The driver's sqlite handle isn't
+// touched, the plugin may carry its own copy of sqlite.
+class KeySearchWorker : public QObject
+{
+    Q_OBJECT
+
+public:
+    static const int ChunkSize = 512;
+
+    explicit KeySearchWorker(QObject *parent = 0);
+    ~KeySearchWorker();
+
+    // Thread safe, called from the GUI thread before queueing the next search
+    void cancel(int serial);
+
+public slots:
+    void open(const QString &path);
+    void close();
+    void search(int serial, const KeyDatabase::SearchPlan &plan);
+
+signals:
+    // The first chunk of a serial replaces the old results and is always
+    // sent, even empty; confirmed blind matches follow as more chunks
+    void found(int serial, const QVector<int> &ids);
+
+private:
+    bool superseded(int serial) const { return serial != latest.load(); }
+    QVector<int> confirm(int serial, const KeyDatabase::SearchPlan &plan, KeyDatabase::Field field,
+                         const QVector<int> &candidates, QSet<int> *known);
+
+    QString connectionName;
+    QSqlDatabase db;
+    QAtomicInt latest;
+};
+
+#endif // KEYSEARCHWORKER_H
@@ -0,0 +1,126 @@
+#include "keytablemodel.h"
+#include "keydatabase.h"
+
+#include <QDebug>
+
+KeyTableModel::KeyTableModel(KeyDatabase *database, QObject *parent) :
+    QAbstractTableModel(parent),
+    database(database),
+    pages(MaxPages)
+{
+}
+
+void KeyTableModel::setIds(const QVector<int> &keyIds)
+{
+    beginResetModel();
+    ids = keyIds;
+    pages.clear();
+    endResetModel();
+}
+
+void KeyTableModel::appendIds(const QVector<int> &keyIds)
+{
+    if(keyIds.isEmpty()) {
+        return;
+    }
+    int first = ids.size();
+    beginInsertRows(QModelIndex(), first, first + keyIds.size() - 1);
+    ids += keyIds;
+    // the last page may have been read short
+    pages.remove(first / PageSize);
+    endInsertRows();
+}
+
+void KeyTableModel::clear()
+{
+    setIds(QVector<int>());
+}
+
+void KeyTableModel::forget(int id)
+{
+    int row = ids.indexOf(id);
+    if(row >= 0) {
+        pages.remove(row / PageSize);
+        emit dataChanged(index(row, 0), index(row, ColumnCount - 1));
+    }
+}
+
+int KeyTableModel::keyId(int row) const
+{
+    if(row < 0 || row >= ids.size()) {
+        return -1;
+    }
+    return ids.at(row);
+}
+
+bool KeyTableModel::getKeyInfo(int row, KeyInfo *key)
+{
+    int id = keyId(row);
+    return id >= 0 && database->getKeyInfo(id, key);
+}
+
+bool KeyTableModel::getField(int row, int field, QString *value)
+{
+    int id = keyId(row);
+    return id >= 0 && database->getKeyField(id, (KeyDatabase::Field)field, value);
+}
+
+int KeyTableModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : ids.size();
+}
+
+int KeyTableModel::columnCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : ColumnCount;
+}
+
+QVariant KeyTableModel::data(const QModelIndex &index, int role) const
+{
+    if(!index.isValid() || index.row() >= ids.size()) {
+        return QVariant();
+    }
+    if(role == Qt::UserRole) {
+        return ids.at(index.row());
+    }
+    if(role != Qt::DisplayRole) {
+        return QVariant();
+    }
+
+    const Page *rows = page(index.row());
+    if(rows == nullptr) {
+        return QVariant();
+    }
+    int offset = index.row() % PageSize;
+    return index.column() == NameColumn ? rows->names.value(offset) : rows->sites.value(offset);
+}
+
+QVariant KeyTableModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if(role != Qt::DisplayRole) {
+        return QVariant();
+    }
+    if(orientation == Qt::Vertical) {
+        return section + 1;
+    }
+    return section == NameColumn ? tr("name") : tr("site");
+}
+
+const KeyTableModel::Page *KeyTableModel::page(int row) const
+{
+    int pageIndex = row / PageSize;
+    Page *cached = pages.object(pageIndex);
+    if(cached != nullptr) {
+        return cached;
+    }
+
+    Page *fetched = new Page();
+    QVector<int> pageIds = ids.mid(pageIndex * PageSize, PageSize);
+    if(!database->getKeyNames(pageIds, &fetched->names, &fetched->sites)) {
+        qDebug() << "Can't read page" << pageIndex << database->getLastErrorMessage();
+        delete fetched;
+        return nullptr;
+    }
+    pages.insert(pageIndex, fetched);
+    return fetched;
+}
@@ -0,0 +1,63 @@
+#ifndef KEYTABLEMODEL_H
+#define KEYTABLEMODEL_H
+
+#include <QAbstractTableModel>
+#include <QCache>
+#include <QVector>
+
+#include "keyinfo.h"
+
+class KeyDatabase;
+
+// Table of name and site over the ids of the current query. Only the ids
+// are held for every row; names and sites are read a page at a time for the
+// rows the view asks for, and secrets are decrypted (and cached by
+// KeyDatabase) only for the rows the user copies or edits. The page cache is
+// bounded, so scrolling a large vault costs a few pages, not the whole table.
+class KeyTableModel : public QAbstractTableModel
+{
+    Q_OBJECT
+
+public:
+    static const int PageSize = 256;
+    static const int MaxPages = 32;
+
+    enum Column {
+        NameColumn = 0,
+        SiteColumn = 1,
+        ColumnCount = 2
+    };
+
+    explicit KeyTableModel(KeyDatabase *database, QObject *parent = 0);
+
+    void setIds(const QVector<int> &keyIds);
+    // more rows of a search still coming in
+    void appendIds(const QVector<int> &keyIds);
+    const QVector<int> &getIds() const { return ids; }
+    void clear();
+    // a row was written or deleted, drops its page
+    void forget(int id);
+
+    int keyId(int row) const;
+    bool getKeyInfo(int row, KeyInfo *key);
+    bool getField(int row, int field, QString *value);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const;
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const;
+
+private:
+    struct Page {
+        QStringList names;
+        QStringList sites;
+    };
+
+    const Page *page(int row) const;
+
+    KeyDatabase *database;
+    QVector<int> ids;
+    mutable QCache<int, Page> pages;
+};
+
+#endif // KEYTABLEMODEL_H
@@ -1,9 +1,18 @@
 #include "mainwindow.h"
 #include <QApplication>
+#include <QTextStream>
+#include "../QtAesLib/qtcpufeatures.h"
 
 int main(int argc, char *argv[])
 {
     QApplication a(argc, argv);
+
+    // which cipher/base64/hash path this machine got
+    if(a.arguments().contains("--cpu-info")) {
+        QTextStream(stdout) << QtCpuFeatures::describe() << "\n";
+        return 0;
+    }
+
     MainWindow w;
     w.show();
 
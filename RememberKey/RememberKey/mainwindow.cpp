@@ -6,18 +6,35 @@
 #include <QMessageBox>
 #include <QClipboard>
 #include <QDesktopServices>
-#include <QDomDocument>
+#include <QHeaderView>
+#include <QFutureWatcher>
+#include <QProgressDialog>
+#include "keepassximporter.h"
+#include "kdbxreader.h"
 
 static const QString RK_LAST_SECTION = "rk.last.section";
 static const QString RK_DATABASE_FILEPATH = "rk.main.database.filepath";
 static const QString RK_CLIPBOARD_EXPIRE = "rk.main.clipboard.expire";
 static const QString RK_APP_EXPIRE = "rk.main.app.expire";
 static const QString RK_ONEDRIVE_ENABLED = "rk.main.onedrive.enable";
+static const QString RK_KDF_BUDGET = "rk.main.kdf.budget";
+static const QString RK_SESSION_WINDOW = "rk.main.session.window";
+static const QString RK_BATCH_SIZE = "rk.main.batch.size";
+static const QString RK_CACHE_SIZE = "rk.main.cache.size";
+static const QString RK_EXPORT_COMPRESS = "rk.main.export.compress";
+static const QString RK_SQLITE_JOURNAL_MODE = "rk.main.sqlite.journal_mode";
+static const QString RK_SQLITE_MMAP_SIZE = "rk.main.sqlite.mmap_size";
+static const QString RK_SQLITE_CACHE_SIZE = "rk.main.sqlite.cache_size";
+static const QString RK_SQLITE_SYNCHRONOUS = "rk.main.sqlite.synchronous";
+static const QString RK_SQLITE_TEMP_STORE = "rk.main.sqlite.temp_store";
 
 static const QString RK_APPLICATION_NAME = "RememberKey";
 static const QString RK_ORGANIZATION_NAME = "www.yvanhom.com";
 static const int RK_CLIPBOARD_TIMEOUT_DEFAULT = 10000;
 static const int RK_APP_TIMEOUT_DEFAULT = 25000;
+static const int RK_KDF_BUDGET_DEFAULT = 300;
+static const int RK_SESSION_WINDOW_DEFAULT = 300000;
+static const int RK_SEARCH_DELAY = 200;
 
 MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent),
@@ -29,12 +46,26 @@ MainWindow::MainWindow(QWidget *parent) :
     // These exist in all application time
     appSettings = new QSettings(RK_APPLICATION_NAME, RK_ORGANIZATION_NAME);
     database = new KeyDatabase;
+    writer = new AsyncKeyDatabase("rk.writer", this);
     createDialog = new CreateDialog(this);
     createDialog->setModal(true);
     editDialog = new EditDialog(this);
     editDialog->setModal(true);
     clipboardTimer = new QTimer(this);
     appTimer = new QTimer(this);
+    searchTimer = new QTimer(this);
+    searchTimer->setSingleShot(true);
+    searchTimer->setInterval(RK_SEARCH_DELAY);
+
+    // searches run on their own connection, typing never waits for sqlite
+    searchSerial = 0;
+    searchFirstChunk = false;
+    lockSerial = 0;
+    searchWorker = new KeySearchWorker;
+    searchWorker->moveToThread(&searchThread);
+    connect(&searchThread, &QThread::finished, searchWorker, &QObject::deleteLater);
+    connect(searchWorker, &KeySearchWorker::found, this, &MainWindow::searchFound);
+    searchThread.start();
 
     this->installEventFilter(this);
     editDialog->installEventFilter(this);
@@ -44,10 +75,12 @@ MainWindow::MainWindow(QWidget *parent) :
     settings = nullptr;
     onedriveDialog = nullptr;
     cryptoAes = nullptr;
+    sessionKey = nullptr;
 
     // 计时器
     connect(clipboardTimer, &QTimer::timeout, this, &MainWindow::clipboard_timeout);
     connect(appTimer, &QTimer::timeout, this, &MainWindow::app_timeout);
+    connect(searchTimer, &QTimer::timeout, this, &MainWindow::startSearch);
 
     // Deal with SettingDialog signals: Create Database file
     connect(createDialog, &CreateDialog::inputCreateReady, this, &MainWindow::createDatabase);
@@ -70,6 +103,8 @@ MainWindow::MainWindow(QWidget *parent) :
 MainWindow::~MainWindow()
 {
     closeSection();
+    searchThread.quit();
+    searchThread.wait();
     editDialog->deleteLater();
     createDialog->deleteLater();
     appSettings->deleteLater();
@@ -88,13 +123,36 @@ void MainWindow::createDatabase(const QString &path, const QString &pass, bool o
 
     // create database
     settings = new QSettings(path, QSettings::IniFormat);
+    kdfBudget = settings->value(RK_KDF_BUDGET, RK_KDF_BUDGET_DEFAULT).toInt();
+    sessionWindow = settings->value(RK_SESSION_WINDOW, RK_SESSION_WINDOW_DEFAULT).toInt();
+    batchSize = settings->value(RK_BATCH_SIZE, KeyDatabase::DefaultBatchSize).toInt();
+    database->setBatchSize(batchSize);
+    writer->setBatchSize(batchSize);
+    cacheSize = settings->value(RK_CACHE_SIZE, KeyDatabase::DefaultCacheSize).toInt();
+    database->setCacheSize(cacheSize);
+    compressExport = settings->value(RK_EXPORT_COMPRESS, true).toBool();
+    loadSqliteSettings();
+
+    // pick the key derivation cost for this machine
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    QtKdf::Params kdf = QtKdf::calibrate(kdfBudget);
     cryptoAes = new QtAes;
-    cryptoAes->initialize(pass);
+    sessionKey = new QtSessionKey(cryptoAes);
+    sessionKey->setWindow(sessionWindow);
+    bool derived = cryptoAes->initialize(pass, kdf);
+    QApplication::restoreOverrideCursor();
+    if(!derived) {
+        warnError(createDialog, tr("Can't derive key from password"));
+        return;
+    }
     QString dbpath = path + ".db";
     if(!database->create(dbpath, pass, cryptoAes)) {
         warnError(createDialog, database->getLastErrorMessage());
         return;
     }
+    writer->open(dbpath);
+    writer->activePassword(pass, cryptoAes);
+    sessionKey->hold(pass);
 
     // active mainwindow when success
     clipTimeout = RK_CLIPBOARD_TIMEOUT_DEFAULT;
@@ -146,17 +204,45 @@ bool MainWindow::activePassword()
         if(password.isEmpty()) {
             database->close();
             return false;
-        } else {
+        }
+
+        if(cryptoAes == nullptr) {
             cryptoAes = new QtAes;
-            cryptoAes->initialize(password);
-            if(database->activePassword(password, cryptoAes)) {
-                return true;
+            sessionKey = new QtSessionKey(cryptoAes);
+            sessionKey->setWindow(sessionWindow);
+        }
+
+        // a relock inside the session window keeps the derived keys
+        QtSessionKey::Result cached = sessionKey->unlock(password);
+        if(cached == QtSessionKey::Rejected) {
+            tipMsg = QString("%1\nInput Password: ").arg(tr("Check password failed: password mismatched"));
+            continue;
+        }
+        if(cached == QtSessionKey::Expired) {
+            if(database->hasKdf()) {
+                QApplication::setOverrideCursor(Qt::WaitCursor);
+                bool derived = cryptoAes->initialize(password, database->getKdfParams());
+                QApplication::restoreOverrideCursor();
+                if(!derived) {
+                    // another try won't help, the function isn't there
+                    warnError(this, QtKdf::isAvailable(database->getKdfParams().algorithm)
+                              ? tr("Can't derive key from password")
+                              : tr("Can't derive key from password: this vault's key derivation function isn't supported by this OpenSSL"));
+                    database->close();
+                    return false;
+                }
             } else {
-                delete cryptoAes;
-                cryptoAes = nullptr;
-                tipMsg = QString("%1\nInput Password: ").arg(database->getLastErrorMessage());
+                cryptoAes->initialize(password);
             }
         }
+        if(database->activePassword(password, cryptoAes)) {
+            writer->activePassword(password, cryptoAes);
+            sessionKey->hold(password);
+            return true;
+        } else {
+            sessionKey->clear();
+            tipMsg = QString("%1\nInput Password: ").arg(database->getLastErrorMessage());
+        }
     }
     warnError(this, tr("Sorry! You have failed 3 times"));
     return false;
@@ -165,8 +251,10 @@ bool MainWindow::activePassword()
 void MainWindow::activeMainWindow()
 {
     ui->itemsTable->setModel(database->getQueryModel());
-    ui->itemsTable->setColumnHidden(0, true);
-    ui->itemsTable->setColumnHidden(3, true);
+    // rows are a fixed height, so the view doesn't measure every one
+    ui->itemsTable->verticalHeader()->setSectionResizeMode(QHeaderView::Fixed);
+    QMetaObject::invokeMethod(searchWorker, "open", Qt::QueuedConnection,
+                              Q_ARG(QString, database->getFilePath()));
     //ui->itemsTable->resize
     ui->centralWidget->show();
     ui->menuEdit->setEnabled(true);
@@ -193,11 +281,51 @@ void MainWindow::warnError(QWidget *parent, const QString &errMsg)
 
 void MainWindow::on_searchEdit_returnPressed()
 {
-    if(!database->search(ui->searchEdit->text())) {
-        warnError(this, database->getLastErrorMessage());
+    startSearch();
+}
+
+void MainWindow::on_searchEdit_textChanged(const QString &)
+{
+    // waits for a pause in typing
+    searchTimer->start();
+}
+
+void MainWindow::startSearch()
+{
+    searchTimer->stop();
+    if(ui->centralWidget->isHidden()) {
+        return;
+    }
+
+    KeyDatabase::SearchPlan plan = database->planSearch(ui->searchEdit->text());
+    searchWorker->cancel(++searchSerial);
+    searchFirstChunk = true;
+    QMetaObject::invokeMethod(searchWorker, "search", Qt::QueuedConnection,
+                              Q_ARG(int, searchSerial), Q_ARG(KeyDatabase::SearchPlan, plan));
+}
+
+void MainWindow::searchFound(int serial, const QVector<int> &ids)
+{
+    if(serial != searchSerial) {
+        return;
+    }
+    // old results stay up until the new ones start arriving
+    if(searchFirstChunk) {
+        searchFirstChunk = false;
+        database->getQueryModel()->setIds(ids);
+    } else {
+        database->getQueryModel()->appendIds(ids);
     }
 }
 
+void MainWindow::cancelSearch()
+{
+    searchTimer->stop();
+    searchWorker->cancel(++searchSerial);
+    // the file may be replaced next, the worker lets go of it first
+    QMetaObject::invokeMethod(searchWorker, "close", Qt::BlockingQueuedConnection);
+}
+
 void MainWindow::on_actionAdd_triggered()
 {
     editDialog->setInfo(true, NULL);
@@ -206,14 +334,7 @@ void MainWindow::on_actionAdd_triggered()
 
 void MainWindow::addKeyInfo(const KeyInfo &key)
 {
-    if(!database->addKeyInfo(key)) {
-        warnError(editDialog, database->getLastErrorMessage());
-        return;
-    }
-    database->updateQueryModel(key.getName());
-
-    editDialog->close();
-    updateEditMenu(false);
+    runEdit(editDialog, writer->addKeyInfo(key), -1, key.getName());
 }
 
 void MainWindow::on_actionEdit_triggered()
@@ -228,14 +349,33 @@ void MainWindow::on_itemsTable_doubleClicked(const QModelIndex &index)
 
 void MainWindow::updateKeyInfo(const KeyInfo &old, const KeyInfo &key)
 {
-    if(!database->updateKeyInfo(old, key)) {
-        warnError(editDialog, database->getLastErrorMessage());
-        return;
-    }
-    database->updateQueryModel(key.getName());
+    runEdit(editDialog, writer->updateKeyInfo(old, key), old.getId(), key.getName());
+}
 
-    editDialog->close();
-    updateEditMenu(false);
+void MainWindow::runEdit(QWidget *parent, QFuture<bool> future, int keyId, const QString &name)
+{
+    // written by the worker behind any running job, the window doesn't
+    // wait for the disk
+    parent->setEnabled(false);
+    QFutureWatcher<bool> *watcher = new QFutureWatcher<bool>(this);
+    connect(watcher, &QFutureWatcher<bool>::finished, this, [this, watcher, parent, keyId, name]() {
+        watcher->deleteLater();
+        parent->setEnabled(true);
+        if(!watcher->result()) {
+            warnError(parent, writer->getLastErrorMessage());
+            return;
+        }
+        if(keyId >= 0) {
+            database->forgetRow(keyId);
+        }
+        database->updateQueryModel(name);
+
+        if(parent == editDialog) {
+            editDialog->close();
+        }
+        updateEditMenu(false);
+    });
+    watcher->setFuture(future);
 }
 
 void MainWindow::onedriveDialogFinished(int result)
@@ -273,24 +413,42 @@ void MainWindow::onedriveDownloadStatus(QFile *file, bool status, const QString
 {
     qDebug() << "Download finished";
 
+    if(!status) {
+        onedriveDialog->close();
+        QMessageBox::warning(this, tr("Operation failed"), tr("Can't upload file : %1").arg(msg));
+        file->deleteLater();
+        return;
+    }
+
+    // uploads of other vaults open with the same password, whatever their salt
+    QString password = QInputDialog::getText(this, tr(""),
+        tr("Password of the downloaded file: "), QLineEdit::Password);
+    if(password.isEmpty()) {
+        onedriveDialog->close();
+        file->deleteLater();
+        return;
+    }
+
     file->seek(0);
-    if(status) {
-        if(!database->importFromFile(file)) {
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    QFutureWatcher<bool> *watcher = new QFutureWatcher<bool>(this);
+    connect(watcher, &QFutureWatcher<bool>::finished, this, [this, watcher, file]() {
+        QApplication::restoreOverrideCursor();
+        watcher->deleteLater();
+        file->deleteLater();
+        if(onedriveDialog != nullptr) {
             onedriveDialog->close();
-            QMessageBox::warning(this, tr("Error"), tr("Can't import file : %1").arg(database->getLastErrorMessage()));
-            database->updateQueryModel("");
+        }
+        // imported rows may replace ones decrypted before
+        database->clearCache();
+        database->updateQueryModel("");
+        if(!watcher->result()) {
+            QMessageBox::warning(this, tr("Error"), tr("Can't import file : %1").arg(writer->getLastErrorMessage()));
         } else {
-            onedriveDialog->close();
-            database->updateQueryModel("");
-            //onedriveDialog->close();
             QMessageBox::information(this, tr("Operation success"), tr("Download and update database DONE"));
         }
-    } else {
-        onedriveDialog->close();
-        QMessageBox::warning(this, tr("Operation failed"), tr("Can't upload file : %1").arg(msg));
-    }
-
-    file->deleteLater();
+    });
+    watcher->setFuture(writer->importFromFile(file, password));
 }
 
 void MainWindow::on_actionDelete_triggered()
@@ -298,12 +456,7 @@ void MainWindow::on_actionDelete_triggered()
     KeyInfo key;
     getSelectedKeyInfo(-1, &key);
 
-    if(!database->deleteKeyInfo(key.getId())) {
-        warnError(this, database->getLastErrorMessage());
-        return;
-    }
-    database->updateQueryModel("");
-    updateEditMenu(false);
+    runEdit(ui->centralWidget, writer->deleteKeyInfo(key.getId()), key.getId(), QString());
 }
 
 void MainWindow::startEditDialog(int row)
@@ -317,9 +470,11 @@ void MainWindow::startEditDialog(int row)
 void MainWindow::on_actionCopy_Password_triggered()
 {
     QClipboard *board = QApplication::clipboard();
-    KeyInfo key;
-    getSelectedKeyInfo(-1, &key);
-    board->setText(key.getPassword());
+    QString password;
+    if(!getSelectedField(KeyDatabase::PasswordField, &password)) {
+        return;
+    }
+    board->setText(password);
 
     clipboardTimer->start();
 }
@@ -367,15 +522,47 @@ void MainWindow::saveSectionSettings()
     settings->setValue(RK_CLIPBOARD_EXPIRE, clipTimeout);
     settings->setValue(RK_APP_EXPIRE, appTimeout);
     settings->setValue(RK_ONEDRIVE_ENABLED, isOnedriveActive);
+    settings->setValue(RK_KDF_BUDGET, kdfBudget);
+    settings->setValue(RK_SESSION_WINDOW, sessionWindow);
+    settings->setValue(RK_BATCH_SIZE, batchSize);
+    settings->setValue(RK_CACHE_SIZE, cacheSize);
+    settings->setValue(RK_EXPORT_COMPRESS, compressExport);
+
+    const KeyDatabase::Config &config = database->getConfig();
+    settings->setValue(RK_SQLITE_JOURNAL_MODE, config.journalMode);
+    settings->setValue(RK_SQLITE_MMAP_SIZE, config.mmapSize);
+    settings->setValue(RK_SQLITE_CACHE_SIZE, config.cacheSize);
+    settings->setValue(RK_SQLITE_SYNCHRONOUS, config.synchronous);
+    settings->setValue(RK_SQLITE_TEMP_STORE, config.tempStore);
+}
+
+void MainWindow::loadSqliteSettings()
+{
+    KeyDatabase::Config config;
+    config.journalMode = settings->value(RK_SQLITE_JOURNAL_MODE, config.journalMode).toString();
+    config.mmapSize = settings->value(RK_SQLITE_MMAP_SIZE, config.mmapSize).toLongLong();
+    config.cacheSize = settings->value(RK_SQLITE_CACHE_SIZE, config.cacheSize).toInt();
+    config.synchronous = settings->value(RK_SQLITE_SYNCHRONOUS, config.synchronous).toString();
+    config.tempStore = settings->value(RK_SQLITE_TEMP_STORE, config.tempStore).toString();
+    database->setConfig(config);
+    writer->setConfig(config);
 }
 
 void MainWindow::closeSection()
 {
+    ++lockSerial;
+    cancelSearch();
     database->close();
+    // the worker may still use the key and the file, let it finish first
+    writer->close().waitForFinished();
     if(onedriveDialog != nullptr) {
         delete onedriveDialog;
         onedriveDialog = nullptr;
     }
+    if(sessionKey != nullptr) {
+        delete sessionKey;
+        sessionKey = nullptr;
+    }
     if(cryptoAes != nullptr) {
         delete cryptoAes;
         cryptoAes = nullptr;
@@ -428,10 +615,20 @@ bool MainWindow::loadSectionSettings()
     clipboardTimer->setInterval(clipTimeout);
     appTimeout = settings->value(RK_CLIPBOARD_EXPIRE, RK_APP_TIMEOUT_DEFAULT).toInt();
     appTimer->setInterval(appTimeout);
+    kdfBudget = settings->value(RK_KDF_BUDGET, RK_KDF_BUDGET_DEFAULT).toInt();
+    sessionWindow = settings->value(RK_SESSION_WINDOW, RK_SESSION_WINDOW_DEFAULT).toInt();
+    batchSize = settings->value(RK_BATCH_SIZE, KeyDatabase::DefaultBatchSize).toInt();
+    database->setBatchSize(batchSize);
+    writer->setBatchSize(batchSize);
+    cacheSize = settings->value(RK_CACHE_SIZE, KeyDatabase::DefaultCacheSize).toInt();
+    database->setCacheSize(cacheSize);
+    compressExport = settings->value(RK_EXPORT_COMPRESS, true).toBool();
+    loadSqliteSettings();
     if(!database->open(filepath)) {
         qDebug() << "Can't open database";
         return false;
     }
+    writer->open(filepath);
 
     if(!activePassword()) {
         qDebug() << "Can't active password";
@@ -460,8 +657,27 @@ void MainWindow::forgetPassword()
         editDialog->close();
     }
     deactiveMainWindow();
+    searchWorker->cancel(++searchSerial);
 
     database->forgetPassword();
+    // queued work finishes with the key before it goes, the password is
+    // asked for once it's gone
+    int serial = ++lockSerial;
+    QFutureWatcher<void> *watcher = new QFutureWatcher<void>(this);
+    connect(watcher, &QFutureWatcher<void>::finished, this, [this, watcher, serial]() {
+        watcher->deleteLater();
+        if(serial != lockSerial) {
+            // the section was closed or locked again meanwhile
+            return;
+        }
+        if(sessionKey != nullptr) {
+            sessionKey->lock();
+        }
+        if(activePassword()) {
+            activeMainWindow();
+        }
+    });
+    watcher->setFuture(writer->forgetPassword());
 }
 
 void MainWindow::getSelectedKeyInfo(int row, KeyInfo *key)
@@ -474,6 +690,12 @@ void MainWindow::getSelectedKeyInfo(int row, KeyInfo *key)
     database->getKeyInQueryModel(row, key);
 }
 
+bool MainWindow::getSelectedField(KeyDatabase::Field field, QString *value)
+{
+    QItemSelectionModel *select = ui->itemsTable->selectionModel();
+    return database->getFieldInQueryModel(select->currentIndex().row(), field, value);
+}
+
 void MainWindow::on_itemsTable_customContextMenuRequested(const QPoint &pos)
 {
     QModelIndex index = ui->itemsTable->indexAt(pos);
@@ -494,9 +716,11 @@ void MainWindow::on_itemsTable_clicked(const QModelIndex &index)
 void MainWindow::on_actionCopy_Username_triggered()
 {
     QClipboard *board = QApplication::clipboard();
-    KeyInfo key;
-    getSelectedKeyInfo(-1, &key);
-    board->setText(key.getUsername());
+    QString username;
+    if(!getSelectedField(KeyDatabase::UsernameField, &username)) {
+        return;
+    }
+    board->setText(username);
 
     clipboardTimer->start();
 }
@@ -513,12 +737,14 @@ void MainWindow::clipboard_timeout()
 void MainWindow::app_timeout()
 {
     qDebug() << "Application state " << appActive;
+    if(ui->centralWidget->isHidden()) {
+        // locked, or a job finished while it was
+        appTimer->stop();
+        return;
+    }
     if(!appActive) {
         qDebug() << "Try to forget password";
         forgetPassword();
-        if(activePassword()) {
-            activeMainWindow();
-        }
     }
     appActive = false;
 }
@@ -554,6 +780,18 @@ void MainWindow::on_actionActivate_triggered(bool checked)
 
 void MainWindow::on_actionUpload_triggered()
 {
+    // the file gets a key of its own, derived from the vault password, so
+    // the vaults it's synced to can open it
+    QString password = QInputDialog::getText(this, tr(""),
+        tr("Password for the uploaded file: "), QLineEdit::Password);
+    if(password.isEmpty()) {
+        return;
+    }
+    if(sessionKey != nullptr && sessionKey->matches(password) == QtSessionKey::Rejected) {
+        warnError(this, tr("Check password failed: password mismatched"));
+        return;
+    }
+
     QTemporaryFile *tempFile = new QTemporaryFile;
     if(!tempFile->open()) {
         QMessageBox::warning(this, tr("Error"), tr("Can't open temperary file for upload purpose"));
@@ -562,16 +800,30 @@ void MainWindow::on_actionUpload_triggered()
     }
     qDebug() << tempFile->fileName();
 
-    if(!database->exportToFile(tempFile)) {
-        QMessageBox::warning(this, tr("Error"), tr("Unable to export database : %1").arg(database->getLastErrorMessage()));
-        return;
-    }
-
-    tempFile->seek(0);
-
+    // encrypting a big vault takes a while, the window stays responsive
     appTimer->stop();
-    onedriveDialog->doUpload(tempFile);
-    onedriveDialog->show();
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    QFutureWatcher<bool> *watcher = new QFutureWatcher<bool>(this);
+    connect(watcher, &QFutureWatcher<bool>::finished, this, [this, watcher, tempFile]() {
+        QApplication::restoreOverrideCursor();
+        watcher->deleteLater();
+        if(onedriveDialog == nullptr) {
+            // the section was closed meanwhile
+            tempFile->deleteLater();
+            return;
+        }
+        if(!watcher->result()) {
+            appTimer->start();
+            QMessageBox::warning(this, tr("Error"), tr("Unable to export database : %1").arg(writer->getLastErrorMessage()));
+            tempFile->deleteLater();
+            return;
+        }
+
+        tempFile->seek(0);
+        onedriveDialog->doUpload(tempFile);
+        onedriveDialog->show();
+    });
+    watcher->setFuture(writer->exportToFile(tempFile, password, compressExport));
 }
 
 void MainWindow::on_actionDownload_triggered()
@@ -589,77 +841,71 @@ void MainWindow::on_actionDownload_triggered()
     onedriveDialog->show();
 }
 
-void MainWindow::import_GoThroughGroup(const QDomElement &ele, int *success, int *failed) {
-    auto nodeList = ele.childNodes();
-    for(int i = 0; i < nodeList.size(); i++) {
-        auto node = nodeList.at(i);
-        if(node.nodeName() == "group") {
-            if(node.namedItem("title").firstChild().toText().data() != "Backup" ) {
-                import_GoThroughGroup(node.toElement(), success, failed);
-            }
-        } else if(node.nodeName() == "entry") {
-            QDomNode title = node.namedItem("title");
-            QDomNode username = node.namedItem("username");
-            QDomNode password = node.namedItem("password");
-            QDomNode url = node.namedItem("url");
-            QDomNode comment = node.namedItem("comment");
-            QDomNode bindesc = node.namedItem("bindesc");
-            QDomNode bin = node.namedItem("bin");
-            KeyInfo key;
-            key.setName(title.firstChild().toText().data());
-            key.setUsername(username.firstChild().toText().data());
-            key.setPassword(password.firstChild().toText().data());
-            key.setSite(url.firstChild().toText().data());
-            QString notes;
-            QString commentStr = comment.firstChild().toText().data();
-            if(!commentStr.isEmpty()) {
-                notes.append(QString("Comment: %1\n").arg(commentStr));
-            }
-            if(!bindesc.isNull()) {
-                notes.append(QString("Filename %1\n").arg(bindesc.firstChild().toText().data()));
-                notes.append(QString("FileData: %1\n").arg(bin.firstChild().toText().data()));
-            }
-            key.setNotes(notes);
-            qDebug() << key.getName() << " " << key.getUsername() << " " << key.getPassword()<< " "
-                     << key.getSite() << " " << key.getNotes();
-            if(!database->addKeyInfo(key)) {
-                qDebug() << "Failed to add key" << database->getLastErrorMessage();
-                (*failed)++;
-            } else {
-                (*success)++;
-            }
+template<typename Importer>
+void MainWindow::runImport(const QString &filename, QFile *file, Importer *importer,
+                           std::function<bool(KeyDatabase *)> work)
+{
+    // parsed as it's read and written by the worker, big files neither
+    // fill the memory nor freeze the window
+    QProgressDialog *progress = new QProgressDialog(tr("Importing %1").arg(filename), QString(), 0, 1000, this);
+    progress->setWindowModality(Qt::WindowModal);
+    progress->setMinimumDuration(500);
+    connect(importer, &Importer::progress, progress, [progress](qint64 read, qint64 total) {
+        if(total > 0) {
+            progress->setValue(read * 1000 / total);
         }
-    }
+    });
+
+    appTimer->stop();
+    QFutureWatcher<bool> *watcher = new QFutureWatcher<bool>(this);
+    connect(watcher, &QFutureWatcher<bool>::finished, this, [this, watcher, importer, progress, file]() {
+        progress->deleteLater();
+        watcher->deleteLater();
+        importer->deleteLater();
+        file->deleteLater();
+        appTimer->start();
+
+        database->updateQueryModel("");
+        if(!watcher->result()) {
+            warnError(this, importer->getLastErrorMessage());
+        }
+        QMessageBox::information(this, tr("Import Finish"), tr("Add records: %1 succeeded, %2 failed")
+                                 .arg(importer->getSucceeded()).arg(importer->getFailed()));
+    });
+    watcher->setFuture(writer->run("import", work));
 }
 
 void MainWindow::on_actionImport_triggered()
 {
-    QString filename = QFileDialog::getOpenFileName(this, tr("Import from KeePassX XML"), tr(""), tr("KeePassX XML(*.xml)"));
+    QString filename = QFileDialog::getOpenFileName(this, tr("Import from KeePass"), tr(""),
+                                                    tr("KeePass database(*.kdbx);;KeePassX XML(*.xml)"));
     if(filename.isEmpty()) {
         return;
     }
 
-    QFile file(filename);
-    if(!file.open(QFile::ReadOnly | QFile::Text)) {
+    QFile *file = new QFile(filename);
+    if(!file->open(QFile::ReadOnly)) {
         QMessageBox::warning(this, tr("Operation Error"), tr("Can't open file %1").arg(filename));
+        delete file;
         return;
     }
 
-    QDomDocument dom;
-    QString         strError;
-    int             errLin = 0, errCol = 0;
-    if( !dom.setContent(&file, false, &strError, &errLin, &errCol)) {
-         QMessageBox::warning(this, tr("Xml file format error"),
-                                 tr("Error Message line %1 column %2 : %3").arg(errLin).arg(errCol).arg(strError));
-         return;
-    }
-    if(dom.isNull()) {
+    if(!KdbxReader::isKdbx(file)) {
+        KeePassXImporter *importer = new KeePassXImporter(this);
+        runImport(filename, file, importer, [importer, file](KeyDatabase *db) {
+            return importer->import(file, db);
+        });
         return;
     }
 
-    QDomElement root = dom.documentElement();
-    int success = 0;
-    int failed = 0;
-    import_GoThroughGroup(root, &success, &failed);
-    QMessageBox::information(this, tr("Import Finish"), tr("Add records: %1 succeeded, %2 failed").arg(success).arg(failed));
+    QString password = QInputDialog::getText(this, tr("Import from KeePass"),
+                                             tr("Password of %1: ").arg(filename), QLineEdit::Password);
+    if(password.isEmpty()) {
+        delete file;
+        return;
+    }
+    KdbxReader *reader = new KdbxReader(this);
+    runImport(filename, file, reader, [reader, file, password](KeyDatabase *db) {
+        return reader->import(file, password, db);
+    });
 }
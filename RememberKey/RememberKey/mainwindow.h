@@ -4,15 +4,18 @@
 #include <QMainWindow>
 #include <QtSql>
 #include <QTimer>
+#include <QThread>
 #include <QDateTime>
 #include <QUrl>
 #include <QSettings>
-#include <QDomDocument>
 #include "keydatabase.h"
+#include "keysearchworker.h"
+#include "asynckeydatabase.h"
 #include "createdialog.h"
 #include "editdialog.h"
 #include "onedrivedialog.h"
 #include "../QtOneDriveLib/qtonedrive.h"
+#include "../QtAesLib/qtsessionkey.h"
 
 namespace Ui {
 class MainWindow;
@@ -39,6 +42,7 @@ public slots:
 private slots:
     // used for UI
     void on_searchEdit_returnPressed();
+    void on_searchEdit_textChanged(const QString &text);
     void on_action_New_triggered();
     void on_action_Open_triggered();
     void on_itemsTable_doubleClicked(const QModelIndex &index);
@@ -60,9 +64,14 @@ private slots:
 
     void on_actionImport_triggered();
 
+    // used for search
+    void startSearch();
+    void searchFound(int serial, const QVector<int> &ids);
+
 private:
     void warnError(QWidget *parent, const QString &errMsg);
     void getSelectedKeyInfo(int row, KeyInfo *key);
+    bool getSelectedField(KeyDatabase::Field field, QString *value);
     void startEditDialog(int row);
 
     bool activePassword();
@@ -76,14 +85,19 @@ private:
     bool loadSettings();
     void saveSettings();
     bool loadSectionSettings();
+    void loadSqliteSettings();
     void saveSectionSettings();
     void closeSection();
+    void cancelSearch();
+    void runEdit(QWidget *parent, QFuture<bool> future, int keyId, const QString &name);
+    template<typename Importer>
+    void runImport(const QString &filename, QFile *file, Importer *importer,
+                   std::function<bool(KeyDatabase *)> work);
 
     void createOnedrive();
     void activeOnedrive();
     void deactiveOnedrive();
 
-    void import_GoThroughGroup(const QDomElement &ele, int *success, int *failed);
     QSettings getApplicationSettings();
 
     Ui::MainWindow *ui;
@@ -95,15 +109,30 @@ private:
     int clipTimeout;
     QTimer *appTimer;
     int appTimeout;
+    QTimer *searchTimer;
+    int kdfBudget;
+    int sessionWindow;
+    int batchSize;
+    int cacheSize;
+    bool compressExport;
     bool appActive;
 
     KeyDatabase *database;
+    // long operations and their writes, on the same file
+    AsyncKeyDatabase *writer;
+    QThread searchThread;
+    KeySearchWorker *searchWorker;
+    int searchSerial;
+    bool searchFirstChunk;
+    // bumped by each lock, a stale re-prompt is dropped
+    int lockSerial;
 
     bool isOnedriveActive;
 
     QSettings *appSettings;
     QSettings *settings;
     QtAes *cryptoAes;
+    QtSessionKey *sessionKey;
 };
 
 #endif // MAINWINDOW_H
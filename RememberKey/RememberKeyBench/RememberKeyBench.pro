@@ -0,0 +1,58 @@
+#-------------------------------------------------
+#
+# Crypto micro-benchmarks for QtAesLib and the record format
+#
+#-------------------------------------------------
+
+QT       += core sql concurrent
+QT       -= gui
+
+TARGET = RememberKeyBench
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+INCLUDEPATH += ../RememberKey
+
+SOURCES += main.cpp \
+    cryptobench.cpp \
+    ../RememberKey/keydatabase.cpp \
+    ../RememberKey/keyinfo.cpp \
+    ../RememberKey/keytablemodel.cpp \
+    ../RememberKey/keyarchive.cpp \
+    ../QtAesLib/qtaes.cpp \
+    ../QtAesLib/qtkdf.cpp \
+    ../QtAesLib/qtbase64.cpp \
+    ../QtAesLib/qtaesstream.cpp \
+    ../QtAesLib/qtsecurememory.cpp \
+    ../QtAesLib/qtcpufeatures.cpp \
+    ../QtAesLib/qthash.cpp
+
+HEADERS += cryptobench.h \
+    ../RememberKey/keydatabase.h \
+    ../RememberKey/keyinfo.h \
+    ../RememberKey/keytablemodel.h \
+    ../RememberKey/keyarchive.h \
+    ../RememberKey/boundedqueue.h \
+    ../RememberKey/importpipeline.h \
+    ../QtAesLib/qtaes.h \
+    ../QtAesLib/qtkdf.h \
+    ../QtAesLib/qtbase64.h \
+    ../QtAesLib/qtaesstream.h \
+    ../QtAesLib/qtsecurememory.h \
+    ../QtAesLib/qtcpufeatures.h \
+    ../QtAesLib/qthash.h
+
+unix {
+    INCLUDEPATH += /usr/local/include
+    LIBS += -L/usr/local/lib -L/usr/lib -lcrypto -lz
+}
+
+win32 {
+    # see QtAesLib.pro
+    isEmpty(WIN_DEPS): WIN_DEPS = C:/msys64/mingw64
+    LIBS += -L$$WIN_DEPS/lib -lcrypto -lz
+    INCLUDEPATH += $$WIN_DEPS/include
+}
+
+CONFIG(release, debug|release):DEFINES += QT_NO_DEBUG_OUTPUT
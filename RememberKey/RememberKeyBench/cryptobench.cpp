@@ -0,0 +1,271 @@
+#include "cryptobench.h"
+
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QSysInfo>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <algorithm>
+#include <openssl/opensslv.h>
+#include <openssl/rand.h>
+
+#include "../QtAesLib/qtaes.h"
+#include "../QtAesLib/qtbase64.h"
+#include "../QtAesLib/qtcpufeatures.h"
+
+static const int FIELD_SIZES[] = { 8, 64, 512, 4096, 65536, 1024 * 1024 };
+static const char BENCH_PASSWORD[] = "correct horse battery staple";
+
+// keeps the optimizer from dropping a result nobody reads
+static volatile int benchSink;
+
+static QByteArray randomBytes(int size)
+{
+    QByteArray bytes(size, '\0');
+    RAND_bytes((unsigned char *)bytes.data(), size);
+    return bytes;
+}
+
+static QString modeName(QtAes::CipherMode mode)
+{
+    switch(mode) {
+    case QtAes::AesGcm:
+        return "gcm";
+    case QtAes::ChaCha20Poly1305:
+        return "chacha20poly1305";
+    default:
+        return "ecb";
+    }
+}
+
+CryptoBench::CryptoBench(int minTimeMs, const QRegularExpression &filter) :
+    minTimeMs(minTimeMs), filter(filter)
+{
+}
+
+void CryptoBench::run()
+{
+    benchCipher();
+    benchInitialize();
+    benchBase64();
+    benchRecord();
+    benchInsert();
+}
+
+void CryptoBench::benchCipher()
+{
+    QtAes aes;
+    aes.initialize(BENCH_PASSWORD);
+
+    const QtAes::CipherMode modes[] = { QtAes::LegacyEcb, QtAes::AesGcm, QtAes::ChaCha20Poly1305 };
+    for(QtAes::CipherMode mode : modes) {
+        aes.setCipherMode(mode);
+        for(int size : FIELD_SIZES) {
+            QByteArray plain = randomBytes(size);
+            // ECB drops trailing zero bytes, keep the sizes comparable
+            plain.replace('\0', '\1');
+            QByteArray encrypted;
+            QByteArray decrypted;
+            aes.encrypt(plain, &encrypted);
+
+            QString suffix = QString("%1/%2").arg(modeName(mode)).arg(size);
+            measure("encrypt/" + suffix, size, [&]() {
+                aes.encrypt(plain, &encrypted);
+            });
+            measure("decrypt/" + suffix, size, [&]() {
+                benchSink = aes.decrypt(encrypted, &decrypted);
+            });
+        }
+    }
+}
+
+void CryptoBench::benchInitialize()
+{
+    QtAes aes;
+    measure("initialize/legacy", 0, [&]() {
+        aes.initialize(BENCH_PASSWORD);
+    });
+
+    // the floor parameters, calibrated vaults cost more by design
+    QtKdf::Algorithm algorithm = QtKdf::preferredAlgorithm();
+    QtKdf::Params params = QtKdf::minimumParams(algorithm);
+    QString name = QString("initialize/kdf/%1").arg(params.toString().section('$', 0, 0));
+    measure(name, 0, [&]() {
+        benchSink = aes.initialize(BENCH_PASSWORD, params);
+    });
+}
+
+void CryptoBench::benchBase64()
+{
+    for(int size : FIELD_SIZES) {
+        QByteArray plain = randomBytes(size);
+        QByteArray encoded(QtBase64::encodedLength(size), '\0');
+        QByteArray decoded(QtBase64::decodedMaxLength(encoded.length()), '\0');
+        QtBase64::encode(plain.constData(), size, encoded.data());
+
+        QString suffix = QString("%1/%2").arg(QtBase64::implementation()).arg(size);
+        measure("base64/encode/" + suffix, size, [&]() {
+            benchSink = QtBase64::encode(plain.constData(), size, encoded.data());
+        });
+        measure("base64/decode/" + suffix, size, [&]() {
+            benchSink = QtBase64::decode(encoded.constData(), encoded.length(), decoded.data());
+        });
+    }
+}
+
+void CryptoBench::benchRecord()
+{
+    // the key reaches the field format only through an unlocked database
+    QTemporaryDir dir;
+    QtAes aes;
+    aes.initialize(BENCH_PASSWORD);
+    if(!dir.isValid() || !database.create(dir.filePath("record.db"), BENCH_PASSWORD, &aes)) {
+        QTextStream(stderr) << "Can't create bench database " << database.getLastErrorMessage() << "\n";
+        return;
+    }
+
+    for(int size : FIELD_SIZES) {
+        KeyInfo key;
+        key.setUsername("someone@example.com");
+        key.setPassword("p4ssw0rd-p4ssw0rd");
+        key.setNotes(QString(size, QChar('n')));
+        qint64 bytes = key.getUsername().length() + key.getPassword().length() + size;
+
+        QString fields[3];
+        QString value;
+        QString suffix = QString("%1/%2").arg(modeName(aes.getCipherMode())).arg(size);
+        measure("record/" + suffix, bytes, [&]() {
+            fields[0] = database.encryptField(key.getUsername());
+            fields[1] = database.encryptField(key.getPassword());
+            fields[2] = database.encryptField(key.getNotes());
+            for(const QString &field : fields) {
+                benchSink = database.decryptField(field, &value);
+            }
+        });
+        // Copy Username next to a large note
+        measure("record/username/" + suffix, key.getUsername().length(), [&]() {
+            benchSink = database.decryptField(fields[0], &value);
+        });
+    }
+    database.close();
+}
+
+void CryptoBench::benchInsert()
+{
+    QTemporaryDir dir;
+    QtAes aes;
+    aes.initialize(BENCH_PASSWORD);
+    if(!dir.isValid() || !database.create(dir.filePath("bench.db"), BENCH_PASSWORD, &aes)) {
+        QTextStream(stderr) << "Can't create bench database " << database.getLastErrorMessage() << "\n";
+        return;
+    }
+
+    KeyInfo key;
+    key.setName("example.com");
+    key.setSite("https://example.com/login");
+    key.setUsername("someone@example.com");
+    key.setPassword("p4ssw0rd-p4ssw0rd");
+
+    // one fsync per row against one per batch
+    measure("insert/autocommit", 0, [&]() {
+        benchSink = database.addKeyInfo(key);
+    });
+    database.beginBatch(KeyDatabase::DefaultBatchSize);
+    measure(QString("insert/batch/%1").arg(KeyDatabase::DefaultBatchSize), 0, [&]() {
+        benchSink = database.addKeyInfo(key);
+    });
+    database.commit();
+    database.close();
+}
+
+void CryptoBench::measure(const QString &name, qint64 bytes, const std::function<void()> &op)
+{
+    if(!filter.match(name).hasMatch()) {
+        return;
+    }
+
+    // warm up contexts and caches, and size a batch at about 1/50 of the budget
+    QElapsedTimer timer;
+    timer.start();
+    op();
+    qint64 once = qMax<qint64>(timer.nsecsElapsed(), 1);
+    qint64 batch = qBound<qint64>(1, minTimeMs * 1000000LL / 50 / once, 1000000);
+
+    QVector<double> samples;
+    QElapsedTimer total;
+    total.start();
+    do {
+        timer.restart();
+        for(qint64 i = 0; i < batch; i++) {
+            op();
+        }
+        samples.append(double(timer.nsecsElapsed()) / batch);
+    } while(total.elapsed() < minTimeMs || samples.size() < 5);
+
+    std::sort(samples.begin(), samples.end());
+    double median = samples.at(samples.size() / 2);
+    double p99 = samples.at(qMin(samples.size() - 1, samples.size() * 99 / 100));
+
+    QJsonObject result;
+    result["name"] = name;
+    result["bytes"] = bytes;
+    result["samples"] = samples.size();
+    result["ops"] = samples.size() * batch;
+    result["ns_min"] = samples.first();
+    result["ns_median"] = median;
+    result["ns_p99"] = p99;
+    result["ops_per_s"] = 1e9 / median;
+    if(bytes > 0) {
+        result["mb_per_s"] = bytes * 1000.0 / median;
+    }
+    cases.append(result);
+
+    QTextStream(stderr) << QString("%1 %2 ns/op").arg(name, -40).arg(median, 14, 'f', 1)
+                        << (bytes > 0 ? QString("  %1 MB/s").arg(bytes * 1000.0 / median, 10, 'f', 1)
+                                      : QString("  %1 ops/s").arg(1e9 / median, 10, 'f', 1))
+                        << "\n";
+}
+
+QJsonObject CryptoBench::results() const
+{
+    QJsonObject environment;
+    environment["qt"] = QString(qVersion());
+    environment["openssl"] = QString(OPENSSL_VERSION_TEXT);
+    environment["cpu"] = QSysInfo::currentCpuArchitecture();
+    environment["os"] = QSysInfo::prettyProductName();
+    environment["dispatch"] = QtCpuFeatures::describe();
+    environment["base64"] = QString(QtBase64::implementation());
+    environment["cipher"] = modeName(QtAes::detectCipherMode());
+    environment["kdf"] = QtKdf::minimumParams(QtKdf::preferredAlgorithm()).toString().section('$', 0, 0);
+
+    QJsonObject root;
+    root["version"] = 1;
+    root["date"] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+    root["min_time_ms"] = minTimeMs;
+    root["environment"] = environment;
+    root["cases"] = cases;
+    return root;
+}
+
+QStringList CryptoBench::compare(const QJsonObject &baseline, double tolerance) const
+{
+    QHash<QString, double> before;
+    for(const QJsonValue &value : baseline["cases"].toArray()) {
+        QJsonObject result = value.toObject();
+        before.insert(result["name"].toString(), result["ns_median"].toDouble());
+    }
+
+    QStringList regressions;
+    for(const QJsonValue &value : cases) {
+        QJsonObject result = value.toObject();
+        QString name = result["name"].toString();
+        double old = before.value(name, 0);
+        double now = result["ns_median"].toDouble();
+        if(old > 0 && now > old * (1 + tolerance / 100)) {
+            regressions << QString("%1: %2 -> %3 ns/op (+%4%)")
+                           .arg(name).arg(old, 0, 'f', 1).arg(now, 0, 'f', 1)
+                           .arg((now / old - 1) * 100, 0, 'f', 1);
+        }
+    }
+    return regressions;
+}
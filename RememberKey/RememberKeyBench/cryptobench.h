@@ -0,0 +1,41 @@
+#ifndef CRYPTOBENCH_H
+#define CRYPTOBENCH_H
+
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QRegularExpression>
+#include <functional>
+
+#include "keydatabase.h"
+
+// Times QtAesLib and the record format, one case per operation and size.
+// Every case is run in batches until minTimeMs has passed; the per-op time of
+// each batch is one sample, reported as min/median/p99 plus throughput.
+class CryptoBench
+{
+public:
+    CryptoBench(int minTimeMs, const QRegularExpression &filter);
+
+    void run();
+
+    QJsonObject results() const;
+    // Cases whose median slowed down by more than tolerance percent
+    QStringList compare(const QJsonObject &baseline, double tolerance) const;
+
+private:
+    void benchCipher();
+    void benchInitialize();
+    void benchBase64();
+    void benchRecord();
+    void benchInsert();
+
+    // op does one operation, bytes is what it processes (0 for key setup)
+    void measure(const QString &name, qint64 bytes, const std::function<void()> &op);
+
+    int minTimeMs;
+    QRegularExpression filter;
+    QJsonArray cases;
+    KeyDatabase database;
+};
+
+#endif // CRYPTOBENCH_H
@@ -0,0 +1,72 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QFile>
+#include <QJsonDocument>
+#include <QTextStream>
+
+#include "cryptobench.h"
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName("RememberKeyBench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Crypto micro-benchmarks for RememberKey");
+    parser.addHelpOption();
+    QCommandLineOption outputOption(QStringList() << "o" << "output",
+                                    "Write JSON results to <file> instead of stdout.", "file");
+    QCommandLineOption timeOption(QStringList() << "t" << "min-time",
+                                  "Minimum time per case in milliseconds.", "ms", "200");
+    QCommandLineOption filterOption(QStringList() << "f" << "filter",
+                                    "Only run cases matching <regex>.", "regex", ".");
+    QCommandLineOption baselineOption(QStringList() << "b" << "baseline",
+                                      "Compare with an earlier result file.", "file");
+    QCommandLineOption toleranceOption("tolerance",
+                                       "Allowed slowdown against the baseline in percent.", "percent", "10");
+    parser.addOption(outputOption);
+    parser.addOption(timeOption);
+    parser.addOption(filterOption);
+    parser.addOption(baselineOption);
+    parser.addOption(toleranceOption);
+    parser.process(a);
+
+    QTextStream err(stderr);
+    QRegularExpression filter(parser.value(filterOption));
+    if(!filter.isValid()) {
+        err << "Bad filter: " << filter.errorString() << "\n";
+        return 2;
+    }
+
+    CryptoBench bench(qMax(1, parser.value(timeOption).toInt()), filter);
+    bench.run();
+
+    QByteArray json = QJsonDocument(bench.results()).toJson();
+    if(parser.isSet(outputOption)) {
+        QFile file(parser.value(outputOption));
+        if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(json) != json.length()) {
+            err << "Can't write " << file.fileName() << "\n";
+            return 2;
+        }
+    } else {
+        QTextStream(stdout) << json;
+    }
+
+    if(parser.isSet(baselineOption)) {
+        QFile file(parser.value(baselineOption));
+        if(!file.open(QIODevice::ReadOnly)) {
+            err << "Can't read " << file.fileName() << "\n";
+            return 2;
+        }
+        QJsonObject baseline = QJsonDocument::fromJson(file.readAll()).object();
+        QStringList regressions = bench.compare(baseline, parser.value(toleranceOption).toDouble());
+        for(const QString &regression : regressions) {
+            err << "REGRESSION " << regression << "\n";
+        }
+        err.flush();
+        // non-zero so a release script can stop here
+        return regressions.isEmpty() ? 0 : 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,477 @@
+#!/usr/bin/env python3
+#
+# Writes the KDBX fixtures of RememberKeyTest. Nothing but the standard
+# library and libcrypto (through ctypes) is needed, so the files can be
+# made again wherever the tests are. Seeds are fixed, every run writes the
+# same bytes.
+#
+#   python3 make_fixtures.py [output dir]
+#
+# Passwords and entries are listed in FIXTURES, tst_kdbxreader.cpp checks
+# the same values.
+
+import base64
+import ctypes
+import ctypes.util
+import hashlib
+import hmac
+import os
+import random
+import struct
+import sys
+import zlib
+
+# ---------------------------------------------------------------- libcrypto
+
+_crypto = ctypes.CDLL(ctypes.util.find_library('crypto') or 'libcrypto.so')
+for _name in ('EVP_aes_256_cbc', 'EVP_aes_256_ecb', 'EVP_chacha20', 'EVP_CIPHER_CTX_new'):
+    getattr(_crypto, _name).restype = ctypes.c_void_p
+_crypto.EVP_CIPHER_CTX_free.argtypes = [ctypes.c_void_p]
+_crypto.EVP_CIPHER_CTX_set_padding.argtypes = [ctypes.c_void_p, ctypes.c_int]
+_crypto.EVP_EncryptInit_ex.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_void_p,
+                                       ctypes.c_char_p, ctypes.c_char_p]
+_crypto.EVP_EncryptUpdate.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.POINTER(ctypes.c_int),
+                                      ctypes.c_char_p, ctypes.c_int]
+_crypto.EVP_EncryptFinal_ex.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.POINTER(ctypes.c_int)]
+
+
+def _encrypt(cipher, key, iv, data, padding=True):
+    ctx = _crypto.EVP_CIPHER_CTX_new()
+    try:
+        assert _crypto.EVP_EncryptInit_ex(ctx, cipher(), None, key, iv) == 1
+        _crypto.EVP_CIPHER_CTX_set_padding(ctx, 1 if padding else 0)
+        out = ctypes.create_string_buffer(len(data) + 32)
+        length = ctypes.c_int(0)
+        assert _crypto.EVP_EncryptUpdate(ctx, out, ctypes.byref(length), data, len(data)) == 1
+        total = length.value
+        tail = ctypes.create_string_buffer(32)
+        assert _crypto.EVP_EncryptFinal_ex(ctx, tail, ctypes.byref(length)) == 1
+        return out.raw[:total] + tail.raw[:length.value]
+    finally:
+        _crypto.EVP_CIPHER_CTX_free(ctx)
+
+
+def aes_cbc(key, iv, data):
+    return _encrypt(_crypto.EVP_aes_256_cbc, key, iv, data)
+
+
+def aes_ecb_rounds(key, block, rounds):
+    ctx = _crypto.EVP_CIPHER_CTX_new()
+    try:
+        assert _crypto.EVP_EncryptInit_ex(ctx, _crypto.EVP_aes_256_ecb(), None, key, None) == 1
+        _crypto.EVP_CIPHER_CTX_set_padding(ctx, 0)
+        buf = ctypes.create_string_buffer(block, len(block))
+        length = ctypes.c_int(0)
+        for _ in range(rounds):
+            assert _crypto.EVP_EncryptUpdate(ctx, buf, ctypes.byref(length), buf.raw, len(block)) == 1
+        return buf.raw
+    finally:
+        _crypto.EVP_CIPHER_CTX_free(ctx)
+
+
+def chacha20(key, nonce, data):
+    # OpenSSL takes the 32-bit block counter in front of the 96-bit nonce
+    return _encrypt(_crypto.EVP_chacha20, key, b'\0' * 4 + nonce, data, padding=False)
+
+# ------------------------------------------------------------------ Salsa20
+
+_M32 = 0xFFFFFFFF
+
+
+def _rotl(v, n):
+    return ((v << n) | (v >> (32 - n))) & _M32
+
+
+def salsa20_stream(key, nonce, length):
+    state = [0x61707865, *struct.unpack('<4I', key[:16]), 0x3320646e,
+             *struct.unpack('<2I', nonce), 0, 0, 0x79622d32,
+             *struct.unpack('<4I', key[16:]), 0x6b206574]
+    out = b''
+    while len(out) < length:
+        x = list(state)
+        for _ in range(10):
+            for a, b, c, d in ((0, 4, 8, 12), (5, 9, 13, 1), (10, 14, 2, 6), (15, 3, 7, 11),
+                               (0, 1, 2, 3), (5, 6, 7, 4), (10, 11, 8, 9), (15, 12, 13, 14)):
+                x[b] ^= _rotl((x[a] + x[d]) & _M32, 7)
+                x[c] ^= _rotl((x[b] + x[a]) & _M32, 9)
+                x[d] ^= _rotl((x[c] + x[b]) & _M32, 13)
+                x[a] ^= _rotl((x[d] + x[c]) & _M32, 18)
+        out += struct.pack('<16I', *[(x[i] + state[i]) & _M32 for i in range(16)])
+        state[8] = (state[8] + 1) & _M32
+        if state[8] == 0:
+            state[9] = (state[9] + 1) & _M32
+    return out[:length]
+
+# ------------------------------------------------------------------- Argon2
+# RFC 9106, checked against its test vectors before anything is written
+
+ARGON2D, ARGON2I, ARGON2ID = 0, 1, 2
+_M64 = 0xFFFFFFFFFFFFFFFF
+
+
+def _blake2b(data, size=64):
+    return hashlib.blake2b(data, digest_size=size).digest()
+
+
+def _hprime(length, data):
+    data = struct.pack('<I', length) + data
+    if length <= 64:
+        return _blake2b(data, length)
+    rounds = (length + 31) // 32 - 2
+    v = _blake2b(data)
+    out = v[:32]
+    for _ in range(rounds - 1):
+        v = _blake2b(v)
+        out += v[:32]
+    return out + _blake2b(v, length - 32 * rounds)
+
+
+def _gb(v, a, b, c, d):
+    va, vb, vc, vd = v[a], v[b], v[c], v[d]
+    va = (va + vb + 2 * (va & _M32) * (vb & _M32)) & _M64
+    vd ^= va
+    vd = ((vd >> 32) | (vd << 32)) & _M64
+    vc = (vc + vd + 2 * (vc & _M32) * (vd & _M32)) & _M64
+    vb ^= vc
+    vb = ((vb >> 24) | (vb << 40)) & _M64
+    va = (va + vb + 2 * (va & _M32) * (vb & _M32)) & _M64
+    vd ^= va
+    vd = ((vd >> 16) | (vd << 48)) & _M64
+    vc = (vc + vd + 2 * (vc & _M32) * (vd & _M32)) & _M64
+    vb ^= vc
+    vb = ((vb >> 63) | (vb << 1)) & _M64
+    v[a], v[b], v[c], v[d] = va, vb, vc, vd
+
+
+def _permute(v, idx):
+    _gb(v, idx[0], idx[4], idx[8], idx[12])
+    _gb(v, idx[1], idx[5], idx[9], idx[13])
+    _gb(v, idx[2], idx[6], idx[10], idx[14])
+    _gb(v, idx[3], idx[7], idx[11], idx[15])
+    _gb(v, idx[0], idx[5], idx[10], idx[15])
+    _gb(v, idx[1], idx[6], idx[11], idx[12])
+    _gb(v, idx[2], idx[7], idx[8], idx[13])
+    _gb(v, idx[3], idx[4], idx[9], idx[14])
+
+
+_ROWS = [list(range(16 * i, 16 * i + 16)) for i in range(8)]
+_COLUMNS = [[2 * i + 16 * r + k for r in range(8) for k in (0, 1)] for i in range(8)]
+
+
+def _compress(x, y):
+    r = [a ^ b for a, b in zip(x, y)]
+    z = list(r)
+    for row in _ROWS:
+        _permute(z, row)
+    for column in _COLUMNS:
+        _permute(z, column)
+    return [a ^ b for a, b in zip(z, r)]
+
+
+def _words(block):
+    return list(struct.unpack('<128Q', block))
+
+
+def argon2(kind, password, salt, passes, memory_kib, lanes, length, secret=b'', data=b''):
+    h0 = _blake2b(struct.pack('<6I', lanes, length, memory_kib, passes, 0x13, kind)
+                  + struct.pack('<I', len(password)) + password
+                  + struct.pack('<I', len(salt)) + salt
+                  + struct.pack('<I', len(secret)) + secret
+                  + struct.pack('<I', len(data)) + data)
+    blocks = 4 * lanes * (memory_kib // (4 * lanes))
+    lane_length = blocks // lanes
+    segment = lane_length // 4
+    memory = [None] * blocks
+    for lane in range(lanes):
+        for i in (0, 1):
+            memory[lane * lane_length + i] = _words(_hprime(1024, h0 + struct.pack('<II', i, lane)))
+
+    zero = [0] * 128
+    for p in range(passes):
+        for s in range(4):
+            for lane in range(lanes):
+                independent = kind == ARGON2I or (kind == ARGON2ID and p == 0 and s < 2)
+                addresses = None
+                counter = 0
+                start = 2 if p == 0 and s == 0 else 0
+                for index in range(start, segment):
+                    if independent and (addresses is None or index % 128 == 0):
+                        counter += 1
+                        seed = [p, lane, s, blocks, passes, kind, counter] + [0] * 121
+                        addresses = _compress(zero, _compress(zero, seed))
+                    current = lane * lane_length + s * segment + index
+                    previous = current - 1 if current % lane_length else current + lane_length - 1
+                    rand = addresses[index % 128] if independent else memory[previous][0]
+
+                    ref_lane = lane if p == 0 and s == 0 else (rand >> 32) % lanes
+                    same = ref_lane == lane
+                    if p == 0:
+                        if s == 0:
+                            area = index - 1
+                        elif same:
+                            area = s * segment + index - 1
+                        else:
+                            area = s * segment - (1 if index == 0 else 0)
+                    else:
+                        if same:
+                            area = lane_length - segment + index - 1
+                        else:
+                            area = lane_length - segment - (1 if index == 0 else 0)
+                    relative = rand & _M32
+                    relative = (relative * relative) >> 32
+                    relative = area - 1 - ((area * relative) >> 32)
+                    first = 0 if p == 0 or s == 3 else (s + 1) * segment
+                    ref = ref_lane * lane_length + (first + relative) % lane_length
+
+                    block = _compress(memory[previous], memory[ref])
+                    if p > 0:
+                        block = [a ^ b for a, b in zip(block, memory[current])]
+                    memory[current] = block
+
+    final = memory[lane_length - 1]
+    for lane in range(1, lanes):
+        final = [a ^ b for a, b in zip(final, memory[lane * lane_length + lane_length - 1])]
+    return _hprime(length, struct.pack('<128Q', *final))
+
+
+def check_argon2():
+    args = (b'\x01' * 32, b'\x02' * 16, 3, 32, 4, 32, b'\x03' * 8, b'\x04' * 12)
+    expected = {
+        ARGON2D: '512b391b6f1162975371d30919734294f868e3be3984f3c1a13a4db9fabe4acb',
+        ARGON2I: 'c814d9d1dc7f37aa13f0d77f2494bda1c8de6b016dd388d29952a4c4672b6ce8',
+        ARGON2ID: '0d640df58d78766c08c037a34a8b53c9d01ef0452d75b65eb52520e96b01e659',
+    }
+    for kind, tag in expected.items():
+        assert argon2(kind, *args).hex() == tag, 'Argon2 type %d differs from RFC 9106' % kind
+
+# --------------------------------------------------------------------- KDBX
+
+SIGNATURE = struct.pack('<II', 0x9AA2D903, 0xB54BFB67)
+CIPHER_AES256 = bytes.fromhex('31c1f2e6bf714350be5805216afc5aff')
+CIPHER_CHACHA20 = bytes.fromhex('d6038a2b8b6f4cb5a524339a31dbb59a')
+KDF_AES = bytes.fromhex('c9d9f39a628a4460bf740d08c18a4fea')
+KDF_ARGON2D = bytes.fromhex('ef636ddf8c29444b91f7a9a403e30a0c')
+KDF_ARGON2ID = bytes.fromhex('9e298b1956db4773b23dfc3ec6f0a1e6')
+SALSA20_NONCE = bytes.fromhex('e830094b97205d2a')
+INNER_SALSA20, INNER_CHACHA20 = 2, 3
+
+
+def _escape(text):
+    return text.replace('&', '&amp;').replace('<', '&lt;').replace('>', '&gt;')
+
+
+class InnerStream:
+    def __init__(self, kind, key):
+        if kind == INNER_SALSA20:
+            self.stream = salsa20_stream(hashlib.sha256(key).digest(), SALSA20_NONCE, 4096)
+        else:
+            digest = hashlib.sha512(key).digest()
+            self.stream = chacha20(digest[:32], digest[32:44], b'\0' * 4096)
+        self.pos = 0
+
+    def protect(self, value):
+        data = value.encode('utf-8')
+        pad = self.stream[self.pos:self.pos + len(data)]
+        self.pos += len(data)
+        return base64.b64encode(bytes(a ^ b for a, b in zip(data, pad))).decode('ascii')
+
+
+class Document:
+    def __init__(self, stream, rng):
+        self.stream = stream
+        self.rng = rng
+        self.parts = []
+
+    def uuid(self):
+        return base64.b64encode(bytes(self.rng.getrandbits(8) for _ in range(16))).decode('ascii')
+
+    def string(self, key, value, protected=False):
+        if protected:
+            value = '<Value Protected="True">%s</Value>' % self.stream.protect(value)
+        else:
+            value = '<Value>%s</Value>' % _escape(value)
+        self.parts.append('<String><Key>%s</Key>%s</String>' % (_escape(key), value))
+
+    def entry(self, entry):
+        self.parts.append('<Entry><UUID>%s</UUID>' % self.uuid())
+        for key in ('Title', 'UserName', 'Password', 'URL', 'Notes'):
+            self.string(key, entry.get(key, ''), key == 'Password')
+        for key, value in entry.get('extra', []):
+            self.string(key, value, entry.get('protectExtra', False))
+        if 'history' in entry:
+            self.parts.append('<History>')
+            for old in entry['history']:
+                self.entry(old)
+            self.parts.append('</History>')
+        self.parts.append('</Entry>')
+
+    def group(self, name, entries, groups=(), uuid=None):
+        self.parts.append('<Group><UUID>%s</UUID><Name>%s</Name>' % (uuid or self.uuid(), _escape(name)))
+        for entry in entries:
+            self.entry(entry)
+        for child in groups:
+            self.group(*child)
+        self.parts.append('</Group>')
+
+
+def document(fixture, stream, rng):
+    doc = Document(stream, rng)
+    recycle = doc.uuid()
+    doc.parts.append('<?xml version="1.0" encoding="utf-8" standalone="yes"?>\n<KeePassFile><Meta>'
+                     '<Generator>make_fixtures.py</Generator><DatabaseName>%s</DatabaseName>'
+                     '<RecycleBinEnabled>True</RecycleBinEnabled><RecycleBinUUID>%s</RecycleBinUUID>'
+                     '</Meta><Root>' % (fixture['name'], recycle))
+    groups = [('Network', fixture.get('nested', []))]
+    if 'recycled' in fixture:
+        groups.append(('Recycle Bin', fixture['recycled'], (), recycle))
+    doc.group('Root', fixture['entries'], groups)
+    doc.parts.append('<DeletedObjects/></Root></KeePassFile>\n')
+    return ''.join(doc.parts).encode('utf-8')
+
+
+def gzip(data):
+    packer = zlib.compressobj(9, zlib.DEFLATED, 31)
+    return packer.compress(data) + packer.flush()
+
+
+def composite_key(password):
+    return hashlib.sha256(hashlib.sha256(password.encode('utf-8')).digest()).digest()
+
+
+def variants(items):
+    out = struct.pack('<H', 0x0100)
+    for kind, name, value in items:
+        name = name.encode('utf-8')
+        out += struct.pack('<BI', kind, len(name)) + name + struct.pack('<I', len(value)) + value
+    return out + b'\0'
+
+
+def write_kdbx3(fixture, rng):
+    rand = lambda n: bytes(rng.getrandbits(8) for _ in range(n))
+    master_seed, transform_seed, iv = rand(32), rand(32), rand(16)
+    stream_key, start_bytes = rand(32), rand(32)
+    rounds = fixture['rounds']
+
+    fields = [(2, CIPHER_AES256), (3, struct.pack('<I', 1)), (4, master_seed), (5, transform_seed),
+              (6, struct.pack('<Q', rounds)), (7, iv), (8, stream_key), (9, start_bytes),
+              (10, struct.pack('<I', INNER_SALSA20)), (0, b'\r\n\r\n')]
+    header = SIGNATURE + struct.pack('<I', 0x00030001)
+    for field, data in fields:
+        header += struct.pack('<BH', field, len(data)) + data
+    if fixture.get('headerOnly'):
+        return header + rand(64)
+
+    transformed = hashlib.sha256(aes_ecb_rounds(transform_seed, composite_key(fixture['password']),
+                                                rounds)).digest()
+    key = hashlib.sha256(master_seed + transformed).digest()
+
+    payload = gzip(document(fixture, InnerStream(INNER_SALSA20, stream_key), rng))
+    # hashed blocks, small ones so the reader crosses a few boundaries
+    blocks = b''
+    index = 0
+    for pos in range(0, len(payload), 256):
+        data = payload[pos:pos + 256]
+        blocks += struct.pack('<I', index) + hashlib.sha256(data).digest() + struct.pack('<I', len(data)) + data
+        index += 1
+    blocks += struct.pack('<I', index) + b'\0' * 32 + struct.pack('<I', 0)
+    return header + aes_cbc(key, iv, start_bytes + blocks)
+
+
+def write_kdbx4(fixture, rng):
+    rand = lambda n: bytes(rng.getrandbits(8) for _ in range(n))
+    aes = fixture['cipher'] == 'aes'
+    master_seed, iv, salt, stream_key = rand(32), rand(16 if aes else 12), rand(32), rand(64)
+    composite = composite_key(fixture['password'])
+
+    kdf = fixture['kdf']
+    if kdf == 'aes':
+        params = variants([(0x42, '$UUID', KDF_AES), (0x42, 'S', salt),
+                           (0x05, 'R', struct.pack('<Q', fixture['rounds']))])
+        transformed = hashlib.sha256(aes_ecb_rounds(salt, composite, fixture['rounds'])).digest()
+    else:
+        kind = ARGON2D if kdf == 'argon2d' else ARGON2ID
+        params = variants([(0x42, '$UUID', KDF_ARGON2D if kind == ARGON2D else KDF_ARGON2ID),
+                           (0x42, 'S', salt), (0x04, 'P', struct.pack('<I', 2)),
+                           (0x05, 'M', struct.pack('<Q', 64 * 1024)), (0x05, 'I', struct.pack('<Q', 2)),
+                           (0x04, 'V', struct.pack('<I', 0x13))])
+        transformed = argon2(kind, composite, salt, 2, 64, 2, 32)
+
+    compressed = fixture.get('compressed', True)
+    fields = [(2, CIPHER_AES256 if aes else CIPHER_CHACHA20), (3, struct.pack('<I', 1 if compressed else 0)),
+              (4, master_seed), (7, iv), (11, params), (0, b'\r\n\r\n')]
+    header = SIGNATURE + struct.pack('<I', 0x00040000)
+    for field, data in fields:
+        header += struct.pack('<BI', field, len(data)) + data
+
+    key = hashlib.sha256(master_seed + transformed).digest()
+    hmac_key = hashlib.sha512(master_seed + transformed + b'\x01').digest()
+    block_key = lambda index: hashlib.sha512(struct.pack('<Q', index) + hmac_key).digest()
+
+    inner = (struct.pack('<BI', 1, 4) + struct.pack('<I', INNER_CHACHA20)
+             + struct.pack('<BI', 2, len(stream_key)) + stream_key
+             + struct.pack('<BI', 3, 5) + b'\x00file'
+             + struct.pack('<BI', 0, 0))
+    payload = inner + document(fixture, InnerStream(INNER_CHACHA20, stream_key), rng)
+    if compressed:
+        payload = gzip(payload)
+    payload = aes_cbc(key, iv, payload) if aes else chacha20(key, iv, payload)
+
+    out = header + hashlib.sha256(header).digest()
+    out += hmac.new(block_key(_M64), header, hashlib.sha256).digest()
+    index = 0
+    for pos in list(range(0, len(payload), 512)) + [len(payload)]:
+        data = payload[pos:pos + 512]
+        size = struct.pack('<I', len(data))
+        out += hmac.new(block_key(index), struct.pack('<Q', index) + size + data, hashlib.sha256).digest()
+        out += size + data
+        index += 1
+    return out
+
+# ----------------------------------------------------------------- fixtures
+
+MAIL = {'Title': 'Mail', 'UserName': 'alice@example.com', 'Password': 'correct horse battery',
+        'URL': 'https://mail.example.com', 'Notes': 'two-factor on'}
+BANK = {'Title': 'Bank', 'UserName': 'alice', 'Password': 'pässwörd ✓ <&>',
+        'URL': 'https://bank.example.com', 'extra': [('PIN', '4321')]}
+ROUTER = {'Title': 'Router', 'UserName': 'admin', 'Password': 'r0uter',
+          'Notes': 'line one\nline two'}
+
+FIXTURES = [
+    {'file': 'kdbx3-aeskdf-salsa20.kdbx', 'name': 'KDBX 3.1', 'version': 3,
+     'password': 'RememberKey 3.1', 'rounds': 6000,
+     'entries': [MAIL, BANK], 'nested': [ROUTER]},
+    {'file': 'kdbx4-argon2d-chacha20.kdbx', 'name': 'KDBX 4 Argon2d', 'version': 4,
+     'password': 'RememberKey Argon2d', 'kdf': 'argon2d', 'cipher': 'chacha20',
+     'entries': [MAIL, BANK], 'nested': [ROUTER]},
+    {'file': 'kdbx4-argon2id-chacha20.kdbx', 'name': 'KDBX 4 Argon2id', 'version': 4,
+     'password': 'RememberKey Argon2id', 'kdf': 'argon2id', 'cipher': 'chacha20', 'compressed': False,
+     'entries': [MAIL, BANK], 'nested': [ROUTER]},
+    # older copies and deleted entries carry protected values too, they
+    # must be read past without being imported
+    {'file': 'kdbx4-aeskdf-history.kdbx', 'name': 'KDBX 4 history', 'version': 4,
+     'password': 'RememberKey history', 'kdf': 'aes', 'rounds': 6000, 'cipher': 'aes',
+     'entries': [dict(MAIL, history=[dict(MAIL, Password='old horse'),
+                                     dict(MAIL, Password='older horse', URL='http://mail.example.com')]),
+                 dict(BANK, protectExtra=True)],
+     'nested': [ROUTER],
+     'recycled': [{'Title': 'Deleted', 'UserName': 'gone', 'Password': 'never imported',
+                   'history': [{'Title': 'Deleted', 'Password': 'nor this'}]}]},
+    # a header asking for more key transformation rounds than the reader allows
+    {'file': 'kdbx3-too-many-rounds.kdbx', 'name': 'KDBX 3.1 rounds', 'version': 3,
+     'password': 'RememberKey rounds', 'rounds': 1 << 40, 'headerOnly': True, 'entries': []},
+]
+
+
+def main():
+    check_argon2()
+    out = sys.argv[1] if len(sys.argv) > 1 else os.path.dirname(os.path.abspath(__file__))
+    for number, fixture in enumerate(FIXTURES):
+        rng = random.Random(number)
+        data = write_kdbx3(fixture, rng) if fixture['version'] == 3 else write_kdbx4(fixture, rng)
+        with open(os.path.join(out, fixture['file']), 'wb') as f:
+            f.write(data)
+        print('%s: %d bytes' % (fixture['file'], len(data)))
+
+
+if __name__ == '__main__':
+    main()
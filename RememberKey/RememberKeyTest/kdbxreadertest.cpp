@@ -0,0 +1,149 @@
+#include "kdbxreadertest.h"
+
+#include <QtTest>
+#include "kdbxreader.h"
+#include "../QtAesLib/qtkdf.h"
+
+Q_DECLARE_METATYPE(QtKdf::Algorithm)
+
+static const QString VAULT_PASSWORD = "vault password";
+
+static QString fixture(const QString &name)
+{
+    return QString(FIXTURES_DIR) + "/" + name;
+}
+
+void KdbxReaderTest::initTestCase()
+{
+    QVERIFY(dir.isValid());
+    // the vault's own key isn't what's tested, it needn't be slow
+    aes.initialize(VAULT_PASSWORD);
+}
+
+bool KdbxReaderTest::createVault(KeyDatabase *database, const QString &name)
+{
+    if(!database->create(dir.filePath(name + ".db"), VAULT_PASSWORD, &aes)) {
+        qWarning() << "Can't create vault" << database->getLastErrorMessage();
+        return false;
+    }
+    return true;
+}
+
+void KdbxReaderTest::importFixture_data()
+{
+    QTest::addColumn<QString>("file");
+    QTest::addColumn<QString>("password");
+    QTest::addColumn<QtKdf::Algorithm>("kdf");
+
+    // AES-KDF, gzip, AES-256 and a Salsa20 inner stream
+    QTest::newRow("kdbx3") << "kdbx3-aeskdf-salsa20.kdbx" << "RememberKey 3.1" << QtKdf::Pbkdf2Sha256;
+    // ChaCha20 outside and in the inner header, which also holds an attachment
+    QTest::newRow("kdbx4-argon2d") << "kdbx4-argon2d-chacha20.kdbx" << "RememberKey Argon2d" << QtKdf::Argon2d;
+    // and uncompressed
+    QTest::newRow("kdbx4-argon2id") << "kdbx4-argon2id-chacha20.kdbx" << "RememberKey Argon2id" << QtKdf::Argon2id;
+    // history and a recycle bin, both full of protected values that are skipped
+    QTest::newRow("kdbx4-history") << "kdbx4-aeskdf-history.kdbx" << "RememberKey history" << QtKdf::Pbkdf2Sha256;
+}
+
+void KdbxReaderTest::importFixture()
+{
+    QFETCH(QString, file);
+    QFETCH(QString, password);
+    QFETCH(QtKdf::Algorithm, kdf);
+
+    if(kdf != QtKdf::Pbkdf2Sha256 && !QtKdf::isAvailable(kdf)) {
+        QSKIP("Argon2 needs OpenSSL 3.2 or later");
+    }
+
+    KeyDatabase database(QString("kdbx.%1").arg(QTest::currentDataTag()));
+    QVERIFY(createVault(&database, QTest::currentDataTag()));
+
+    QFile in(fixture(file));
+    QVERIFY(in.open(QIODevice::ReadOnly));
+    KdbxReader reader;
+    QVERIFY2(reader.import(&in, password, &database), qPrintable(reader.getLastErrorMessage()));
+    QCOMPARE(reader.getSucceeded(), 3);
+    QCOMPARE(reader.getFailed(), 0);
+
+    QVERIFY(database.search(""));
+    KeyTableModel *model = database.getQueryModel();
+    QCOMPARE(model->rowCount(), 3);
+    QHash<QString, KeyInfo> keys;
+    for(int row = 0; row < model->rowCount(); row++) {
+        KeyInfo key;
+        QVERIFY(model->getKeyInfo(row, &key));
+        keys.insert(key.getName(), key);
+    }
+
+    QVERIFY(keys.contains("Mail"));
+    const KeyInfo &mail = keys["Mail"];
+    QCOMPARE(mail.getUsername(), QString("alice@example.com"));
+    // the current password, not one of the history's
+    QCOMPARE(mail.getPassword(), QString("correct horse battery"));
+    QCOMPARE(mail.getSite(), QString("https://mail.example.com"));
+    QCOMPARE(mail.getNotes(), QString("two-factor on"));
+
+    QVERIFY(keys.contains("Bank"));
+    const KeyInfo &bank = keys["Bank"];
+    QCOMPARE(bank.getUsername(), QString("alice"));
+    QCOMPARE(bank.getPassword(), QString::fromUtf8("pässwörd ✓ <&>"));
+    QCOMPARE(bank.getSite(), QString("https://bank.example.com"));
+    QCOMPARE(bank.getNotes(), QString("PIN: 4321"));
+
+    // from a nested group
+    QVERIFY(keys.contains("Router"));
+    const KeyInfo &router = keys["Router"];
+    QCOMPARE(router.getUsername(), QString("admin"));
+    QCOMPARE(router.getPassword(), QString("r0uter"));
+    QCOMPARE(router.getSite(), QString());
+    QCOMPARE(router.getNotes(), QString("line one\nline two"));
+
+    database.close();
+}
+
+void KdbxReaderTest::wrongPassword_data()
+{
+    QTest::addColumn<QString>("file");
+
+    // caught by the stream start bytes
+    QTest::newRow("kdbx3") << "kdbx3-aeskdf-salsa20.kdbx";
+    // caught by the header HMAC
+    QTest::newRow("kdbx4") << "kdbx4-aeskdf-history.kdbx";
+}
+
+void KdbxReaderTest::wrongPassword()
+{
+    QFETCH(QString, file);
+
+    KeyDatabase database(QString("wrong.%1").arg(QTest::currentDataTag()));
+    QVERIFY(createVault(&database, QString("wrong-%1").arg(QTest::currentDataTag())));
+
+    QFile in(fixture(file));
+    QVERIFY(in.open(QIODevice::ReadOnly));
+    KdbxReader reader;
+    QVERIFY(!reader.import(&in, "not the password", &database));
+    QCOMPARE(reader.getLastErrorMessage(), QString("Wrong password or damaged database"));
+    QCOMPARE(reader.getSucceeded(), 0);
+
+    QVERIFY(database.search(""));
+    QCOMPARE(database.getQueryModel()->rowCount(), 0);
+    database.close();
+}
+
+void KdbxReaderTest::tooManyRounds()
+{
+    KeyDatabase database("rounds");
+    QVERIFY(createVault(&database, "rounds"));
+
+    // 2^40 AES rounds would run for hours, it's refused before any
+    QFile in(fixture("kdbx3-too-many-rounds.kdbx"));
+    QVERIFY(in.open(QIODevice::ReadOnly));
+    KdbxReader reader;
+    QElapsedTimer timer;
+    timer.start();
+    QVERIFY(!reader.import(&in, "RememberKey rounds", &database));
+    QVERIFY(timer.elapsed() < 5000);
+    QVERIFY2(reader.getLastErrorMessage().contains("key transformation rounds"),
+             qPrintable(reader.getLastErrorMessage()));
+    database.close();
+}
@@ -0,0 +1,32 @@
+#ifndef KDBXREADERTEST_H
+#define KDBXREADERTEST_H
+
+#include <QObject>
+#include <QTemporaryDir>
+
+#include "keydatabase.h"
+
+// Imports the KDBX fixtures into a fresh vault and checks what came out.
+// The fixtures are made by fixtures/make_fixtures.py, which lists the same
+// passwords and entries.
+class KdbxReaderTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+
+    void importFixture_data();
+    void importFixture();
+    void wrongPassword_data();
+    void wrongPassword();
+    void tooManyRounds();
+
+private:
+    bool createVault(KeyDatabase *database, const QString &name);
+
+    QTemporaryDir dir;
+    QtAes aes;
+};
+
+#endif // KDBXREADERTEST_H
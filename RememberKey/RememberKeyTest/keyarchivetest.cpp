@@ -0,0 +1,181 @@
+#include "keyarchivetest.h"
+
+#include <QtTest>
+#include <QBuffer>
+#include <QTemporaryFile>
+#include "../QtAesLib/qtaesstream.h"
+
+static const QString VAULT_PASSWORD = "shared password";
+
+void KeyArchiveTest::initTestCase()
+{
+    QVERIFY(dir.isValid());
+    // each vault draws its own salt, as two installs would
+    QVERIFY(first.initialize(VAULT_PASSWORD, QtKdf::minimumParams(QtKdf::Pbkdf2Sha256)));
+    QVERIFY(second.initialize(VAULT_PASSWORD, QtKdf::minimumParams(QtKdf::Pbkdf2Sha256)));
+    QVERIFY(first.getVerifier() != second.getVerifier());
+
+    const char *values[][5] = {
+        { "Mail", "https://mail.example.com", "alice@example.com", "correct horse battery", "two-factor on" },
+        { "Bank", "https://bank.example.com", "alice", "pässwörd ✓", "PIN: 4321" },
+        { "Router", "", "admin", "r0uter", "line one\nline two" }
+    };
+    for(int i = 0; i < 3; i++) {
+        KeyInfo key;
+        key.setName(QString::fromUtf8(values[i][0]));
+        key.setSite(QString::fromUtf8(values[i][1]));
+        key.setUsername(QString::fromUtf8(values[i][2]));
+        key.setPassword(QString::fromUtf8(values[i][3]));
+        key.setNotes(QString::fromUtf8(values[i][4]));
+        keys.append(key);
+    }
+}
+
+bool KeyArchiveTest::createVault(KeyDatabase *database, QtAes *aes, const QString &name)
+{
+    if(!database->create(dir.filePath(name + ".db"), VAULT_PASSWORD, aes)) {
+        qWarning() << "Can't create vault" << database->getLastErrorMessage();
+        return false;
+    }
+    return true;
+}
+
+QList<KeyInfo> KeyArchiveTest::readAll(KeyDatabase *database)
+{
+    QList<KeyInfo> found;
+    database->search("");
+    KeyTableModel *model = database->getQueryModel();
+    for(int row = 0; row < model->rowCount(); row++) {
+        KeyInfo key;
+        if(model->getKeyInfo(row, &key)) {
+            found.append(key);
+        }
+    }
+    return found;
+}
+
+static bool sameKeys(QList<KeyInfo> expected, QList<KeyInfo> actual)
+{
+    if(expected.size() != actual.size()) {
+        return false;
+    }
+    foreach(const KeyInfo &key, expected) {
+        bool matched = false;
+        foreach(const KeyInfo &other, actual) {
+            matched = matched || (key.getName() == other.getName() && key.getSite() == other.getSite()
+                                  && key.getUsername() == other.getUsername()
+                                  && key.getPassword() == other.getPassword()
+                                  && key.getNotes() == other.getNotes());
+        }
+        if(!matched) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void KeyArchiveTest::acrossVaults_data()
+{
+    QTest::addColumn<bool>("compress");
+
+    QTest::newRow("compressed") << true;
+    QTest::newRow("plain") << false;
+}
+
+void KeyArchiveTest::acrossVaults()
+{
+    QFETCH(bool, compress);
+    QString tag = QTest::currentDataTag();
+
+    KeyDatabase source("source." + tag);
+    QVERIFY(createVault(&source, &first, "source-" + tag));
+    foreach(const KeyInfo &key, keys) {
+        QVERIFY2(source.addKeyInfo(key), qPrintable(source.getLastErrorMessage()));
+    }
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    QVERIFY2(source.exportToFile(&file, VAULT_PASSWORD, compress), qPrintable(source.getLastErrorMessage()));
+    source.close();
+
+    KeyDatabase target("target." + tag);
+    QVERIFY(createVault(&target, &second, "target-" + tag));
+    QVERIFY(file.seek(0));
+    QVERIFY2(target.importFromFile(&file, VAULT_PASSWORD), qPrintable(target.getLastErrorMessage()));
+    QVERIFY(sameKeys(keys, readAll(&target)));
+    target.close();
+}
+
+void KeyArchiveTest::restoreAcrossVaults()
+{
+    KeyDatabase source("restore.source");
+    QVERIFY(createVault(&source, &first, "restore-source"));
+    foreach(const KeyInfo &key, keys) {
+        QVERIFY(source.addKeyInfo(key));
+    }
+    QList<KeyInfo> exported = readAll(&source);
+    QCOMPARE(exported.size(), keys.size());
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    QVERIFY2(source.exportToFile(&file, VAULT_PASSWORD), qPrintable(source.getLastErrorMessage()));
+    source.close();
+
+    // one record out of the index, the others stay sealed
+    KeyDatabase target("restore.target");
+    QVERIFY(createVault(&target, &second, "restore-target"));
+    const KeyInfo &wanted = exported.at(1);
+    QVERIFY2(target.restoreKeyInfo(&file, wanted.getId(), VAULT_PASSWORD),
+             qPrintable(target.getLastErrorMessage()));
+    QVERIFY(sameKeys(QList<KeyInfo>() << wanted, readAll(&target)));
+    target.close();
+}
+
+void KeyArchiveTest::wrongPassword()
+{
+    KeyDatabase source("wrong.source");
+    QVERIFY(createVault(&source, &first, "wrong-source"));
+    foreach(const KeyInfo &key, keys) {
+        QVERIFY(source.addKeyInfo(key));
+    }
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    QVERIFY(source.exportToFile(&file, VAULT_PASSWORD));
+    source.close();
+
+    KeyDatabase target("wrong.target");
+    QVERIFY(createVault(&target, &second, "wrong-target"));
+    QVERIFY(file.seek(0));
+    QVERIFY(!target.importFromFile(&file, "another password"));
+    QVERIFY(readAll(&target).isEmpty());
+    target.close();
+}
+
+void KeyArchiveTest::streamAcrossKeys()
+{
+    QByteArray plain(3 * 1000 + 17, '\0');
+    for(int i = 0; i < plain.size(); i++) {
+        plain[i] = (char)(i * 31);
+    }
+
+    // small chunks, so several of them and a short last one
+    QBuffer in(&plain);
+    in.open(QIODevice::ReadOnly);
+    QBuffer sealed;
+    sealed.open(QIODevice::ReadWrite);
+    QtAesStream writer(VAULT_PASSWORD, nullptr, 1000);
+    QVERIFY2(writer.encrypt(&in, &sealed), qPrintable(writer.getLastErrorMessage()));
+
+    sealed.seek(0);
+    QVERIFY(QtAesStream::isStream(&sealed));
+    QBuffer out;
+    out.open(QIODevice::ReadWrite);
+    QtAesStream reader(VAULT_PASSWORD);
+    QVERIFY2(reader.decrypt(&sealed, &out), qPrintable(reader.getLastErrorMessage()));
+    QCOMPARE(out.data(), plain);
+
+    sealed.seek(0);
+    QBuffer wrong;
+    wrong.open(QIODevice::ReadWrite);
+    QtAesStream stranger("another password");
+    QVERIFY(!stranger.decrypt(&sealed, &wrong));
+    QVERIFY(wrong.data().isEmpty());
+}
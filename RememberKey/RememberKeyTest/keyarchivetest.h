@@ -0,0 +1,35 @@
+#ifndef KEYARCHIVETEST_H
+#define KEYARCHIVETEST_H
+
+#include <QObject>
+#include <QTemporaryDir>
+
+#include "keydatabase.h"
+
+// Exports of one vault imported into another with the same password. The
+// two vaults have their own KDF salts, so their keys differ; only the
+// password is shared.
+class KeyArchiveTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+
+    void acrossVaults_data();
+    void acrossVaults();
+    void restoreAcrossVaults();
+    void wrongPassword();
+    void streamAcrossKeys();
+
+private:
+    bool createVault(KeyDatabase *database, QtAes *aes, const QString &name);
+    QList<KeyInfo> readAll(KeyDatabase *database);
+
+    QTemporaryDir dir;
+    QtAes first;
+    QtAes second;
+    QList<KeyInfo> keys;
+};
+
+#endif // KEYARCHIVETEST_H
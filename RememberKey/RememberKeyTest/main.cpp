@@ -0,0 +1,17 @@
+#include <QCoreApplication>
+#include <QtTest>
+
+#include "kdbxreadertest.h"
+#include "keyarchivetest.h"
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+
+    int status = 0;
+    KdbxReaderTest kdbx;
+    status |= QTest::qExec(&kdbx, argc, argv);
+    KeyArchiveTest archive;
+    status |= QTest::qExec(&archive, argc, argv);
+    return status;
+}